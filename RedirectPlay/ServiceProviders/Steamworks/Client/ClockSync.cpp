@@ -0,0 +1,101 @@
+#include "ClockSync.h"
+
+#include <algorithm>
+
+void CClockSync::OnRequestSent(TClock::time_point now)
+{
+	m_nextRequest = now + (m_sampleCount < s_sampleCount ? s_fastInterval : s_interval);
+}
+
+bool CClockSync::AddSample(uint64 requestTime, uint64 serverTime, TClock::time_point received)
+{
+	using std::chrono::duration_cast;
+	using std::chrono::microseconds;
+
+	int64 const sent      = static_cast<int64>(requestTime);
+	int64 const arrived   = static_cast<int64>(ToMicroseconds(received));
+	int64 const roundTrip = arrived - sent;
+	if (roundTrip < 0 || roundTrip > duration_cast<microseconds>(s_maxRoundTrip).count())
+	{
+		return false;
+	}
+
+	int64 const session = static_cast<int64>(serverTime);
+	SSample const sample{ sent + roundTrip / 2, session - (sent + roundTrip / 2), roundTrip };
+	m_samples[m_nextSample] = sample;
+	m_nextSample  = (m_nextSample + 1) % s_sampleCount;
+	m_sampleCount = (std::min)(m_sampleCount + 1, s_sampleCount);
+
+	m_best = 0;
+	for (size_t i = 1; i < m_sampleCount; ++i)
+	{
+		if (m_samples[i].roundTrip < m_samples[m_best].roundTrip)
+		{
+			m_best = i;
+		}
+	}
+
+	// the drift is measured between filtered samples, the others would only add their queueing delays
+	SSample const& best = m_samples[m_best];
+	if (!m_hasDriftAnchor)
+	{
+		m_driftAnchor    = best;
+		m_hasDriftAnchor = true;
+	}
+	else if (best.local - m_driftAnchor.local >= duration_cast<microseconds>(s_minDriftSpan).count())
+	{
+		double const measured = std::clamp(static_cast<double>(best.offset - m_driftAnchor.offset) / static_cast<double>(best.local - m_driftAnchor.local), -s_maxDrift, s_maxDrift);
+		m_drift       = m_drift == 0.0 ? measured : m_drift + (measured - m_drift) / 4.0;
+		m_driftAnchor = best;
+	}
+
+	double const toServer   = static_cast<double>((std::max)(int64(0), session - (sent + GetOffset(sent))));
+	double const fromServer = static_cast<double>((std::max)(int64(0), arrived + GetOffset(arrived) - session));
+	if (m_sampleCount == 1)
+	{
+		m_toServer   = toServer;
+		m_fromServer = fromServer;
+	}
+	else
+	{
+		m_toServer   += (toServer - m_toServer) / 8.0;
+		m_fromServer += (fromServer - m_fromServer) / 8.0;
+	}
+	return true;
+}
+
+TClock::duration CClockSync::GetSessionTime(TClock::time_point now) const
+{
+	int64 const local = static_cast<int64>(ToMicroseconds(now));
+	return std::chrono::microseconds(local + GetOffset(local));
+}
+
+SClockLatency CClockSync::GetLatency() const
+{
+	std::chrono::microseconds const toServer(static_cast<int64>(m_toServer));
+	std::chrono::microseconds const fromServer(static_cast<int64>(m_fromServer));
+	return SClockLatency{ toServer + fromServer, toServer, fromServer };
+}
+
+void CClockSync::Write(Log::ESource source) const
+{
+	if (!IsSynchronized())
+	{
+		return;
+	}
+
+	SSample const& best = m_samples[m_best];
+	Log::Write(Log::ELevel::Info, source, "Session clock offset %lldus, drift %.1fppm, best round trip %lldus, %.0fus to the server, %.0fus back.",
+		static_cast<long long>(best.offset), m_drift * 1e6, static_cast<long long>(best.roundTrip), m_toServer, m_fromServer);
+}
+
+uint64 CClockSync::ToMicroseconds(TClock::time_point time)
+{
+	return static_cast<uint64>(std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch()).count());
+}
+
+int64 CClockSync::GetOffset(int64 local) const
+{
+	SSample const& best = m_samples[m_best];
+	return best.offset + static_cast<int64>(m_drift * static_cast<double>(local - best.local));
+}
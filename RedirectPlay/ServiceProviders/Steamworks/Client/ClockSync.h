@@ -0,0 +1,74 @@
+#pragma once
+
+#include "../SteamTypes.h"
+#include "Log.h"
+
+#include "Steam/steamtypes.h"
+
+#include <array>
+
+// Estimate of the server's session clock with EFeature::ClockSync, see Messages::Client::STimeRequest.
+//
+// The client periodically sends its TClock time, the server answers with it and its session clock.
+// Each answer is a sample of the offset between both clocks, taken halfway through its round trip.
+// Queueing only ever delays messages, so the sample with the shortest round trip among the last s_sampleCount
+// is the most accurate one, the others are filtered out. The drift between both clocks is measured across
+// filtered samples at least s_minDriftSpan apart, it carries the estimate forward until the next sample.
+// One way latencies are smoothed per sample against the filtered offset, so they show on which way messages queue.
+
+struct SClockLatency
+{
+	TClock::duration roundTrip;
+	TClock::duration toServer;
+	TClock::duration fromServer;
+};
+
+class CClockSync
+{
+public:
+	static constexpr size_t           s_sampleCount   = 8;
+	static constexpr TClock::duration s_fastInterval  = std::chrono::milliseconds(200); // until the filter is filled
+	static constexpr TClock::duration s_interval      = std::chrono::seconds(2);
+	static constexpr TClock::duration s_minDriftSpan  = std::chrono::seconds(30);
+	static constexpr TClock::duration s_maxRoundTrip  = std::chrono::seconds(5);
+	static constexpr double           s_maxDrift      = 500e-6;
+
+	bool             ShouldRequest(TClock::time_point now) const { return now >= m_nextRequest; }
+	void             OnRequestSent(TClock::time_point now);
+
+	// Returns false if the sample is implausible, the times are microseconds.
+	bool             AddSample(uint64 requestTime, uint64 serverTime, TClock::time_point received);
+
+	bool             IsSynchronized() const { return m_sampleCount > 0; }
+	TClock::duration GetSessionTime(TClock::time_point now) const;
+	SClockLatency    GetLatency() const;
+	double           GetDrift() const { return m_drift; }
+
+	void             Write(Log::ESource source) const;
+
+	static uint64    ToMicroseconds(TClock::time_point time);
+
+private:
+	struct SSample
+	{
+		int64 local;     // middle of the round trip
+		int64 offset;    // server session time minus local time
+		int64 roundTrip;
+	};
+
+	int64 GetOffset(int64 local) const;
+
+	std::array<SSample, s_sampleCount> m_samples{};
+	size_t                             m_sampleCount = 0;
+	size_t                             m_nextSample  = 0;
+	size_t                             m_best        = 0;
+
+	SSample                            m_driftAnchor{};
+	bool                               m_hasDriftAnchor = false;
+	double                             m_drift          = 0.0; // microseconds of offset per microsecond
+
+	double                             m_toServer   = 0.0; // smoothed one way latencies in microseconds
+	double                             m_fromServer = 0.0;
+
+	TClock::time_point                 m_nextRequest;
+};
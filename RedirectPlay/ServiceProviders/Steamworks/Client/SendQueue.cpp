@@ -0,0 +1,126 @@
+#include "SendQueue.h"
+
+CSendQueue::CSendQueue()
+	: m_dropCallback()
+	, m_messages()
+	, m_nextSequence(0)
+	, m_nextId(0)
+	, m_bytes(0)
+	, m_stats()
+{
+}
+
+uint32 CSendQueue::AllocateId()
+{
+	if (++m_nextId == 0)
+	{
+		++m_nextId;
+	}
+	return m_nextId;
+}
+
+void CSendQueue::Push(SMessage&& message)
+{
+	m_bytes += message.data.size();
+	++m_stats.queued;
+
+	TKey const key(0xFFFFu - message.info.priority, m_nextSequence++);
+	m_messages.emplace(key, std::move(message));
+}
+
+void CSendQueue::Pop()
+{
+	Erase(m_messages.begin());
+}
+
+size_t CSendQueue::Expire(TClock::time_point now)
+{
+	size_t count = 0;
+	TMessages::iterator it = m_messages.begin();
+	while (it != m_messages.end())
+	{
+		if (it->second.deadline <= now)
+		{
+			it = Drop(it, EDrop::Expired);
+			++count;
+		}
+		else
+		{
+			++it;
+		}
+	}
+	m_stats.expired += count;
+	return count;
+}
+
+bool CSendQueue::Cancel(uint32 id)
+{
+	if (id == 0)
+	{
+		m_stats.cancelled += m_messages.size();
+		bool const any = !m_messages.empty();
+		for (TMessages::iterator it = m_messages.begin(); it != m_messages.end(); )
+		{
+			it = Drop(it, EDrop::Cancelled);
+		}
+		return any;
+	}
+
+	for (TMessages::iterator it = m_messages.begin(); it != m_messages.end(); ++it)
+	{
+		if (it->second.info.id == id)
+		{
+			Drop(it, EDrop::Cancelled);
+			++m_stats.cancelled;
+			return true;
+		}
+	}
+	return false;
+}
+
+size_t CSendQueue::CancelPriority(uint16 minPriority, uint16 maxPriority)
+{
+	// keys are ordered by descending priority
+	TMessages::iterator const first = m_messages.lower_bound(TKey(0xFFFFu - maxPriority, 0));
+	TMessages::iterator const last  = m_messages.lower_bound(TKey(0xFFFFu - minPriority + 1, 0));
+
+	size_t count = 0;
+	for (TMessages::iterator it = first; it != last; )
+	{
+		it = Drop(it, EDrop::Cancelled);
+		++count;
+	}
+	m_stats.cancelled += count;
+	return count;
+}
+
+void CSendQueue::Clear()
+{
+	m_messages.clear();
+	m_bytes = 0;
+}
+
+CSendQueue::TMessages::iterator CSendQueue::Erase(TMessages::iterator it)
+{
+	m_bytes -= it->second.data.size();
+	return m_messages.erase(it);
+}
+
+CSendQueue::TMessages::iterator CSendQueue::Drop(TMessages::iterator it, EDrop reason)
+{
+	if (m_dropCallback)
+	{
+		m_dropCallback(it->second, reason);
+	}
+	return Erase(it);
+}
+
+void SSendQueueStats::Write(Log::ESource source) const
+{
+	if (queued == 0)
+	{
+		return;
+	}
+
+	Log::Write(Log::ELevel::Info, source, "Send queue held %llu messages, %llu expired and %llu were cancelled before they were sent.", queued, expired, cancelled);
+}
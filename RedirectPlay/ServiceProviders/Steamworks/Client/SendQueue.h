@@ -0,0 +1,95 @@
+#pragma once
+
+#include "../SteamTypes.h"
+#include "Log.h"
+
+#include "DirectX/dplay.h"
+#include "Steam/steamtypes.h"
+
+#include <functional>
+#include <map>
+#include <utility>
+#include <vector>
+
+// Data the game sent that was not handed to steam yet, see CSteamPlayClient::FlushSendQueue.
+// Messages leave in priority order, messages of the same priority in the order they were sent.
+// Until then they can be cancelled, messages with a timeout expire once it passed.
+// Dropped messages are reported to the drop callback, so the sender can be told with a DPMSG_SENDCOMPLETE.
+
+struct SSendQueueStats
+{
+	uint64 queued    = 0; // messages that had to wait
+	uint64 expired   = 0;
+	uint64 cancelled = 0;
+
+	void Write(Log::ESource source) const;
+};
+
+class CSendQueue
+{
+public:
+	// Everything a DPMSG_SENDCOMPLETE reports about a send.
+	struct SSendInfo
+	{
+		uint32             id;
+		DPID               from;
+		DPID               to;
+		DWORD              flags;    // DPSEND_*
+		uint16             priority;
+		DWORD              timeout;  // ms, 0 without a timeout
+		LPVOID             pContext;
+		TClock::time_point start;
+	};
+
+	struct SMessage
+	{
+		SSendInfo          info;
+		TClock::time_point deadline; // TClock::time_point::max() without a timeout
+		std::vector<uint8> data;
+	};
+
+	enum class EDrop
+	{
+		Expired,
+		Cancelled,
+	};
+	using TDropCallback = std::function<void(SMessage const& message, EDrop reason)>;
+
+	CSendQueue();
+
+	// Not called for messages thrown away by Clear().
+	void      SetDropCallback(TDropCallback callback) { m_dropCallback = std::move(callback); }
+
+	bool      IsEmpty() const  { return m_messages.empty(); }
+	size_t    GetCount() const { return m_messages.size(); }
+	size_t    GetBytes() const { return m_bytes; }
+
+	// Ids are never 0, DirectPlay uses that to cancel everything.
+	uint32    AllocateId();
+
+	void      Push(SMessage&& message);
+	SMessage& Front()          { return m_messages.begin()->second; }
+	void      Pop();
+
+	size_t    Expire(TClock::time_point now);
+	bool      Cancel(uint32 id); // 0 cancels all messages
+	size_t    CancelPriority(uint16 minPriority, uint16 maxPriority);
+	void      Clear();
+
+	SSendQueueStats const& GetStats() const { return m_stats; }
+	void                   ResetStats()     { m_stats = SSendQueueStats(); }
+
+private:
+	using TKey      = std::pair<uint32, uint64>; // inverted priority, sequence
+	using TMessages = std::map<TKey, SMessage>;
+
+	TMessages::iterator Erase(TMessages::iterator it);
+	TMessages::iterator Drop(TMessages::iterator it, EDrop reason);
+
+	TDropCallback   m_dropCallback;
+	TMessages       m_messages;
+	uint64          m_nextSequence;
+	uint32          m_nextId;
+	size_t          m_bytes;
+	SSendQueueStats m_stats;
+};
@@ -1,6 +1,8 @@
 #include "SteamPlayClient.h"
-#include "../Messages/Messages.h"
+#include "../Messages/DataBundle.h"
+#include "../Messages/MessageRegistry.h"
 #include "../Messages/MessageSender.h"
+#include "../SteamPlayConfig.h"
 #include "../SteamTypes.h"
 #include "Log.h"
 #include "DirectPlay/Utils.h"
@@ -12,25 +14,159 @@
 #include "Steam/isteamuser.h"
 
 #include <unordered_map>
+#include <algorithm>
 #include <cassert>
 
 using TMessageSender = CMessageSender<SteamNetworkingSockets, Log::ESource::Client>;
 
+static DPMSG_CREATEPLAYERORGROUP const s_createPlayerTemplate = []()
+{
+	DPMSG_CREATEPLAYERORGROUP message{};
+	message.dwType       = DPSYS_CREATEPLAYERORGROUP;
+	message.dwPlayerType = DPPLAYERTYPE_PLAYER;
+	return message;
+}();
+
+static DPMSG_DESTROYPLAYERORGROUP const s_destroyPlayerTemplate = []()
+{
+	DPMSG_DESTROYPLAYERORGROUP message{};
+	message.dwType       = DPSYS_DESTROYPLAYERORGROUP;
+	message.dwPlayerType = DPPLAYERTYPE_PLAYER;
+	return message;
+}();
+
+template<size_t TSize>
+static void ConvertName(fwstring<TSize>& dest, char const* szSource)
+{
+	if (mbstowcs(dest.data(), szSource, dest.max_size()) == static_cast<size_t>(-1))
+	{
+		dest.clear();
+	}
+}
+
+template<size_t TSize>
+static void ConvertName(fstring<TSize>& dest, wchar_t const* szSource)
+{
+	if (!szSource || wcstombs(dest.data(), szSource, dest.max_size()) == static_cast<size_t>(-1))
+	{
+		dest.clear();
+	}
+}
+
+CSteamPlayClient::SPlayerNames::SPlayerNames(char const* szShortName, char const* szLongName)
+	: shortName(szShortName)
+	, longName(szLongName)
+{
+	ConvertName(shortNameW, shortName);
+	ConvertName(longNameW, longName);
+}
+
+CSteamPlayClient::SPlayerNames::SPlayerNames(wchar_t const* szShortName, wchar_t const* szLongName)
+	: shortNameW(szShortName)
+	, longNameW(szLongName)
+{
+	ConvertName(shortName, shortNameW);
+	ConvertName(longName, longNameW);
+}
+
+// Pointers of queued sysmsgs point into our own buffer, rebase them into the copy handed to the game.
+static void RelocateSysMessage(void* pDest, void const* pSource, size_t size)
+{
+	char*       const pDestBytes   = static_cast<char*>(pDest);
+	char const* const pSourceBytes = static_cast<char const*>(pSource);
+
+	auto relocate = [=](auto*& ptr)
+	{
+		char const* const pBytes = reinterpret_cast<char const*>(ptr);
+		if (pBytes >= pSourceBytes && pBytes < pSourceBytes + size)
+		{
+			ptr = reinterpret_cast<std::remove_reference_t<decltype(ptr)>>(pDestBytes + (pBytes - pSourceBytes));
+		}
+	};
+
+	switch (static_cast<DPMSG_GENERIC*>(pDest)->dwType)
+	{
+	case DPSYS_CREATEPLAYERORGROUP:
+	{
+		DPMSG_CREATEPLAYERORGROUP& message = *static_cast<DPMSG_CREATEPLAYERORGROUP*>(pDest);
+		relocate(message.dpnName.lpszShortName);
+		relocate(message.dpnName.lpszLongName);
+		break;
+	}
+	case DPSYS_DESTROYPLAYERORGROUP:
+	{
+		DPMSG_DESTROYPLAYERORGROUP& message = *static_cast<DPMSG_DESTROYPLAYERORGROUP*>(pDest);
+		relocate(message.dpnName.lpszShortName);
+		relocate(message.dpnName.lpszLongName);
+		break;
+	}
+	default:
+		break;
+	}
+}
+
 CSteamPlayClient::CSteamPlayClient()
 	: m_state(EState::Disconnected)
 	, m_serverID()
 	, m_serverConnection()
 	, m_authTicket()
+	, m_authToken()
+	, m_authTokenSize(0)
+	, m_earlyAuthSent(false)
+	, m_joinStart()
 	, m_password()
+	, m_capabilities()
+	, m_nextStatsReport()
 	, m_players()
-	, m_createPlayerCallback()
+	, m_playerSlots()
+	, m_primaryPlayer(DPID_UNKNOWN)
+	, m_primaryPlayerRetired(false)
+	, m_createPlayerRequests()
+	, m_nextCreatePlayerRequest(0)
 	, m_dataMessages()
+	, m_sequencedQueued(0)
+	, m_compressBuffer()
+	, m_compressionStats()
+	, m_sendQueue()
+	, m_pendingCompletions()
+	, m_reliableBytesSent()
+	, m_deltaSendStreams()
+	, m_deltaReceiveStreams()
+	, m_deltaBuffer()
+	, m_fragments()
+	, m_nextTransferId(0)
+	, m_sequenceCounters()
+	, m_sequenceFilter()
+	, m_redundantSender()
+	, m_redundantReceiver()
+	, m_redundancyBuffer()
+	, m_redundantPayloads()
+	, m_clockSync()
+	, m_replay()
+	, m_resumeToken(0)
+	, m_resumeGraceTime()
+	, m_resumeDeadline()
+	, m_standby(false)
+	, m_standbyRoster()
+	, m_standbyRosterChanged(false)
+	, m_standbyHost()
+	, m_migrationStart()
+	, m_migrationDeadline()
 {
+	m_sendQueue.SetDropCallback([this](CSendQueue::SMessage const& message, CSendQueue::EDrop reason)
+	{
+		OnSendDropped(message, reason);
+	});
+	TMessageSender::SetReplayBuffers([this](HSteamNetConnection connection) -> CReplayBuffer*
+	{
+		return connection == m_serverConnection && m_capabilities.Has(EFeature::Resume) ? &m_replay : nullptr;
+	});
 }
 
 CSteamPlayClient::~CSteamPlayClient()
 { 
 	Disconnect(EDisconnectReason::ClientDisconnect);
+	TMessageSender::SetReplayBuffers(nullptr);
 }
 
 bool CSteamPlayClient::Join(CSteamID serverID, char const* szPassword)
@@ -40,11 +176,21 @@ bool CSteamPlayClient::Join(CSteamID serverID, char const* szPassword)
 		return false;
 	}
 
+	m_joinStart = TClock::now();
+	SCapabilities const localCapabilities = SSteamPlayConfig::Get().GetCapabilities();
+	bool const          earlyAuth         = localCapabilities.Has(EFeature::EarlyAuth);
+	if (earlyAuth)
+	{
+		// the ticket is on its way to steam while we connect
+		RequestAuthTicket();
+	}
+
 	SteamNetworkingIdentity identity{ };
 	identity.SetSteamID(serverID);
 	m_serverConnection = SteamNetworkingSockets()->ConnectP2P(identity, 0, 0, nullptr);
 	if (m_serverConnection == k_HSteamNetConnection_Invalid)
 	{
+		CancelAuthTicket();
 		return false;
 	}
 
@@ -54,6 +200,29 @@ bool CSteamPlayClient::Join(CSteamID serverID, char const* szPassword)
 	m_state = Connecting;
 	m_serverID = serverID;
 	m_password.assign(szPassword);
+	m_capabilities = SCapabilities();
+
+	// steam queues it until the connection is established, so the server has it right after sending SInfo
+	m_earlyAuthSent = false;
+	if (earlyAuth)
+	{
+		Messages::Client::SEarlyAuth early;
+		early.password     = m_password;
+		early.token        = SByteView{ m_authToken.data(), m_authTokenSize };
+		early.capabilities = localCapabilities;
+		m_earlyAuthSent    = TMessageSender::Send(early, m_serverConnection, k_nSteamNetworkingSend_Reliable);
+	}
+	m_replay = CReplayBuffer();
+	m_replay.SetMaxSize(SSteamPlayConfig::Get().resumeReplaySize);
+	m_resumeToken = 0;
+	m_standby = false;
+	m_standbyRoster = SStandbyRoster();
+	m_standbyRosterChanged = false;
+	m_standbyHost = CSteamID();
+
+	m_playerSlots.fill(DPID_UNKNOWN);
+	m_primaryPlayer = DPID_UNKNOWN;
+	m_primaryPlayerRetired = false;
 	
 	Log::InfoClient("Connecting to server...");
 	return true;
@@ -68,8 +237,7 @@ void CSteamPlayClient::Disconnect(EDisconnectReason reason)
 
 		if (m_authTicket != k_HAuthTicketInvalid)
 		{
-			SteamUser()->CancelAuthTicket(m_authTicket);
-			m_authTicket = k_HAuthTicketInvalid;
+			CancelAuthTicket();
 		}
 		else
 		{
@@ -82,450 +250,1415 @@ void CSteamPlayClient::Disconnect(EDisconnectReason reason)
 		m_serverConnection = k_HSteamNetConnection_Invalid;
 		m_players.clear();
 		m_password.clear();
+		m_earlyAuthSent = false;
+		FailCreatePlayerRequests();
+		m_joinStart = TClock::time_point();
 
 		m_dataMessages.clear();
+		m_sequencedQueued = 0;
+
+		m_compressionStats.Write(Log::ESource::Client);
+		m_compressionStats = SCompressionStats();
+
+		m_deltaSendStreams.GetStats().Write(Log::ESource::Client);
+		m_deltaReceiveStreams.GetStats().Write(Log::ESource::Client);
+		m_deltaSendStreams = CDeltaStreams();
+		m_deltaReceiveStreams = CDeltaStreams();
+
+		// the players are gone, nobody is left to tell about pending sends
+		m_sendQueue.GetStats().Write(Log::ESource::Client);
+		m_sendQueue.Clear();
+		m_sendQueue.ResetStats();
+		for (TPendingCompletions& completions : m_pendingCompletions)
+		{
+			completions.clear();
+		}
+		m_reliableBytesSent.fill(0);
+
+		m_fragments.Clear();
+		m_nextTransferId = 0;
+
+		if (m_sequenceFilter.GetDropped() > 0)
+		{
+			Log::InfoClient("Dropped %llu obsolete sequenced data messages.", m_sequenceFilter.GetDropped());
+		}
+		m_sequenceCounters = CSequenceCounters();
+		m_sequenceFilter = CSequenceFilter();
+
+		m_redundantReceiver.GetStats().Write(Log::ESource::Client);
+		m_redundantSender = CRedundantSender();
+		m_redundantReceiver = CRedundantReceiver();
+
+		m_clockSync.Write(Log::ESource::Client);
+		m_clockSync = CClockSync();
+
+		m_replay = CReplayBuffer();
+		m_resumeToken = 0;
+
+		m_standby = false;
+		m_standbyRoster = SStandbyRoster();
+		m_standbyRosterChanged = false;
+		m_standbyHost = CSteamID();
 
 		Log::InfoClient("Disconnected from server %u.", reason);
 	}
 }
 
-bool CSteamPlayClient::CreatePlayer(SCreatePlayerData const& input, TCreatePlayerCallback callback)
+bool CSteamPlayClient::CreatePlayer(SCreatePlayerData const& input, TCreatePlayerCallback callback, uint32* pRequestId)
 {
-	bool result = TMessageSender::TrySend<Messages::Client::SCreatePlayer>(
-		m_serverConnection,
-		k_nSteamNetworkingSend_Reliable,
-		input.dataSize,
-		[&input](Messages::Client::SCreatePlayer& message)
-		{
-			strncpy(message.szShortName, input.szShortName, ArrayCount(message.szShortName));
-			strncpy(message.szLongName, input.szLongName, ArrayCount(message.szLongName));
-			message.serverPlayer = input.serverPlayer;
-			message.spectator    = input.spectator;
-		});
+	if (m_state == Migrating)
+	{
+		return false;
+	}
+
+	SPlayerNames const names(input.szShortName, input.szLongName);
+
+	// 0 is what older servers answer with
+	m_nextCreatePlayerRequest = m_nextCreatePlayerRequest + 1 != 0 ? m_nextCreatePlayerRequest + 1 : 1;
 
-	if (!result)
+	Messages::Client::SCreatePlayer message;
+	message.shortName    = names.shortName;
+	message.longName     = names.longName;
+	message.serverPlayer = input.serverPlayer;
+	message.spectator    = input.spectator;
+	message.requestId    = m_nextCreatePlayerRequest;
+
+	if (!TMessageSender::Send(message, m_serverConnection, k_nSteamNetworkingSend_Reliable))
 	{
 		return false;
 	}
 
-	m_createPlayerCallback = std::move(callback);
+	m_createPlayerRequests.push_back(SCreatePlayerRequest{ message.requestId, names, std::move(callback) });
+	if (pRequestId)
+	{
+		*pRequestId = message.requestId;
+	}
 	return true;
 }
 
-bool CSteamPlayClient::SendData(DPID from, DPID to, void* pData, size_t len, bool reliable, bool sameThread)
+// The request stays queued, servers without request ids answer in order.
+void CSteamPlayClient::AbandonCreatePlayer(uint32 requestId)
 {
-	int flags = 0;
-	if (reliable)
+	TCreatePlayerRequests::iterator const it = std::find_if(m_createPlayerRequests.begin(), m_createPlayerRequests.end(),
+		[requestId](SCreatePlayerRequest const& request) { return request.requestId == requestId; });
+	if (it == m_createPlayerRequests.end() || it->abandoned)
 	{
-		flags |= k_nSteamNetworkingSend_Reliable;
+		return;
 	}
-	if (sameThread)
+
+	it->abandoned = true;
+	TCreatePlayerCallback const callback = std::move(it->callback);
+	it->callback = nullptr;
+	if (callback)
 	{
-		flags |= k_nSteamNetworkingSend_UseCurrentThread;
+		callback(DPID_UNKNOWN);
 	}
-
-	// todo: return HRESULT / pending etc.?
-	return TMessageSender::TrySend<Messages::Shared::SData>(
-		m_serverConnection,
-		flags,
-		len,
-		[from, to, pData, len](Messages::Shared::SData& message)
-		{
-			message.from = from;
-			message.to = to;
-			memcpy(message.pData, pData, len);
-		});
 }
 
-bool CSteamPlayClient::DestroyPlayer(DPID dpid)
+// The requests will not be answered anymore.
+void CSteamPlayClient::FailCreatePlayerRequests()
 {
-	if (dpid == DPID_ALLPLAYERS)
+	TCreatePlayerRequests requests;
+	std::swap(requests, m_createPlayerRequests);
+	for (SCreatePlayerRequest const& request : requests)
 	{
-		TPlayers::iterator it = m_players.begin();
-		while (it != m_players.end())
+		if (request.callback)
 		{
-			if (it->second.local)
-			{
-				it = m_players.erase(it);
-			}
-			else
-			{
-				++it;
-			}
+			request.callback(DPID_UNKNOWN);
 		}
 	}
-	else
+}
+
+bool CSteamPlayClient::SendData(SSendData const& input, uint32* pMessageId)
+{
+	CSendQueue::SSendInfo info;
+	info.id       = m_sendQueue.AllocateId();
+	info.from     = input.from;
+	info.to       = input.to;
+	info.flags    = input.flags;
+	info.priority = static_cast<uint16>(input.priority);
+	info.timeout  = input.timeout;
+	info.pContext = input.pContext;
+	info.start    = TClock::now();
+
+	if (pMessageId)
 	{
-		TPlayers::iterator const it = m_players.find(dpid);
-		if (it == m_players.end() || !it->second.local)
-		{
-			return false;
-		}
+		*pMessageId = info.id;
+	}
 
-		m_players.erase(it);
+	// data only waits if steam has enough to send already, or it would overtake data that waits.
+	// Synchronous sends return once steam has the data, what waits goes out ahead of them regardless of the budget,
+	// only a migrating host keeps them waiting for the new one.
+	bool const synchronous = !(input.flags & DPSEND_ASYNC);
+	FlushSendQueue(synchronous);
+	if (m_state != Migrating && m_sendQueue.IsEmpty() && (synchronous || GetSendBudget() >= input.size))
+	{
+		return DispatchData(info, input.pData, input.size);
 	}
 
-	return TMessageSender::TrySend<Messages::Client::SDestroyPlayer>(
-		m_serverConnection,
-		k_nSteamNetworkingSend_Reliable,
-		[dpid](Messages::Client::SDestroyPlayer& message)
-		{
-			message.dpid = dpid;
-		});
+	CSendQueue::SMessage message;
+	message.info     = info;
+	message.deadline = input.timeout > 0 ? info.start + std::chrono::milliseconds(input.timeout) : TClock::time_point::max();
+	message.data.assign(static_cast<uint8 const*>(input.pData), static_cast<uint8 const*>(input.pData) + input.size);
+	m_sendQueue.Push(std::move(message));
+	return true;
 }
 
-HRESULT CSteamPlayClient::ReceiveData(LPDPID pFrom, LPDPID pTo, DWORD flags, LPVOID pData, LPDWORD pSize)
+bool CSteamPlayClient::CancelMessage(uint32 id)
 {
-	if (!pFrom || !pTo || !pSize)
+	return m_sendQueue.Cancel(id);
+}
+
+void CSteamPlayClient::CancelPriority(uint16 minPriority, uint16 maxPriority)
+{
+	m_sendQueue.CancelPriority(minPriority, maxPriority);
+}
+
+// Bytes steam may take before its queue holds more than the configured send queue time.
+size_t CSteamPlayClient::GetSendBudget() const
+{
+	SteamNetConnectionRealTimeStatus_t status;
+	if (SteamNetworkingSockets()->GetConnectionRealTimeStatus(m_serverConnection, &status, 0, nullptr) != k_EResultOK)
 	{
-		return DPERR_INVALIDPARAM;
+		return 0;
 	}
 
-	TDataMessages::iterator it = m_dataMessages.begin();
-	if (!(flags & DPRECEIVE_ALL))
+	size_t const budget  = SSteamPlayConfig::GetSendWindow(status, SSteamPlayConfig::Get().sendQueueTime);
+	size_t const pending = SSteamPlayConfig::GetPendingBytes(status);
+	return pending < budget ? budget - pending : 0;
+}
+
+void CSteamPlayClient::FlushSendQueue(bool all)
+{
+	if (m_sendQueue.IsEmpty())
 	{
-		while (it != m_dataMessages.end())
-		{
-			bool const fromValid = !(flags & DPRECEIVE_FROMPLAYER) || it->from == *pFrom;
-			bool const toValid = !(flags & DPRECEIVE_TOPLAYER) || it->to == *pTo;
-			if (fromValid && toValid)
-			{
-				break;
-			}
+		return;
+	}
 
-			++it;
-		}
+	m_sendQueue.Expire(TClock::now());
+	if (m_state == Migrating)
+	{
+		// data waits for the new host
+		return;
 	}
 
-	if (it == m_dataMessages.end())
+	size_t budget = m_sendQueue.IsEmpty() ? 0 : GetSendBudget();
+	while (!m_sendQueue.IsEmpty() && (all || budget > 0))
 	{
-		return DPERR_NOMESSAGES;
+		CSendQueue::SMessage const& message = m_sendQueue.Front();
+		budget -= (std::min)(budget, message.data.size());
+		if (!DispatchData(message.info, message.data.data(), message.data.size()))
+		{
+			QueueSendComplete(message.info, DPERR_GENERIC);
+		}
+		m_sendQueue.Pop();
 	}
+}
 
-	*pFrom = it->from;
-	*pTo = it->to;
-	void const* pSourceData;
-	size_t      sourceSize;
-	if (it->from == DPID_SYSMSG)
+static bool WantsSendComplete(DWORD flags)
+{
+	return (flags & DPSEND_ASYNC) && !(flags & DPSEND_NOSENDCOMPLETEMSG);
+}
+
+bool CSteamPlayClient::DispatchData(CSendQueue::SSendInfo const& info, void const* pData, size_t len)
+{
+	bool const reliable = info.flags & DPSEND_GUARANTEED;
+
+	int flags = 0;
+	if (reliable)
 	{
-		pSourceData = it->pMsg->GetData();
-		sourceSize = it->pMsg->GetSize();
+		flags |= k_nSteamNetworkingSend_Reliable;
 	}
-	else
+	if (!(info.flags & DPSEND_ASYNC))
 	{
-		pSourceData = static_cast<Messages::Shared::SData const*>(it->pMsg->GetData())->pData;
-		sourceSize = it->pMsg->GetSize() - sizeof(Messages::Shared::SData);
+		flags |= k_nSteamNetworkingSend_UseCurrentThread;
 	}
-
-	if (!pData || *pSize < sourceSize)
+	if (m_capabilities.Has(EFeature::LowLatency))
 	{
-		return DPERR_BUFFERTOOSMALL;
+		flags |= k_nSteamNetworkingSend_NoNagle;
 	}
 
-	memcpy(pData, pSourceData, sourceSize);
-
-	if (!(flags & DPRECEIVE_PEEK))
+	ELane        lane;
+	size_t const sentSize = TransmitData(info.from, info.to, pData, len, flags, info.priority, lane);
+	if (sentSize == 0)
 	{
-		m_dataMessages.erase(it);
+		return false;
 	}
-	return DP_OK;
-}
-
-void CSteamPlayClient::ReceiveNetworkData()
-{
-	static constexpr size_t s_maxMessages = 64;
-
-	if (!SteamNetworkingSockets() || m_serverConnection == k_HSteamNetConnection_Invalid)
-		return;
 
-	SteamNetworkingMessage_t* messages[s_maxMessages];
-	int const count = SteamNetworkingSockets()->ReceiveMessagesOnConnection(m_serverConnection, messages, s_maxMessages);
-
-	if (m_state == Disconnected)
+	if (!reliable)
 	{
-		for (int i = 0; i < count; ++i)
+		// nothing will tell whether it arrived, it is complete once steam has it
+		if (WantsSendComplete(info.flags))
 		{
-			assert(messages[i] != nullptr);
-			messages[i]->Release();
+			QueueSendComplete(info, DP_OK);
 		}
-		return;
+		return true;
 	}
 
-	for (int i = 0; i < count; ++i)
+	size_t const laneIndex = static_cast<size_t>(lane);
+	m_reliableBytesSent[laneIndex] += sentSize;
+	if (WantsSendComplete(info.flags))
 	{
-		ProcessNetworkingMessage(messages[i]);
+		m_pendingCompletions[laneIndex].push_back({ info, m_reliableBytesSent[laneIndex] });
 	}
+	return true;
 }
 
-void CSteamPlayClient::ProcessNetworkingMessage(TSteamMessageUniquePtr pSteamMessage)
+// Returns the size of the steam message or 0 if the data could not be sent, lane is set to the steam lane it was sent on.
+size_t CSteamPlayClient::TransmitData(DPID from, DPID to, void const* pData, size_t len, int flags, DWORD priority, ELane& lane)
 {
-	assert(pSteamMessage != nullptr);
-	assert(pSteamMessage->GetData() != nullptr);
-	assert(pSteamMessage->GetSize() > 0);
+	SSteamPlayConfig const& config = SSteamPlayConfig::Get();
+	ELane const logicalLane = m_capabilities.Has(EFeature::Lanes) ? config.GetLane(priority, len) : ELane::Default;
+	lane = SSteamPlayConfig::GetStreamLane(m_capabilities, logicalLane, from, to, flags);
 
-	if (pSteamMessage->GetSize() < sizeof(SMessage))
+	if (!m_capabilities.Has(EFeature::CompactHeader))
 	{
-		Log::WarnClient("Server message was too short.");
-		return;
+		Messages::Shared::SData legacyHeader;
+		legacyHeader.from = from;
+		legacyHeader.to   = to;
+		return SendDataMessage(&legacyHeader, sizeof(legacyHeader), pData, len, flags, lane);
 	}
 
-	size_t receiveSize;
-	void(CSteamPlayClient::*pReceive)(TSteamMessageUniquePtr);
+	Messages::Shared::SDataHeader header;
+	header.SetTo(to, GetPlayerSlot(to));
+	header.SetFrom(from, GetPlayerSlot(from), from == m_primaryPlayer);
 
-	SMessage const& message = *static_cast<SMessage*>(pSteamMessage->m_pData);
-	switch (message.GetId())
+	// only the latest unreliable value of a stream is delivered
+	if (m_capabilities.Has(EFeature::Sequenced) && !(flags & k_nSteamNetworkingSend_Reliable))
 	{
-	case Messages::Server::SInfo::ID:
-		pReceive = &CSteamPlayClient::OnReceiveInfo;
-		receiveSize = sizeof(Messages::Server::SInfo);
-		break;
-	case Messages::Server::SAuthPassed::ID:
-		pReceive = &CSteamPlayClient::OnReceiveAuthPassed;
-		receiveSize = sizeof(Messages::Server::SAuthPassed);
-		break;
-	case Messages::Server::SCreatePlayerResponse::ID:
-		pReceive = &CSteamPlayClient::OnReceiveCreatePlayerResponse;
-		receiveSize = sizeof(Messages::Server::SCreatePlayerResponse);
-		break;
-	case Messages::Server::SPlayerCreated::ID:
-		pReceive = &CSteamPlayClient::OnReceivePlayerCreated;
-		receiveSize = sizeof(Messages::Server::SPlayerCreated);
-		break;
-	case Messages::Server::SPlayerDestroyed::ID:
-		pReceive = &CSteamPlayClient::OnReceivePlayerDestroyed;
-		receiveSize = sizeof(Messages::Server::SPlayerDestroyed);
-		break;
-	case Messages::Shared::SData::ID:
-		pReceive = &CSteamPlayClient::OnReceiveData;
-		receiveSize = sizeof(Messages::Shared::SData);
-		break;
-	default:
-		Log::WarnClient("Server sent unregistered message %u.", message.GetId());
-		return;
+		header.flags   |= Messages::Shared::SDataHeader::s_flagSequenced;
+		header.sequence = m_sequenceCounters.Next(SStreamKey{ from, to, lane });
 	}
-
-	if (pSteamMessage->GetSize() < receiveSize)
+	// every unreliable message repeats the previous payloads of its stream, they are not compressed
+	else if (m_capabilities.Has(EFeature::Redundancy) && !(flags & k_nSteamNetworkingSend_Reliable))
 	{
-		Log::WarnClient("Server message %u was too short. Got %u but expected at least %u.", message.GetId(), pSteamMessage->GetSize(), receiveSize);
-		return;
+		header.flags |= Messages::Shared::SDataHeader::s_flagRedundant;
+		size_t const headerSize = header.GetSize();
+		size_t const maxSize    = config.redundancyMaxSize > headerSize ? config.redundancyMaxSize - headerSize : 0;
+		header.sequence = m_redundantSender.Encode(SStreamKey{ from, to, lane }, pData, len, config.redundancyDepth, maxSize, m_redundancyBuffer);
+		return SendDataMessage(header, m_redundancyBuffer.data(), m_redundancyBuffer.size(), flags, lane);
 	}
 
-	(this->*pReceive)(std::move(pSteamMessage));
-}
-
-void CSteamPlayClient::OnReceiveInfo(TSteamMessageUniquePtr pSteamMessage)
-{
-	assert(pSteamMessage != nullptr);
-	Messages::Server::SInfo const& message = *static_cast<Messages::Server::SInfo*>(pSteamMessage->m_pData);
-
-	if (!message.auth && !message.password)
+	// payloads of delta streams are not compressed, the receiver keeps them as they are
+	if (m_capabilities.Has(EFeature::Delta) && CDeltaStreams::IsEligible(len, flags))
 	{
-		SteamNetConnectionInfo_t info;
-		SteamNetworkingSockets()->GetConnectionInfo(m_serverConnection, &info);
-		SteamUser()->AdvertiseGame(k_steamIDNonSteamGS, info.m_addrRemote.GetIPv4(), info.m_addrRemote.m_port);
-
-		m_state = Connected;
+		bool const delta = m_deltaSendStreams.Encode(from, to, lane, pData, len, m_deltaBuffer);
+		if (delta)
+		{
+			header.flags |= Messages::Shared::SDataHeader::s_flagDelta;
+		}
 
-		Log::InfoClient("Connected to server!");
-		return;
+		size_t const sentSize = SendDataMessage(header, delta ? m_deltaBuffer.data() : pData, delta ? m_deltaBuffer.size() : len, flags, lane);
+		if (sentSize == 0)
+		{
+			// the server did not get this payload, start over with keyframes
+			m_deltaSendStreams.Clear();
+		}
+		return sentSize;
 	}
 
-	//Steamworks_TestSecret();
-
-	Messages::Client::SBeginAuth response;
-	if (message.password)
+	// the receiver does not accept compressed payloads that exceed a steam message
+	if (m_capabilities.Has(EFeature::Compression) && len >= config.compressionThreshold && len <= CLZCodec::s_maxPayloadSize)
 	{
-		if (m_password.empty())
+		if (!config.captureFile.empty())
 		{
-			if (!ShowPasswordRequest(m_password.data(), m_password.array_size()))
-			{
-				Disconnect(EDisconnectReason::ClientDisconnect); // todo? test, DPERR_INVALIDPASSWORD
-				return;
-			}
+			CLZCapture::Write(config.captureFile.c_str(), pData, len);
 		}
 
-		m_password.copyTo(response.szPassword);
-	}
-
-	if (message.auth)
-	{
-		m_authTicket = SteamUser()->GetAuthSessionTicket(response.pToken, sizeof(response.pToken), &response.tokenLen);
-		if (response.tokenLen < 1)
+		size_t const packedSize = CLZCodec::CompressPayload(pData, len, m_compressBuffer, GetDictionary(), m_compressionStats);
+		if (packedSize > 0)
 		{
-			Log::WarnClient("Got invalid auth session ticket!");
+			header.flags |= Messages::Shared::SDataHeader::s_flagCompressed;
+			return SendDataMessage(header, m_compressBuffer.data(), packedSize, flags, lane);
 		}
 	}
 
-	TMessageSender::Send(response, m_serverConnection, k_nSteamNetworkingSend_Reliable);
-
-	m_state = PendingAuth;
-	Log::InfoClient("Pending Auth with server!");
+	return SendDataMessage(header, pData, len, flags, lane);
 }
 
-void CSteamPlayClient::OnReceiveAuthPassed(TSteamMessageUniquePtr)
+size_t CSteamPlayClient::SendDataMessage(Messages::Shared::SDataHeader const& header, void const* pPayload, size_t payloadSize, int flags, ELane& lane)
 {
-	m_state = Connected;
-	Log::InfoClient("Passed Auth with server!");
+	uint8 headerBytes[Messages::Shared::SDataHeader::s_maxSize];
+	size_t const headerSize = header.Write(headerBytes);
+	return SendDataMessage(headerBytes, headerSize, pPayload, payloadSize, flags, lane);
 }
 
-void CSteamPlayClient::OnReceiveCreatePlayerResponse(TSteamMessageUniquePtr pSteamMessage)
+// Returns the size of the data message or 0 if it could not be sent. Fragment headers are not counted,
+// that only makes send completions late. Fragments go out on their own lane, lane is updated to it.
+size_t CSteamPlayClient::SendDataMessage(void const* pHeader, size_t headerSize, void const* pPayload, size_t payloadSize, int flags, ELane& lane)
 {
-	assert(pSteamMessage != nullptr);
-	Messages::Server::SCreatePlayerResponse& message = *static_cast<Messages::Server::SCreatePlayerResponse*>(pSteamMessage->m_pData);
+	SSteamPlayConfig const& config = SSteamPlayConfig::Get();
+	size_t const messageSize = headerSize + payloadSize;
 
-	if (message.dpid != DPID_UNKNOWN)
+	bool sent;
+	if (config.ShouldFragment(m_capabilities, messageSize, flags))
 	{
-		if (m_players.contains(message.dpid))
+		if (messageSize > config.maxMessageSize)
 		{
-			Log::InfoClient("Player with id %u already exists.", message.dpid);
+			Log::WarnClient("Data message of size %u exceeds the maximum message size.", messageSize);
+			return 0;
 		}
 
-		SPlayerData& playerData = m_players[message.dpid] = SPlayerData{ message.szShortName, message.szLongName , true };
-		Log::DebugClient("Created local player '%s' '%s'", playerData.shortName.data(), playerData.longName.data());
+		lane = SSteamPlayConfig::GetFragmentLane(m_capabilities, lane);
+		sent = TMessageSender::SendFragments(pHeader, headerSize, pPayload, payloadSize, m_serverConnection, lane, m_nextTransferId++, config.fragmentSize);
 	}
 	else
 	{
-		Log::InfoClient("Server failed to create player.");
-	}
-
-	if (m_createPlayerCallback)
-	{
-		TCreatePlayerCallback callback = nullptr;
-		std::swap(callback, m_createPlayerCallback);
-		callback(message.dpid);
+		sent = TMessageSender::SendData(pHeader, headerSize, pPayload, payloadSize, m_serverConnection, flags, lane);
 	}
+	return sent ? messageSize : 0;
 }
 
-void CSteamPlayClient::OnReceivePlayerCreated(TSteamMessageUniquePtr pSteamMessage)
+void CSteamPlayClient::OnSendDropped(CSendQueue::SMessage const& message, CSendQueue::EDrop reason)
 {
-	assert(pSteamMessage != nullptr);
-	Messages::Server::SPlayerCreated& message = *static_cast<Messages::Server::SPlayerCreated*>(pSteamMessage->m_pData);
+	QueueSendComplete(message.info, reason == CSendQueue::EDrop::Expired ? DPERR_TIMEOUT : DPERR_CANCELLED);
+}
 
-	if (message.dpid == DPID_UNKNOWN)
+// Steam does not report acknowledgements per message. Reliable data of a lane is acknowledged in the order it was handed over though,
+// so everything but the bytes steam still holds as pending or unacknowledged on that lane has arrived.
+// Reliable control messages are not counted, they only make completions late, never early.
+void CSteamPlayClient::UpdateSendCompletions()
+{
+	// the new connection knows nothing about the bytes sent before, see OnReceiveResumeResponse
+	if (m_state == Resuming)
 	{
 		return;
 	}
 
-	SPlayerData& playerData = m_players[message.dpid] = SPlayerData{ message.szShortName, message.szLongName , false };
-
-	size_t const shortNameSize = playerData.shortName.size() + 1;
-	size_t const longNameSize  = playerData.longName.size() + 1;
-	size_t const totalSize = sizeof(DPMSG_CREATEPLAYERORGROUP) + sizeof(wchar_t) * shortNameSize + sizeof(wchar_t) * longNameSize;
-	TSteamMessageSharedPtr sysMsg(SteamNetworkingUtils()->AllocateMessage(totalSize), &ReleaseSteamMessage);
-
-	DPMSG_CREATEPLAYERORGROUP* pDPMessage = static_cast<DPMSG_CREATEPLAYERORGROUP*>(sysMsg->m_pData);
-	pDPMessage->dwType           = DPSYS_CREATEPLAYERORGROUP;
-	pDPMessage->dwPlayerType     = DPPLAYERTYPE_PLAYER;
-	pDPMessage->dpId             = message.dpid;
-	pDPMessage->dwCurrentPlayers = m_players.size();
-	pDPMessage->lpData           = nullptr;
-	pDPMessage->dwDataSize       = 0;
-
-	wchar_t* szShortName = reinterpret_cast<wchar_t*>(pDPMessage + 1);
-	wchar_t* szLongName = szShortName + shortNameSize;
-	mbstowcs(szShortName, playerData.shortName, shortNameSize);
-	mbstowcs(szLongName, playerData.longName, longNameSize);
-	pDPMessage->dpnName = ConstructDPName(szShortName, szLongName);
+	uint16 const laneCount = SSteamPlayConfig::GetLaneCount(m_capabilities);
+	bool const pending = std::any_of(m_pendingCompletions.begin(), m_pendingCompletions.begin() + laneCount,
+		[](TPendingCompletions const& completions) { return !completions.empty(); });
+	if (!pending)
+	{
+		return;
+	}
 
-	pDPMessage->dpIdParent = 0;
-	pDPMessage->dwFlags    = 0;
+	SteamNetConnectionRealTimeStatus_t status;
+	std::array<SteamNetConnectionRealTimeLaneStatus_t, std::tuple_size_v<TLaneCounts>> lanes;
+	if (SteamNetworkingSockets()->GetConnectionRealTimeStatus(m_serverConnection, &status, laneCount, lanes.data()) != k_EResultOK)
+	{
+		return;
+	}
 
-	for (TPlayer const& player : m_players)
+	for (uint16 lane = 0; lane < laneCount; ++lane)
 	{
-		if (player.second.local)
+		TPendingCompletions& completions = m_pendingCompletions[lane];
+		uint64 const         sent        = m_reliableBytesSent[lane];
+		uint64 const         outstanding = static_cast<uint64>(lanes[lane].m_cbPendingReliable) + static_cast<uint64>(lanes[lane].m_cbSentUnackedReliable);
+		uint64 const         acknowledged = sent - (std::min)(outstanding, sent);
+		while (!completions.empty() && completions.front().reliableEnd <= acknowledged)
 		{
-			m_dataMessages.emplace_back(DPID_SYSMSG, player.first, sysMsg);
+			QueueSendComplete(completions.front().info, DP_OK);
+			completions.pop_front();
 		}
 	}
-
-	Log::DebugClient("Created remote player %u '%s' '%s'", message.dpid, playerData.shortName.data(), playerData.longName.data());
 }
 
-void CSteamPlayClient::OnReceivePlayerDestroyed(TSteamMessageUniquePtr pSteamMessage)
+void CSteamPlayClient::QueueSendComplete(CSendQueue::SSendInfo const& info, HRESULT result)
 {
-	assert(pSteamMessage != nullptr);
-	Messages::Server::SPlayerDestroyed const& message = *static_cast<Messages::Server::SPlayerDestroyed*>(pSteamMessage->m_pData);
+	if (!WantsSendComplete(info.flags))
+	{
+		return;
+	}
 
-	TPlayers::iterator const playerIt = m_players.find(message.dpid);
-	if (playerIt == m_players.end())
+	// the completion goes to the sending player only
+	TPlayer const* pPlayer = FindPlayer(info.from);
+	if (!pPlayer || !pPlayer->second.local)
 	{
 		return;
 	}
 
-	SPlayerData const& playerData = playerIt->second;
+	SteamNetworkingMessage_t* pSteamMessage = SteamNetworkingUtils()->AllocateMessage(sizeof(DPMSG_SENDCOMPLETE));
+	if (!pSteamMessage)
+	{
+		Log::WarnClient("Failed to allocate send complete message for %u.", info.id);
+		return;
+	}
 
-	size_t const shortNameSize = playerData.shortName.size() + 1;
-	size_t const longNameSize = playerData.longName.size() + 1;
-	size_t const totalSize = sizeof(DPMSG_DESTROYPLAYERORGROUP) + sizeof(wchar_t) * shortNameSize + sizeof(wchar_t) * longNameSize;
-	TSteamMessageSharedPtr sysMsg(SteamNetworkingUtils()->AllocateMessage(totalSize), &ReleaseSteamMessage);
+	using std::chrono::duration_cast;
+	using std::chrono::milliseconds;
+
+	DPMSG_SENDCOMPLETE* pDPMessage = static_cast<DPMSG_SENDCOMPLETE*>(pSteamMessage->m_pData);
+	*pDPMessage = DPMSG_SENDCOMPLETE{};
+	pDPMessage->dwType     = DPSYS_SENDCOMPLETE;
+	pDPMessage->idFrom     = info.from;
+	pDPMessage->idTo       = info.to;
+	pDPMessage->dwFlags    = info.flags;
+	pDPMessage->dwPriority = info.priority;
+	pDPMessage->dwTimeout  = info.timeout;
+	pDPMessage->lpvContext = info.pContext;
+	pDPMessage->dwMsgID    = info.id;
+	pDPMessage->hr         = result;
+	pDPMessage->dwSendTime = static_cast<DWORD>(duration_cast<milliseconds>(TClock::now() - info.start).count());
+
+	TSteamMessageSharedPtr const sysMsg(pSteamMessage, &ReleaseSteamMessage);
+	m_dataMessages.emplace_back(DPID_SYSMSG, info.from, sysMsg, 0, sysMsg->GetSize(), sysMsg->GetSize(), false);
+}
 
-	DPMSG_DESTROYPLAYERORGROUP* pDPMessage = static_cast<DPMSG_DESTROYPLAYERORGROUP*>(sysMsg->m_pData);
-	pDPMessage->dwType           = DPSYS_DESTROYPLAYERORGROUP;
-	pDPMessage->dwPlayerType     = DPPLAYERTYPE_PLAYER;
-	pDPMessage->dpId             = message.dpid;
-	pDPMessage->lpLocalData      = nullptr;
-	pDPMessage->dwLocalDataSize  = 0;
-	pDPMessage->lpRemoteData     = nullptr;
-	pDPMessage->dwRemoteDataSize = 0;
+bool CSteamPlayClient::DestroyPlayer(DPID dpid)
+{
+	// the new host still has to hand the players back
+	if (m_state == Migrating)
+	{
+		return false;
+	}
+
+	if (dpid == DPID_ALLPLAYERS)
+	{
+		TPlayers::iterator it = m_players.begin();
+		while (it != m_players.end())
+		{
+			if (it->second.local)
+			{
+				ErasePlayer(it++);
+			}
+			else
+			{
+				++it;
+			}
+		}
+	}
+	else
+	{
+		TPlayers::iterator const it = m_players.find(dpid);
+		if (it == m_players.end() || !it->second.local)
+		{
+			return false;
+		}
+
+		ErasePlayer(it);
+	}
+
+	Messages::Client::SDestroyPlayer message;
+	message.dpid = dpid;
+	return TMessageSender::Send(message, m_serverConnection, k_nSteamNetworkingSend_Reliable);
+}
+
+HRESULT CSteamPlayClient::GetPlayerName(DPID dpid, LPVOID pData, LPDWORD pSize)
+{
+	if (!pSize)
+	{
+		return DPERR_INVALIDPARAM;
+	}
+
+	TPlayer const* pPlayer = FindPlayer(dpid);
+	if (!pPlayer)
+	{
+		return DPERR_INVALIDPLAYER;
+	}
+
+	SPlayerNames const& names = pPlayer->second.names;
+	size_t const shortNameLen = names.shortNameW.size() + 1;
+	size_t const longNameLen  = names.longNameW.size() + 1;
+	DWORD const  requiredSize = static_cast<DWORD>(sizeof(DPNAME) + sizeof(wchar_t) * (shortNameLen + longNameLen));
+
+	if (!pData || *pSize < requiredSize)
+	{
+		*pSize = requiredSize;
+		return DPERR_BUFFERTOOSMALL;
+	}
+
+	DPNAME*  pName       = static_cast<DPNAME*>(pData);
+	wchar_t* szShortName = reinterpret_cast<wchar_t*>(pName + 1);
+	wchar_t* szLongName  = szShortName + shortNameLen;
+	memcpy(szShortName, names.shortNameW.data(), sizeof(wchar_t) * shortNameLen);
+	memcpy(szLongName, names.longNameW.data(), sizeof(wchar_t) * longNameLen);
+	*pName = ConstructDPName(szShortName, szLongName);
+
+	*pSize = requiredSize;
+	return DP_OK;
+}
+
+HRESULT CSteamPlayClient::ReceiveData(LPDPID pFrom, LPDPID pTo, DWORD flags, LPVOID pData, LPDWORD pSize)
+{
+	if (!pFrom || !pTo || !pSize)
+	{
+		return DPERR_INVALIDPARAM;
+	}
+
+	TDataMessages::iterator it = m_dataMessages.begin();
+	if (!(flags & DPRECEIVE_ALL))
+	{
+		while (it != m_dataMessages.end())
+		{
+			bool const fromValid = !(flags & DPRECEIVE_FROMPLAYER) || it->from == *pFrom;
+			bool const toValid = !(flags & DPRECEIVE_TOPLAYER) || it->to == *pTo;
+			if (fromValid && toValid)
+			{
+				break;
+			}
+
+			++it;
+		}
+	}
+
+	if (it == m_dataMessages.end())
+	{
+		return DPERR_NOMESSAGES;
+	}
+
+	*pFrom = it->from;
+	*pTo = it->to;
+	void const*  pSourceData = static_cast<char const*>(it->pMsg->GetData()) + it->offset;
+	size_t const sourceSize  = it->rawSize;
+
+	if (!pData || *pSize < sourceSize)
+	{
+		return DPERR_BUFFERTOOSMALL;
+	}
+
+	if (it->compressed)
+	{
+		// decompress straight into the game's buffer
+		if (!CLZCodec::DecompressPayload(pSourceData, it->size, pData, sourceSize, GetDictionary(), m_compressionStats))
+		{
+			Log::WarnClient("Failed to decompress data message from %u.", it->from);
+			EraseDataMessage(it);
+			return ReceiveData(pFrom, pTo, flags, pData, pSize);
+		}
+	}
+	else
+	{
+		memcpy(pData, pSourceData, sourceSize);
+	}
+
+	if (it->from == DPID_SYSMSG)
+	{
+		RelocateSysMessage(pData, pSourceData, sourceSize);
+	}
+
+	if (!(flags & DPRECEIVE_PEEK))
+	{
+		EraseDataMessage(it);
+	}
+	return DP_OK;
+}
+
+void CSteamPlayClient::ReceiveNetworkData()
+{
+	static constexpr size_t s_maxMessages = 64;
+
+	if (!SteamNetworkingSockets() || m_serverConnection == k_HSteamNetConnection_Invalid)
+		return;
+
+	SteamNetworkingMessage_t* messages[s_maxMessages];
+	int const count = SteamNetworkingSockets()->ReceiveMessagesOnConnection(m_serverConnection, messages, s_maxMessages);
+
+	if (m_state == Disconnected)
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			assert(messages[i] != nullptr);
+			messages[i]->Release();
+		}
+		return;
+	}
+
+	for (int i = 0; i < count; ++i)
+	{
+		// the session may get lost while handling a message, see LoseSession
+		if (m_state == Disconnected)
+		{
+			messages[i]->Release();
+			continue;
+		}
+		ProcessNetworkingMessage(messages[i]);
+	}
+	if (m_state == Disconnected)
+	{
+		return;
+	}
+
+	FlushSendQueue(false);
+	UpdateSendCompletions();
+
+	static constexpr TClock::duration s_statsReportInterval = std::chrono::seconds(10);
+
+	TClock::time_point const now = TClock::now();
+	if (m_state == Resuming && m_resumeToken != 0 && now >= m_resumeDeadline)
+	{
+		Log::InfoClient("Could not resume the session in time.");
+		if (!m_standbyHost.IsValid() || !StartMigration())
+		{
+			LoseSession();
+		}
+	}
+	else if (m_state == Migrating && now >= m_migrationDeadline)
+	{
+		Log::InfoClient("Could not reach the new host in time.");
+		LoseSession();
+	}
+	UpdateClockSync(now);
+	if (now >= m_nextStatsReport)
+	{
+		m_nextStatsReport = now + s_statsReportInterval;
+
+		using std::chrono::duration_cast;
+		using std::chrono::microseconds;
+		using std::chrono::milliseconds;
+
+		std::array<TClock::duration, static_cast<size_t>(ELane::Count)> queueTimes;
+		if (m_capabilities.Has(EFeature::Lanes) && GetLaneQueueTimes(queueTimes))
+		{
+			Log::DebugClient("Lane queue times: default %lldus, high %lldus, bulk %lldus.",
+				static_cast<long long>(duration_cast<microseconds>(queueTimes[static_cast<size_t>(ELane::Default)]).count()),
+				static_cast<long long>(duration_cast<microseconds>(queueTimes[static_cast<size_t>(ELane::High)]).count()),
+				static_cast<long long>(duration_cast<microseconds>(queueTimes[static_cast<size_t>(ELane::Bulk)]).count()));
+		}
+
+		TClock::duration sessionTime;
+		SClockLatency    latency;
+		if (GetSessionTime(sessionTime) && GetLatency(latency))
+		{
+			Log::DebugClient("Session time %lldms, round trip %lldus, to server %lldus, from server %lldus.",
+				static_cast<long long>(duration_cast<milliseconds>(sessionTime).count()),
+				static_cast<long long>(duration_cast<microseconds>(latency.roundTrip).count()),
+				static_cast<long long>(duration_cast<microseconds>(latency.toServer).count()),
+				static_cast<long long>(duration_cast<microseconds>(latency.fromServer).count()));
+		}
+	}
+}
+
+bool CSteamPlayClient::GetLaneQueueTimes(std::array<TClock::duration, static_cast<size_t>(ELane::Count)>& queueTimes) const
+{
+	if (m_serverConnection == k_HSteamNetConnection_Invalid)
+	{
+		return false;
+	}
+	return TMessageSender::GetLaneQueueTimes(m_serverConnection, queueTimes);
+}
+
+bool CSteamPlayClient::GetSessionTime(TClock::duration& time) const
+{
+	if (!m_clockSync.IsSynchronized())
+	{
+		return false;
+	}
+	time = m_clockSync.GetSessionTime(TClock::now());
+	return true;
+}
+
+bool CSteamPlayClient::GetLatency(SClockLatency& latency) const
+{
+	if (!m_clockSync.IsSynchronized())
+	{
+		return false;
+	}
+	latency = m_clockSync.GetLatency();
+	return true;
+}
+
+void CSteamPlayClient::UpdateClockSync(TClock::time_point now)
+{
+	if (m_state != Connected || !m_capabilities.Has(EFeature::ClockSync) || !m_clockSync.ShouldRequest(now))
+	{
+		return;
+	}
+
+	// a retransmit or nagle would only add to the round trip
+	Messages::Client::STimeRequest request;
+	request.clientTime = CClockSync::ToMicroseconds(now);
+	ELane const lane = m_capabilities.Has(EFeature::Lanes) ? ELane::High : ELane::Default;
+	TMessageSender::Send(request, m_serverConnection, k_nSteamNetworkingSend_UnreliableNoNagle, lane);
+	m_clockSync.OnRequestSent(now);
+}
+
+void CSteamPlayClient::ProcessNetworkingMessage(TSteamMessageUniquePtr pSteamMessage)
+{
+	assert(pSteamMessage != nullptr);
+	assert(pSteamMessage->GetData() != nullptr);
+	assert(pSteamMessage->GetSize() > 0);
+
+	m_replay.Receive(*pSteamMessage);
+
+	using TDispatcher = CMessageDispatcher<CSteamPlayClient, EMessageDirection::ToClient, Log::ESource::Client>;
+	static constexpr TDispatcher::TTable s_dispatchTable = TDispatcher::MakeTable<
+		TDispatcher::SBind<&CSteamPlayClient::OnReceiveInfo>,
+		TDispatcher::SBind<&CSteamPlayClient::OnReceiveAuthPassed>,
+		TDispatcher::SBind<&CSteamPlayClient::OnReceiveCreatePlayerResponse>,
+		TDispatcher::SBind<&CSteamPlayClient::OnReceivePlayerCreated>,
+		TDispatcher::SBind<&CSteamPlayClient::OnReceivePlayerDestroyed>,
+		TDispatcher::SBind<&CSteamPlayClient::OnReceiveTimeResponse>,
+		TDispatcher::SBind<&CSteamPlayClient::OnReceiveResumeToken>,
+		TDispatcher::SBind<&CSteamPlayClient::OnReceiveResumeResponse>,
+		TDispatcher::SBind<&CSteamPlayClient::OnReceiveStandbySession>,
+		TDispatcher::SBind<&CSteamPlayClient::OnReceiveStandbyPlayer>,
+		TDispatcher::SBind<&CSteamPlayClient::OnReceiveStandbyHost>,
+		TDispatcher::SBindRaw<Messages::Shared::SData, &CSteamPlayClient::OnReceiveData>,
+		TDispatcher::SBindRaw<Messages::Shared::SDataHeader, &CSteamPlayClient::OnReceiveData>,
+		TDispatcher::SBindRaw<Messages::Server::SDataBundle, &CSteamPlayClient::OnReceiveDataBundle>,
+		TDispatcher::SBindRaw<Messages::Shared::SDataFragment, &CSteamPlayClient::OnReceiveDataFragment>>();
+
+	TDispatcher::Dispatch(s_dispatchTable, *this, std::move(pSteamMessage));
+}
+
+void CSteamPlayClient::OnReceiveInfo(Messages::Server::SInfo const& message)
+{
+	if (message.protocol != s_protocolId)
+	{
+		Log::WarnClient("The server runs an incompatible version, protocol 0x%x.", message.protocol);
+		if (m_state == Connecting)
+		{
+			Disconnect(EDisconnectReason::ClientDisconnect);
+		}
+		else
+		{
+			LoseSession();
+		}
+		return;
+	}
+
+	SCapabilities const localCapabilities = SSteamPlayConfig::Get().GetCapabilities();
+	SCapabilities const previousCapabilities = m_capabilities;
+	m_capabilities = SCapabilities::Negotiate(localCapabilities, message.capabilities);
+	if (m_capabilities.Has(EFeature::Lanes) && !SSteamPlayConfig::Get().ConfigureLanes(SteamNetworkingSockets(), m_serverConnection, m_capabilities))
+	{
+		m_capabilities.features &= ~SCapabilities::s_laneFeatures;
+	}
+	if (m_capabilities.Has(EFeature::LowLatency))
+	{
+		SteamNetworkingUtils()->SetConnectionConfigValueInt32(m_serverConnection, k_ESteamNetworkingConfig_NagleTime, 0);
+	}
+	Log::DebugClient("Using protocol version %u with features 0x%x.", m_capabilities.version, m_capabilities.features);
+	LogJoinStep("got the server info");
+
+	if (m_state == Resuming)
+	{
+		// the replayed messages were encoded with the old capabilities
+		if (m_capabilities.features != previousCapabilities.features
+			|| m_capabilities.maxBatchSize != previousCapabilities.maxBatchSize
+			|| m_capabilities.dictionaryId != previousCapabilities.dictionaryId)
+		{
+			Log::InfoClient("Could not resume the session, the server's capabilities changed.");
+			LoseSession();
+			return;
+		}
+
+		Messages::Client::SResume resume;
+		resume.token        = m_resumeToken;
+		resume.received     = m_replay.GetSuspendedReceived();
+		resume.capabilities = localCapabilities;
+		TMessageSender::Send(resume, m_serverConnection, k_nSteamNetworkingSend_Reliable);
+		return;
+	}
+
+	// the server got our credentials already, unless it asks for a password we did not have
+	bool const earlyAuth = m_earlyAuthSent && m_capabilities.Has(EFeature::EarlyAuth) && (!message.password || !m_password.empty());
+	if (!message.auth)
+	{
+		CancelAuthTicket();
+	}
+
+	if (!message.auth && !message.password)
+	{
+		// servers with capabilities still need to know ours
+		if (m_capabilities.version > 0 && !earlyAuth)
+		{
+			Messages::Client::SBeginAuth announce;
+			announce.capabilities = localCapabilities;
+			TMessageSender::Send(announce, m_serverConnection, k_nSteamNetworkingSend_Reliable);
+		}
+
+		SteamNetConnectionInfo_t info;
+		SteamNetworkingSockets()->GetConnectionInfo(m_serverConnection, &info);
+		SteamUser()->AdvertiseGame(k_steamIDNonSteamGS, info.m_addrRemote.GetIPv4(), info.m_addrRemote.m_port);
+
+		bool const migrated = m_state == Migrating;
+		m_state = Connected;
+		if (migrated)
+		{
+			CompleteMigration();
+		}
+
+		Log::InfoClient("Connected to server!");
+		return;
+	}
+
+	//Steamworks_TestSecret();
+
+	if (earlyAuth)
+	{
+		if (m_state != Migrating)
+		{
+			m_state = PendingAuth;
+		}
+		Log::InfoClient("Pending Auth with server, sent along with the connection request!");
+		return;
+	}
+
+	Messages::Client::SBeginAuth response;
+	response.capabilities = localCapabilities;
+	if (message.password)
+	{
+		if (m_password.empty())
+		{
+			if (!ShowPasswordRequest(m_password.data(), m_password.array_size()))
+			{
+				Disconnect(EDisconnectReason::ClientDisconnect); // todo? test, DPERR_INVALIDPASSWORD
+				return;
+			}
+		}
+
+		response.password = m_password;
+	}
+
+	if (message.auth)
+	{
+		RequestAuthTicket();
+		response.token = SByteView{ m_authToken.data(), m_authTokenSize };
+	}
+
+	TMessageSender::Send(response, m_serverConnection, k_nSteamNetworkingSend_Reliable);
+
+	// a migrating client stays connected for the game while the new host authenticates it
+	if (m_state != Migrating)
+	{
+		m_state = PendingAuth;
+	}
+	Log::InfoClient("Pending Auth with server!");
+}
+
+void CSteamPlayClient::OnReceiveAuthPassed(Messages::Server::SAuthPassed const&)
+{
+	bool const migrated = m_state == Migrating;
+	m_state = Connected;
+	Log::InfoClient("Passed Auth with server!");
+	LogJoinStep("passed auth");
+	if (migrated)
+	{
+		CompleteMigration();
+	}
+}
+
+void CSteamPlayClient::OnReceiveCreatePlayerResponse(Messages::Server::SCreatePlayerResponse const& message)
+{
+	// servers without request ids answer in order
+	TCreatePlayerRequests::iterator const it = message.requestId != 0
+		? std::find_if(m_createPlayerRequests.begin(), m_createPlayerRequests.end(), [&message](SCreatePlayerRequest const& request) { return request.requestId == message.requestId; })
+		: m_createPlayerRequests.begin();
+	if (it == m_createPlayerRequests.end())
+	{
+		Log::WarnClient("Got a response to unknown create player request %u.", message.requestId);
+		return;
+	}
+
+	SCreatePlayerRequest request = std::move(*it);
+	m_createPlayerRequests.erase(it);
+
+	if (request.abandoned)
+	{
+		// the game was told the player could not be created
+		if (message.dpid != DPID_UNKNOWN)
+		{
+			Log::InfoClient("Destroying player %u, its create request was abandoned.", message.dpid);
+			Messages::Client::SDestroyPlayer destroy;
+			destroy.dpid = message.dpid;
+			TMessageSender::Send(destroy, m_serverConnection, k_nSteamNetworkingSend_Reliable);
+		}
+		return;
+	}
+
+	if (message.dpid != DPID_UNKNOWN)
+	{
+		// reuse the names we converted when sending the request unless the server changed them
+		bool const sameNames = strcmp(request.names.shortName, message.shortName) == 0
+			&& strcmp(request.names.longName, message.longName) == 0;
+
+		TPlayer const& player = AddPlayer(message.dpid, sameNames ? request.names : SPlayerNames(message.shortName, message.longName), true, message.slot);
+		if (m_primaryPlayer == DPID_UNKNOWN && !m_primaryPlayerRetired)
+		{
+			m_primaryPlayer = message.dpid;
+		}
+		Log::DebugClient("Created local player '%s' '%s'", player.second.names.shortName.data(), player.second.names.longName.data());
+		LogJoinStep("created the first player");
+		m_joinStart = TClock::time_point();
+	}
+	else
+	{
+		Log::InfoClient("Server failed to create player.");
+	}
+
+	if (request.callback)
+	{
+		request.callback(message.dpid);
+	}
+}
+
+void CSteamPlayClient::OnReceivePlayerCreated(Messages::Server::SPlayerCreated const& message)
+{
+	if (message.dpid == DPID_UNKNOWN)
+	{
+		return;
+	}
+
+	TPlayer const& player = AddPlayer(message.dpid, SPlayerNames(message.shortName, message.longName), false, message.slot);
+
+	DPMSG_CREATEPLAYERORGROUP createTemplate = s_createPlayerTemplate;
+	createTemplate.dwCurrentPlayers = m_players.size();
+	QueueSysMessage(AllocatePlayerSysMessage(createTemplate, player));
+
+	Log::DebugClient("Created remote player %u '%s' '%s'", message.dpid, player.second.names.shortName.data(), player.second.names.longName.data());
+}
+
+void CSteamPlayClient::OnReceivePlayerDestroyed(Messages::Server::SPlayerDestroyed const& message)
+{
+	TPlayers::iterator const playerIt = m_players.find(message.dpid);
+	if (playerIt == m_players.end())
+	{
+		return;
+	}
+
+	TSteamMessageSharedPtr const sysMsg = AllocatePlayerSysMessage(s_destroyPlayerTemplate, *playerIt);
+	ErasePlayer(playerIt);
+	QueueSysMessage(sysMsg);
+}
+
+CSteamPlayClient::TPlayer& CSteamPlayClient::AddPlayer(DPID dpid, SPlayerNames const& names, bool local, TPlayerSlot slot)
+{
+	if (m_players.contains(dpid))
+	{
+		Log::InfoClient("Player with id %u already exists.", dpid);
+	}
+
+	SPlayerData& playerData = m_players[dpid];
+	if (playerData.slot != s_invalidPlayerSlot)
+	{
+		m_playerSlots[playerData.slot] = DPID_UNKNOWN;
+	}
+
+	playerData.names = names;
+	playerData.local = local;
+	playerData.slot  = slot < s_maxPlayerSlots ? slot : s_invalidPlayerSlot;
+	if (playerData.slot != s_invalidPlayerSlot)
+	{
+		m_playerSlots[playerData.slot] = dpid;
+	}
+	return *m_players.find(dpid);
+}
+
+void CSteamPlayClient::ErasePlayer(TPlayers::iterator it)
+{
+	if (it->second.slot != s_invalidPlayerSlot && m_playerSlots[it->second.slot] == it->first)
+	{
+		m_playerSlots[it->second.slot] = DPID_UNKNOWN;
+	}
+
+	// the server retires the primary player as well, later data needs an explicit sender
+	if (it->first == m_primaryPlayer)
+	{
+		m_primaryPlayer = DPID_UNKNOWN;
+		m_primaryPlayerRetired = true;
+	}
+
+	m_deltaSendStreams.ErasePlayer(it->first);
+	m_deltaReceiveStreams.ErasePlayer(it->first);
+	m_sequenceCounters.ErasePlayer(it->first);
+	m_sequenceFilter.ErasePlayer(it->first);
+	m_redundantSender.ErasePlayer(it->first);
+	m_redundantReceiver.ErasePlayer(it->first);
+
+	m_players.erase(it);
+}
+
+DPID CSteamPlayClient::GetSlotPlayer(TPlayerSlot slot) const
+{
+	return slot < s_maxPlayerSlots ? m_playerSlots[slot] : DPID_UNKNOWN;
+}
+
+TPlayerSlot CSteamPlayClient::GetPlayerSlot(DPID dpid) const
+{
+	TPlayers::const_iterator const it = m_players.find(dpid);
+	return it != m_players.end() ? it->second.slot : s_invalidPlayerSlot;
+}
+
+template<typename TDPMessage>
+TSteamMessageSharedPtr CSteamPlayClient::AllocatePlayerSysMessage(TDPMessage const& messageTemplate, TPlayer const& player) const
+{
+	SPlayerNames const& names = player.second.names;
+	size_t const shortNameLen = names.shortNameW.size() + 1;
+	size_t const longNameLen  = names.longNameW.size() + 1;
+	size_t const totalSize    = sizeof(TDPMessage) + sizeof(wchar_t) * (shortNameLen + longNameLen);
+
+	SteamNetworkingMessage_t* pSteamMessage = SteamNetworkingUtils()->AllocateMessage(totalSize);
+	if (!pSteamMessage)
+	{
+		Log::WarnClient("Failed to allocate system message of size %u.", totalSize);
+		return nullptr;
+	}
+
+	TDPMessage* pDPMessage = static_cast<TDPMessage*>(pSteamMessage->m_pData);
+	*pDPMessage = messageTemplate;
+	pDPMessage->dpId = player.first;
 
 	wchar_t* szShortName = reinterpret_cast<wchar_t*>(pDPMessage + 1);
-	wchar_t* szLongName  = szShortName + shortNameSize;
-	mbstowcs(szShortName, playerData.shortName.data(), shortNameSize);
-	mbstowcs(szLongName, playerData.longName.data(), longNameSize);
+	wchar_t* szLongName  = szShortName + shortNameLen;
+	memcpy(szShortName, names.shortNameW.data(), sizeof(wchar_t) * shortNameLen);
+	memcpy(szLongName, names.longNameW.data(), sizeof(wchar_t) * longNameLen);
 	pDPMessage->dpnName = ConstructDPName(szShortName, szLongName);
 
-	pDPMessage->dpIdParent = 0;
-	pDPMessage->dwFlags    = 0;
+	return TSteamMessageSharedPtr(pSteamMessage, &ReleaseSteamMessage);
+}
+
+void CSteamPlayClient::QueueSysMessage(TSteamMessageSharedPtr const& sysMsg)
+{
+	if (!sysMsg)
+	{
+		return;
+	}
 
-	m_players.erase(playerIt);
 	for (TPlayer const& player : m_players)
 	{
 		if (player.second.local)
 		{
-			m_dataMessages.emplace_back(DPID_SYSMSG, player.first, sysMsg);
+			m_dataMessages.emplace_back(DPID_SYSMSG, player.first, sysMsg, 0, sysMsg->GetSize(), sysMsg->GetSize(), false);
+		}
+	}
+}
+
+void CSteamPlayClient::OnReceiveTimeResponse(Messages::Server::STimeResponse const& message)
+{
+	if (!m_capabilities.Has(EFeature::ClockSync))
+	{
+		Log::WarnClient("Got a time response without negotiating clock sync.");
+		return;
+	}
+
+	if (!m_clockSync.AddSample(message.clientTime, message.sessionTime, TClock::now()))
+	{
+		Log::DebugClient("Dropped an implausible clock sample.");
+	}
+}
+
+void CSteamPlayClient::OnReceiveResumeToken(Messages::Server::SResumeToken const& message)
+{
+	m_resumeToken     = message.token;
+	m_resumeGraceTime = std::chrono::milliseconds(message.graceTime);
+}
+
+void CSteamPlayClient::OnReceiveResumeResponse(Messages::Server::SResumeResponse const& message)
+{
+	if (m_state != Resuming)
+	{
+		return;
+	}
+
+	CReplayBuffer::TEntries messages;
+	if (!message.accepted || !m_replay.Resume(message.received, messages))
+	{
+		Log::InfoClient("The server could not resume the session.");
+		LoseSession();
+		return;
+	}
+
+	m_state = Connected;
+
+	TLaneBytes replayedBytes{};
+	for (CReplayBuffer::SEntry const& entry : messages)
+	{
+		if (TSteamMessageUniquePtr pSteamMessage = TMessageSender::Allocate(entry.data.size()))
+		{
+			memcpy(pSteamMessage->m_pData, entry.data.data(), entry.data.size());
+			TMessageSender::Send(std::move(pSteamMessage), m_serverConnection, k_nSteamNetworkingSend_Reliable, static_cast<ELane>(entry.lane));
+			replayedBytes[entry.lane] += entry.data.size();
+		}
+	}
+
+	// pending sends are either replayed or arrived already, both are acknowledged once the replay of their lane is
+	m_reliableBytesSent = replayedBytes;
+	for (size_t lane = 0; lane < m_pendingCompletions.size(); ++lane)
+	{
+		for (SPendingCompletion& pending : m_pendingCompletions[lane])
+		{
+			pending.reliableEnd = replayedBytes[lane];
 		}
 	}
+
+	Log::InfoClient("Resumed the session, replayed %zu messages.", messages.size());
+}
+
+void CSteamPlayClient::OnReceiveStandbySession(Messages::Server::SStandbySession const& message)
+{
+	m_standby = true;
+	m_standbyRoster.Apply(message);
+	m_standbyRosterChanged = true;
+	Log::InfoClient("The server made this client its standby host.");
+}
+
+void CSteamPlayClient::OnReceiveStandbyPlayer(Messages::Server::SStandbyPlayer const& message)
+{
+	if (!m_standby)
+	{
+		Log::WarnClient("Got a standby player without being the standby host.");
+		return;
+	}
+
+	m_standbyRoster.Apply(message);
+	m_standbyRosterChanged = true;
+}
+
+void CSteamPlayClient::OnReceiveStandbyHost(Messages::Server::SStandbyHost const& message)
+{
+	m_standbyHost = CSteamID(message.serverId);
+}
+
+bool CSteamPlayClient::GetStandbyRoster(SStandbyRoster& roster)
+{
+	if (!m_standbyRosterChanged)
+	{
+		return false;
+	}
+
+	roster = m_standbyRoster;
+	m_standbyRosterChanged = false;
+	return true;
+}
+
+void CSteamPlayClient::ReportStandbyServer(CSteamID serverID)
+{
+	Messages::Client::SStandbyReady ready;
+	ready.serverId = serverID.ConvertToUint64();
+	TMessageSender::Send(ready, m_serverConnection, k_nSteamNetworkingSend_Reliable);
 }
 
 void CSteamPlayClient::OnReceiveData(TSteamMessageUniquePtr pSteamMessage)
 {
 	assert(pSteamMessage != nullptr);
-	Messages::Shared::SData const& message = *static_cast<Messages::Shared::SData*>(pSteamMessage->m_pData);
 
-	if (!IsDPIDValidFrom(message.from))
+	size_t const size = pSteamMessage->GetSize();
+	QueueData(TSteamMessageSharedPtr(pSteamMessage.release(), &ReleaseSteamMessage), 0, size);
+}
+
+void CSteamPlayClient::OnReceiveDataBundle(TSteamMessageUniquePtr pSteamMessage)
+{
+	assert(pSteamMessage != nullptr);
+
+	// all contained messages share the bundle buffer
+	TSteamMessageSharedPtr const pBundle(pSteamMessage.release(), &ReleaseSteamMessage);
+	bool const valid = Messages::Server::SDataBundle::ForEach(pBundle->GetData(), pBundle->GetSize(), [this, &pBundle](size_t offset, size_t size)
+	{
+		EMessage const id = *reinterpret_cast<EMessage const*>(static_cast<char const*>(pBundle->GetData()) + offset);
+		if (id == Messages::Shared::SDataHeader::ID || (id == Messages::Shared::SData::ID && size >= sizeof(Messages::Shared::SData)))
+		{
+			QueueData(pBundle, offset, size);
+		}
+		else
+		{
+			Log::WarnClient("Server data bundle contains message %u.", id);
+		}
+	});
+
+	if (!valid)
+	{
+		Log::WarnClient("Server data bundle is malformed.");
+	}
+}
+
+// Collects the fragments of a transfer, the complete data message is handled like an unfragmented one.
+void CSteamPlayClient::OnReceiveDataFragment(TSteamMessageUniquePtr pSteamMessage)
+{
+	assert(pSteamMessage != nullptr);
+
+	TSteamMessageUniquePtr pComplete;
+	if (!m_fragments.Add(*pSteamMessage, SSteamPlayConfig::Get().maxMessageSize, pComplete))
+	{
+		Log::WarnClient("Dropped a server data transfer, a fragment was malformed or out of order.");
+		return;
+	}
+
+	if (pComplete)
+	{
+		OnReceiveData(std::move(pComplete));
+	}
+}
+
+// Queues the data message at offset of pSteamMessage for the local recipients.
+void CSteamPlayClient::QueueData(TSteamMessageSharedPtr const& pSteamMessage, size_t offset, size_t size)
+{
+	void const* const pMessage = static_cast<char const*>(pSteamMessage->GetData()) + offset;
+
+	DPID   from;
+	DPID   to;
+	size_t headerSize;
+	bool   compressed = false;
+	bool   delta      = false;
+	bool   sequenced  = false;
+	bool   redundant  = false;
+	uint16 sequence   = 0;
+
+	if (static_cast<SMessage const*>(pMessage)->GetId() == Messages::Shared::SData::ID)
+	{
+		// the size was checked by the dispatch table or the bundle
+		Messages::Shared::SData const& message = *static_cast<Messages::Shared::SData const*>(pMessage);
+		from       = message.from;
+		to         = message.to;
+		headerSize = sizeof(Messages::Shared::SData);
+	}
+	else
+	{
+		using EAddress = Messages::Shared::SDataHeader::EAddress;
+
+		Messages::Shared::SDataHeader header;
+		headerSize = header.Read(pMessage, size);
+		if (headerSize == 0)
+		{
+			Log::WarnClient("Server data header is malformed.");
+			return;
+		}
+
+		// the server always names the sender, slots it only uses for players it told us about
+		from = header.fromMode == EAddress::Slot ? GetSlotPlayer(static_cast<TPlayerSlot>(header.from)) : header.fromMode == EAddress::Id ? header.from : DPID_UNKNOWN;
+		to   = header.toMode == EAddress::Slot ? GetSlotPlayer(static_cast<TPlayerSlot>(header.to)) : header.to;
+		compressed = (header.flags & Messages::Shared::SDataHeader::s_flagCompressed) != 0;
+		delta      = (header.flags & Messages::Shared::SDataHeader::s_flagDelta) != 0;
+		sequenced  = (header.flags & Messages::Shared::SDataHeader::s_flagSequenced) != 0;
+		redundant  = (header.flags & Messages::Shared::SDataHeader::s_flagRedundant) != 0;
+		sequence   = header.sequence;
+	}
+
+	if (!IsDPIDValidFrom(from))
 	{
 		Log::WarnClient("Server data message sender is invalid.");
 		return;
 	}
 
-	if (!IsDPIDValidTo(message.to))
+	if (!IsDPIDValidTo(to))
 	{
 		Log::WarnClient("Server data message recipient is invalid.");
 		return;
 	}
 
-	if (message.to == DPID_ALLPLAYERS)
+	void const* const pPayload   = static_cast<char const*>(pMessage) + headerSize;
+	TSteamMessageSharedPtr pData = pSteamMessage;
+	uint32 payloadOffset         = static_cast<uint32>(offset + headerSize);
+	uint32 payloadSize           = static_cast<uint32>(size - headerSize);
+	size_t rawSize               = payloadSize;
+	if (compressed && (delta || CLZCodec::ReadPayloadSize(pPayload, payloadSize, rawSize) == 0))
+	{
+		Log::WarnClient("Server data message has a malformed compressed payload.");
+		return;
+	}
+
+	// deltas are applied in the order they arrive, ReceiveData may pick messages out of order
+	bool const  reliable = (pSteamMessage->m_nFlags & k_nSteamNetworkingSend_Reliable) != 0;
+	ELane const lane     = static_cast<ELane>(pSteamMessage->m_idxLane);
+	if (sequenced)
+	{
+		if (reliable || delta || !m_capabilities.Has(EFeature::Sequenced))
+		{
+			Log::WarnClient("Server data message is sequenced without negotiating it.");
+			return;
+		}
+		if (!m_sequenceFilter.Accept(SStreamKey{ from, to, lane }, sequence))
+		{
+			return;
+		}
+	}
+	if (redundant)
+	{
+		if (reliable || delta || compressed || sequenced || !m_capabilities.Has(EFeature::Redundancy))
+		{
+			Log::WarnClient("Server data message is redundant without negotiating it.");
+			return;
+		}
+		if (!m_redundantReceiver.Receive(SStreamKey{ from, to, lane }, sequence, pPayload, payloadSize, m_redundantPayloads))
+		{
+			Log::WarnClient("Server data message has malformed redundant payloads.");
+			return;
+		}
+
+		// all payloads point into the same steam message
+		uint8 const* const pBase = static_cast<uint8 const*>(pSteamMessage->GetData());
+		for (CRedundantReceiver::SPayload const& payload : m_redundantPayloads)
+		{
+			uint32 const size = static_cast<uint32>(payload.size);
+			QueueDataForRecipients(SDataMessageCache{ from, to, pData, static_cast<uint32>(payload.pData - pBase), size, size, false, false, to, lane });
+		}
+		return;
+	}
+	if (delta)
+	{
+		uint8 const* pDecoded = m_capabilities.Has(EFeature::Delta) && reliable ? m_deltaReceiveStreams.Decode(from, to, lane, pPayload, payloadSize, rawSize) : nullptr;
+		if (!pDecoded)
+		{
+			Log::InfoClient("Dropped data message from %u, its delta could not be applied.", from);
+			return;
+		}
+
+		pData = TSteamMessageSharedPtr(SteamNetworkingUtils()->AllocateMessage(rawSize), &ReleaseSteamMessage);
+		if (!pData)
+		{
+			Log::WarnClient("Failed to allocate data message of size %u.", rawSize);
+			return;
+		}
+		memcpy(pData->m_pData, pDecoded, rawSize);
+		payloadOffset = 0;
+		payloadSize   = static_cast<uint32>(rawSize);
+	}
+	else if (!compressed && m_capabilities.Has(EFeature::Delta) && CDeltaStreams::IsEligible(payloadSize, pSteamMessage->m_nFlags))
+	{
+		m_deltaReceiveStreams.Store(from, to, lane, pPayload, payloadSize);
+	}
+
+	QueueDataForRecipients(SDataMessageCache{ from, to, pData, payloadOffset, payloadSize, static_cast<uint32>(rawSize), compressed, sequenced, to, lane });
+}
+
+// Queues a copy of the message for each local player it is addressed to.
+void CSteamPlayClient::QueueDataForRecipients(SDataMessageCache message)
+{
+	DPID const to = message.to;
+	if (to == DPID_ALLPLAYERS)
 	{
-		TSteamMessageSharedPtr ptr(pSteamMessage.release(), &ReleaseSteamMessage);
 		for (TPlayer const& player : m_players)
 		{
 			if (player.second.local)
 			{
-				m_dataMessages.emplace_back(message.from, player.first, ptr);
+				message.to = player.first;
+				QueueDataMessage(message);
 			}
 		}
 	}
-	else if (TPlayer* recipient = FindPlayer(message.to))
+	else if (TPlayer* recipient = FindPlayer(to))
 	{
 		if (recipient->second.local)
 		{
-			m_dataMessages.emplace_back(message.from, message.to, TSteamMessageSharedPtr(pSteamMessage.release(), &ReleaseSteamMessage));
+			QueueDataMessage(message);
 		}
 	}
 	else
 	{
-		Log::InfoClient("Server data message recipient %u not found!", message.to);
+		Log::InfoClient("Server data message recipient %u not found!", to);
+	}
+}
+
+void CSteamPlayClient::QueueDataMessage(SDataMessageCache const& message)
+{
+	// newer data of a sequenced stream takes the place of the entry the game did not receive yet
+	if (message.sequenced && m_sequencedQueued > 0)
+	{
+		for (TDataMessages::reverse_iterator it = m_dataMessages.rbegin(); it != m_dataMessages.rend(); ++it)
+		{
+			if (it->sequenced && it->from == message.from && it->to == message.to && it->streamTo == message.streamTo && it->lane == message.lane)
+			{
+				*it = message;
+				return;
+			}
+		}
 	}
+
+	m_dataMessages.push_back(message);
+	m_sequencedQueued += message.sequenced ? 1 : 0;
+}
+
+void CSteamPlayClient::EraseDataMessage(TDataMessages::iterator it)
+{
+	m_sequencedQueued -= it->sequenced ? 1 : 0;
+	m_dataMessages.erase(it);
+}
+
+CLZDictionary const* CSteamPlayClient::GetDictionary() const
+{
+	// a dictionary is only used if the server has the same one
+	return m_capabilities.dictionaryId != 0 ? SSteamPlayConfig::Get().pDictionary.get() : nullptr;
 }
 
 static bool IsSteamNetworkingDisconnected(ESteamNetworkingConnectionState state)
@@ -537,29 +1670,230 @@ static bool IsSteamNetworkingDisconnected(ESteamNetworkingConnectionState state)
 
 void CSteamPlayClient::OnNetConnectionStatusChanged(SteamNetConnectionStatusChangedCallback_t* pCallback)
 {
+	if (pCallback->m_hConn != m_serverConnection)
+	{
+		return;
+	}
+
 	SteamNetConnectionInfo_t const& info = pCallback->m_info;
 	ESteamNetworkingConnectionState const oldState = pCallback->m_eOldState;
 	ESteamNetworkingConnectionState const newState = info.m_eState;
 
+	if (newState == k_ESteamNetworkingConnectionState_Connected && oldState != newState)
+	{
+		LogJoinStep("connected");
+	}
+
 	if (!IsSteamNetworkingDisconnected(oldState) &&
 		 IsSteamNetworkingDisconnected(newState))
 	{
 		Log::DebugClient("SessionLost %i %i", oldState, newState);
 		//Disconnect((EDisconnectReason)info.m_eEndReason);
 
-		TSteamMessageSharedPtr sysMsg(SteamNetworkingUtils()->AllocateMessage(sizeof(DPMSG_SESSIONLOST)), &ReleaseSteamMessage);
+		if (CanResume(info.m_eEndReason) && StartResume())
+		{
+			return;
+		}
+		if (CanMigrate(info.m_eEndReason) && StartMigration())
+		{
+			return;
+		}
+		LoseSession();
+	}
+}
 
-		static_cast<DPMSG_SESSIONLOST*>(sysMsg->m_pData)->dwType = DPSYS_SESSIONLOST;
-		for (TPlayer const& player : m_players)
+void CSteamPlayClient::RequestAuthTicket()
+{
+	if (m_authTicket != k_HAuthTicketInvalid)
+	{
+		return;
+	}
+
+	m_authTokenSize = 0;
+	m_authTicket = SteamUser()->GetAuthSessionTicket(m_authToken.data(), static_cast<int>(m_authToken.size()), &m_authTokenSize);
+	if (m_authTokenSize < 1)
+	{
+		Log::WarnClient("Got invalid auth session ticket!");
+	}
+}
+
+void CSteamPlayClient::CancelAuthTicket()
+{
+	if (m_authTicket != k_HAuthTicketInvalid)
+	{
+		SteamUser()->CancelAuthTicket(m_authTicket);
+		m_authTicket = k_HAuthTicketInvalid;
+	}
+	m_authTokenSize = 0;
+}
+
+// Join time is measured from Join until the first local player exists, see EFeature::EarlyAuth.
+void CSteamPlayClient::LogJoinStep(char const* szStep) const
+{
+	if (m_joinStart == TClock::time_point())
+	{
+		return;
+	}
+
+	long long const elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(TClock::now() - m_joinStart).count();
+	Log::InfoClient("Join %s after %lldms.", szStep, elapsed);
+}
+
+bool CSteamPlayClient::CanResume(int endReason) const
+{
+	if (m_resumeToken == 0 || (m_state != Connected && m_state != Resuming))
+	{
+		return false;
+	}
+
+	switch (static_cast<EDisconnectReason>(endReason))
+	{
+	case EDisconnectReason::ServerClosed:
+	case EDisconnectReason::ServerReject:
+	case EDisconnectReason::ServerFull:
+	case EDisconnectReason::ClientKicked:
+		return false;
+	default:
+		return true;
+	}
+}
+
+// The server keeps the players of a lost connection for the grace time it sent with the token.
+// Connection attempts are retried until then, everything sent meanwhile is recorded for the replay.
+bool CSteamPlayClient::StartResume()
+{
+	TClock::time_point const now = TClock::now();
+	if (m_state != Resuming)
+	{
+		m_state          = Resuming;
+		m_resumeDeadline = now + m_resumeGraceTime;
+		m_replay.Suspend();
+		Log::InfoClient("Lost the connection to the server, resuming the session...");
+	}
+	else if (now >= m_resumeDeadline)
+	{
+		return false;
+	}
+
+	SteamNetworkingIdentity identity{ };
+	identity.SetSteamID(m_serverID);
+	HSteamNetConnection const connection = SteamNetworkingSockets()->ConnectP2P(identity, 0, 0, nullptr);
+	if (connection == k_HSteamNetConnection_Invalid)
+	{
+		return false;
+	}
+
+	SteamNetworkingSockets()->CloseConnection(m_serverConnection, static_cast<int>(EDisconnectReason::ClientResume), nullptr, false);
+	m_serverConnection = connection;
+	return true;
+}
+
+bool CSteamPlayClient::CanMigrate(int endReason) const
+{
+	if (!m_standbyHost.IsValid() || (m_state != Connected && m_state != Resuming))
+	{
+		return false;
+	}
+
+	switch (static_cast<EDisconnectReason>(endReason))
+	{
+	case EDisconnectReason::ServerReject:
+	case EDisconnectReason::ServerFull:
+	case EDisconnectReason::ClientKicked:
+		return false;
+	default:
+		return true;
+	}
+}
+
+// The standby host holds the connection until it lost the host as well, then the usual handshake gives
+// this client its players back. Everything else that belonged to the old connection starts over.
+bool CSteamPlayClient::StartMigration()
+{
+	SteamNetworkingIdentity identity{ };
+	identity.SetSteamID(m_standbyHost);
+	HSteamNetConnection const connection = SteamNetworkingSockets()->ConnectP2P(identity, 0, 0, nullptr);
+	if (connection == k_HSteamNetConnection_Invalid)
+	{
+		return false;
+	}
+
+	SteamNetworkingSockets()->CloseConnection(m_serverConnection, static_cast<int>(EDisconnectReason::ClientDisconnect), nullptr, false);
+	CancelAuthTicket();
+	m_earlyAuthSent = false;
+
+	TClock::time_point const now = TClock::now();
+	m_state             = Migrating;
+	m_serverID          = m_standbyHost;
+	m_serverConnection  = connection;
+	m_standbyHost       = CSteamID();
+	m_migrationStart    = now;
+	m_migrationDeadline = now + std::chrono::milliseconds(SSteamPlayConfig::Get().migrationTimeout);
+
+	m_capabilities        = SCapabilities();
+	m_deltaSendStreams    = CDeltaStreams();
+	m_deltaReceiveStreams = CDeltaStreams();
+	m_fragments.Clear();
+	m_sequenceCounters    = CSequenceCounters();
+	m_sequenceFilter      = CSequenceFilter();
+	m_redundantSender     = CRedundantSender();
+	m_redundantReceiver   = CRedundantReceiver();
+	m_clockSync           = CClockSync();
+	m_replay              = CReplayBuffer();
+	m_replay.SetMaxSize(SSteamPlayConfig::Get().resumeReplaySize);
+	m_resumeToken         = 0;
+
+	// the old host answers no more requests
+	FailCreatePlayerRequests();
+
+	// nobody can tell whether the old host passed these on
+	for (TPendingCompletions& completions : m_pendingCompletions)
+	{
+		for (SPendingCompletion const& pending : completions)
 		{
-			if (player.second.local)
-			{
-				m_dataMessages.emplace_back(DPID_SYSMSG, player.first, sysMsg);
-			}
+			QueueSendComplete(pending.info, DPERR_CONNECTIONLOST);
 		}
+		completions.clear();
+	}
+	m_reliableBytesSent.fill(0);
+
+	Log::InfoClient("Lost the host, migrating to server %llu...", m_serverID.ConvertToUint64());
+	return true;
+}
 
-		// The game might not notify the player.
-		MessageBoxA(GetMainWindow(), "Session has been closed.", "Steamworks Connection", MB_OK);
+void CSteamPlayClient::CompleteMigration()
+{
+	long long const elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(TClock::now() - m_migrationStart).count();
+	Log::InfoClient("Migrated to the new host in %lldms.", elapsed);
+
+	if (m_standby)
+	{
+		// the server of this client is the host now
+		m_standby = false;
+		m_standbyRoster = SStandbyRoster();
+		m_standbyRosterChanged = false;
+
+		TSteamMessageSharedPtr sysMsg(SteamNetworkingUtils()->AllocateMessage(sizeof(DPMSG_HOST)), &ReleaseSteamMessage);
+		static_cast<DPMSG_HOST*>(sysMsg->m_pData)->dwType = DPSYS_HOST;
+		QueueSysMessage(sysMsg);
 	}
 }
 
+void CSteamPlayClient::LoseSession()
+{
+	TSteamMessageSharedPtr sysMsg(SteamNetworkingUtils()->AllocateMessage(sizeof(DPMSG_SESSIONLOST)), &ReleaseSteamMessage);
+	static_cast<DPMSG_SESSIONLOST*>(sysMsg->m_pData)->dwType = DPSYS_SESSIONLOST;
+	QueueSysMessage(sysMsg);
+
+	// nothing is sent on the lost connection anymore, what arrived before and DPSYS_SESSIONLOST still go to the game
+	TDataMessages dataMessages;
+	std::swap(dataMessages, m_dataMessages);
+	size_t const sequencedQueued = m_sequencedQueued;
+	Disconnect(EDisconnectReason::ClientDisconnect);
+	m_dataMessages    = std::move(dataMessages);
+	m_sequencedQueued = sequencedQueued;
+
+	// The game might not notify the player.
+	MessageBoxA(GetMainWindow(), "Session has been closed.", "Steamworks Connection", MB_OK);
+}
+
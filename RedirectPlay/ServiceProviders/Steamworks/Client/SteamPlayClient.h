@@ -1,6 +1,17 @@
 #pragma once
 
+#include "../Messages/Compression.h"
+#include "../Messages/DataHeader.h"
+#include "../Messages/Delta.h"
+#include "../Messages/Fragmentation.h"
+#include "../Messages/Messages.h"
+#include "../Messages/Redundancy.h"
+#include "../Messages/Replay.h"
+#include "../Messages/Sequence.h"
+#include "../Messages/StandbyRoster.h"
 #include "../SteamTypes.h"
+#include "ClockSync.h"
+#include "SendQueue.h"
 #include "Utils/fstring.h"
 
 #include "DirectX/dplay.h"
@@ -9,9 +20,11 @@
 #include "Steam/steamclientpublic.h"
 #include "Steam/steamnetworkingtypes.h"
 
+#include <array>
 #include <deque>
 #include <functional>
 #include <memory>
+#include <vector>
 
 class CSteamPlayClient
 {
@@ -22,25 +35,50 @@ public:
 		Connecting,
 		PendingAuth,
 		Connected,
+		Resuming,  // on a new connection after the old one was lost, see CReplayBuffer
+		Migrating, // to the standby host after the host was lost, see SStandbyRoster
 	};
 
 	struct SCreatePlayerData
 	{
-		char const* szShortName;
-		char const* szLongName;
-		bool        serverPlayer;
-		bool        spectator;
-		void const* pData;
-		size_t      dataSize;
+		wchar_t const* szShortName;
+		wchar_t const* szLongName;
+		bool           serverPlayer;
+		bool           spectator;
 	};
 	using TCreatePlayerCallback = std::function<void(DPID id)>;
 
+	struct SSendData
+	{
+		DPID        from;
+		DPID        to;
+		void const* pData;
+		size_t      size;
+		DWORD       flags;        // DPSEND_*
+		DWORD       priority = 0;
+		DWORD       timeout  = 0; // ms
+		LPVOID      pContext = nullptr;
+	};
+
 protected:
+	// Names are converted to UTF-16 once when the player is added and reused for every sysmsg and name query.
+	struct SPlayerNames
+	{
+		SPlayerNames() = default;
+		SPlayerNames(char const* szShortName, char const* szLongName);
+		SPlayerNames(wchar_t const* szShortName, wchar_t const* szLongName);
+
+		fstring<DPSHORTNAMELEN>  shortName;
+		fstring<DPLONGNAMELEN>   longName;
+		fwstring<DPSHORTNAMELEN> shortNameW;
+		fwstring<DPLONGNAMELEN>  longNameW;
+	};
+
 	struct SPlayerData
 	{
-		fstring<DPSHORTNAMELEN> shortName;
-		fstring<DPLONGNAMELEN>  longName;
+		SPlayerNames            names;
 		bool                    local;
+		TPlayerSlot             slot = s_invalidPlayerSlot;
 
 		// @fixme: DirectPlay seems to keep a player array PER player.
 		// Thus the sysmsgs also need to be send for local player creations
@@ -55,40 +93,136 @@ protected:
 		DPID                   from;
 		DPID                   to;
 		TSteamMessageSharedPtr pMsg;
+		uint32                 offset;  // of the payload, 0 for sysmsgs
+		uint32                 size;    // of the payload, bundles hold several messages in one buffer
+		uint32                 rawSize; // handed to the game, compressed payloads are decompressed on receive
+		bool                   compressed;
+		bool                   sequenced = false;        // replaced by newer data of its stream until it is received
+		DPID                   streamTo  = DPID_UNKNOWN; // 'to' of the stream, DPID_ALLPLAYERS for broadcasts
+		ELane                  lane      = ELane::Default;
 	};
 	using TDataMessages = std::deque<SDataMessageCache>;
 
+	// Reliable sends waiting for steam to acknowledge them before the sender gets its DPMSG_SENDCOMPLETE.
+	// Lanes are acknowledged independently, so each steam lane has its own queue and byte count.
+	struct SPendingCompletion
+	{
+		CSendQueue::SSendInfo info;
+		uint64                reliableEnd; // m_reliableBytesSent of its lane once the message was handed to steam
+	};
+	using TPendingCompletions = std::deque<SPendingCompletion>;
+	using TLaneCompletions    = std::array<TPendingCompletions, std::tuple_size_v<TLaneCounts>>;
+	using TLaneBytes          = std::array<uint64, std::tuple_size_v<TLaneCounts>>;
+
+	// Any number of create player requests may be in flight, responses are matched by their id.
+	struct SCreatePlayerRequest
+	{
+		uint32                requestId;
+		SPlayerNames          names; // converted once, reused unless the server changed them
+		TCreatePlayerCallback callback;
+		bool                  abandoned = false; // the player the server creates for it is destroyed again
+	};
+	using TCreatePlayerRequests = std::deque<SCreatePlayerRequest>;
+
 public:
 	CSteamPlayClient();
 	~CSteamPlayClient();
 
 	EState  GetState() const              { return m_state; }
-	bool    IsConnected() const           { return m_state == Connected; }
+	// With EFeature::EarlyAuth the game goes on while the server checks the credentials, it holds what we send until then.
+	bool    IsConnected() const           { return m_state == Connected || m_state == Resuming || m_state == Migrating || IsAuthPipelined(); }
+	bool    IsAuthPipelined() const       { return m_state == PendingAuth && m_capabilities.Has(EFeature::EarlyAuth); }
 	bool    IsDisconnected() const        { return m_state == Disconnected; }
+	bool    HasDataMessages() const       { return !m_dataMessages.empty(); }
 	bool    IsConnectingOrPending() const { return m_state == Connecting || m_state == PendingAuth; }
 
 	bool    Join(CSteamID serverID, char const* szPassword = nullptr);
 	void    Disconnect(EDisconnectReason reason);
-	bool    CreatePlayer(SCreatePlayerData const& input, TCreatePlayerCallback callback = nullptr);
-	bool    SendData(DPID from, DPID to, void* pData, size_t len, bool reliable, bool sameThread = false);
+	// The callback is not called if the request could not be sent.
+	bool    CreatePlayer(SCreatePlayerData const& input, TCreatePlayerCallback callback = nullptr, uint32* pRequestId = nullptr);
+	// The callback gets DPID_UNKNOWN right away, a player the server still creates for the request is destroyed.
+	void    AbandonCreatePlayer(uint32 requestId);
+	bool    SendData(SSendData const& input, uint32* pMessageId = nullptr);
+	bool    CancelMessage(uint32 id);
+	void    CancelPriority(uint16 minPriority, uint16 maxPriority);
 	bool    DestroyPlayer(DPID dpid);
-	
+	HRESULT GetPlayerName(DPID dpid, LPVOID pData, LPDWORD pSize);
+
 	HRESULT ReceiveData(LPDPID pFrom, LPDPID pTo, DWORD flags, LPVOID pData, LPDWORD pSize);
 
 	void    ReceiveNetworkData();
 
+	// Time the oldest message of each ELane has been waiting to be sent.
+	bool    GetLaneQueueTimes(std::array<TClock::duration, static_cast<size_t>(ELane::Count)>& queueTimes) const;
+
+	// The server's session clock and one way latencies, false until the first EFeature::ClockSync sample.
+	bool    GetSessionTime(TClock::duration& time) const;
+	bool    GetLatency(SClockLatency& latency) const;
+
+	// EFeature::HostMigration, the roster is returned once per change while this client is the standby host.
+	bool    IsStandby() const   { return m_standby; }
+	bool    IsMigrating() const { return m_state == Migrating; }
+	bool    GetStandbyRoster(SStandbyRoster& roster);
+	void    ReportStandbyServer(CSteamID serverID);
+
 protected:	
 	STEAM_CALLBACK(CSteamPlayClient, OnNetConnectionStatusChanged, SteamNetConnectionStatusChangedCallback_t);
 
 	void ProcessNetworkingMessage(TSteamMessageUniquePtr pSteamMessage);
-	void OnReceiveInfo(TSteamMessageUniquePtr pSteamMessage);
-	void OnReceiveAuthPassed(TSteamMessageUniquePtr pSteamMessage);
-	void OnReceiveCreatePlayerResponse(TSteamMessageUniquePtr pSteamMessage);
-	void OnReceivePlayerCreated(TSteamMessageUniquePtr pSteamMessage);
-	void OnReceivePlayerDestroyed(TSteamMessageUniquePtr pSteamMessage);
+	void OnReceiveInfo(Messages::Server::SInfo const& message);
+	void OnReceiveAuthPassed(Messages::Server::SAuthPassed const& message);
+	void OnReceiveCreatePlayerResponse(Messages::Server::SCreatePlayerResponse const& message);
+	void OnReceivePlayerCreated(Messages::Server::SPlayerCreated const& message);
+	void OnReceivePlayerDestroyed(Messages::Server::SPlayerDestroyed const& message);
+	void OnReceiveTimeResponse(Messages::Server::STimeResponse const& message);
+	void OnReceiveResumeToken(Messages::Server::SResumeToken const& message);
+	void OnReceiveResumeResponse(Messages::Server::SResumeResponse const& message);
+	void OnReceiveStandbySession(Messages::Server::SStandbySession const& message);
+	void OnReceiveStandbyPlayer(Messages::Server::SStandbyPlayer const& message);
+	void OnReceiveStandbyHost(Messages::Server::SStandbyHost const& message);
 	void OnReceiveData(TSteamMessageUniquePtr pSteamMessage);
+	void OnReceiveDataBundle(TSteamMessageUniquePtr pSteamMessage);
+	void OnReceiveDataFragment(TSteamMessageUniquePtr pSteamMessage);
+	void QueueData(TSteamMessageSharedPtr const& pSteamMessage, size_t offset, size_t size);
+	void QueueDataForRecipients(SDataMessageCache message);
+	void QueueDataMessage(SDataMessageCache const& message);
+	void EraseDataMessage(TDataMessages::iterator it);
+
+	size_t GetSendBudget() const;
+	void   FlushSendQueue(bool all);
+	void   UpdateClockSync(TClock::time_point now);
+	bool   DispatchData(CSendQueue::SSendInfo const& info, void const* pData, size_t len);
+	size_t TransmitData(DPID from, DPID to, void const* pData, size_t len, int flags, DWORD priority, ELane& lane);
+	size_t SendDataMessage(Messages::Shared::SDataHeader const& header, void const* pPayload, size_t payloadSize, int flags, ELane& lane);
+	size_t SendDataMessage(void const* pHeader, size_t headerSize, void const* pPayload, size_t payloadSize, int flags, ELane& lane);
+
+	void   OnSendDropped(CSendQueue::SMessage const& message, CSendQueue::EDrop reason);
+	void   UpdateSendCompletions();
+	void   QueueSendComplete(CSendQueue::SSendInfo const& info, HRESULT result);
+
+	void   FailCreatePlayerRequests();
+	void   RequestAuthTicket();
+	void   CancelAuthTicket();
+	void   LogJoinStep(char const* szStep) const;
 
-	TPlayer* FindPlayer(DPID dpid);
+	bool   CanResume(int endReason) const;
+	bool   StartResume();
+	bool   CanMigrate(int endReason) const;
+	bool   StartMigration();
+	void   CompleteMigration();
+	void   LoseSession();
+
+	CLZDictionary const* GetDictionary() const;
+
+	TPlayer*    FindPlayer(DPID dpid);
+	TPlayer&    AddPlayer(DPID dpid, SPlayerNames const& names, bool local, TPlayerSlot slot);
+	void        ErasePlayer(TPlayers::iterator it);
+	DPID        GetSlotPlayer(TPlayerSlot slot) const;
+	TPlayerSlot GetPlayerSlot(DPID dpid) const;
+
+	template<typename TDPMessage>
+	TSteamMessageSharedPtr AllocatePlayerSysMessage(TDPMessage const& messageTemplate, TPlayer const& player) const;
+	void                   QueueSysMessage(TSteamMessageSharedPtr const& sysMsg);
 
 protected:
 	EState                 m_state;
@@ -96,13 +230,60 @@ protected:
 	CSteamID               m_serverID;
 	HSteamNetConnection    m_serverConnection;
 	HAuthTicket            m_authTicket;
+	std::array<uint8, Messages::Client::SBeginAuth::s_maxTokenSize> m_authToken;
+	uint32                 m_authTokenSize;
+	bool                   m_earlyAuthSent; // see EFeature::EarlyAuth
+	TClock::time_point     m_joinStart;     // until the first player was created, see LogJoinStep
 	fstring<DPPASSWORDLEN> m_password;
+	SCapabilities          m_capabilities; // negotiated with the server
+	TClock::time_point     m_nextStatsReport;
 
 	TPlayers               m_players;
+	std::array<DPID, s_maxPlayerSlots> m_playerSlots;
+	DPID                   m_primaryPlayer; // sender of data with an implicit 'from', see Messages::Shared::SDataHeader
+	bool                   m_primaryPlayerRetired;
 
-	TCreatePlayerCallback  m_createPlayerCallback;
+	TCreatePlayerRequests  m_createPlayerRequests; // oldest first
+	uint32                 m_nextCreatePlayerRequest;
 
 	TDataMessages          m_dataMessages;
+	size_t                 m_sequencedQueued; // sequenced entries in m_dataMessages
+
+	std::vector<uint8>     m_compressBuffer;
+	SCompressionStats      m_compressionStats;
+
+	CSendQueue             m_sendQueue;
+	TLaneCompletions       m_pendingCompletions;
+	TLaneBytes             m_reliableBytesSent; // data handed to steam on this connection, per steam lane
+
+	CDeltaStreams          m_deltaSendStreams;
+	CDeltaStreams          m_deltaReceiveStreams;
+	std::vector<uint8>     m_deltaBuffer;
+
+	CFragmentAssembler     m_fragments;
+	uint32                 m_nextTransferId;
+
+	CSequenceCounters      m_sequenceCounters;
+	CSequenceFilter        m_sequenceFilter;
+
+	CRedundantSender               m_redundantSender;
+	CRedundantReceiver             m_redundantReceiver;
+	std::vector<uint8>             m_redundancyBuffer;
+	CRedundantReceiver::TPayloads  m_redundantPayloads;
+
+	CClockSync             m_clockSync;
+
+	CReplayBuffer          m_replay;
+	uint64                 m_resumeToken; // 0 if the session can not be resumed
+	TClock::duration       m_resumeGraceTime;
+	TClock::time_point     m_resumeDeadline;
+
+	bool                   m_standby; // keeps a server ready to take over the session
+	SStandbyRoster         m_standbyRoster;
+	bool                   m_standbyRosterChanged;
+	CSteamID               m_standbyHost; // server to migrate to once the host is lost
+	TClock::time_point     m_migrationStart;
+	TClock::time_point     m_migrationDeadline;
 };
 
 inline CSteamPlayClient::TPlayer* CSteamPlayClient::FindPlayer(DPID dpid)
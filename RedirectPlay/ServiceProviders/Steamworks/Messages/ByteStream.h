@@ -0,0 +1,266 @@
+#pragma once
+
+#include "Utils/fstring.h"
+
+#include "Steam/steamtypes.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+// Streams for the serialized control messages.
+// A message describes its layout once in a static Serialize(stream, self) function,
+// which is then used for measuring, writing and reading the message.
+// Integers are LEB128 varints, strings and byte blobs are prefixed with a varint length.
+// All reads are bounds-checked, a failed read leaves the reader in a failed state.
+
+template<typename T, bool = std::is_enum_v<T>>
+struct SStreamInteger { using Type = std::make_unsigned_t<T>; };
+template<typename T>
+struct SStreamInteger<T, true> { using Type = std::make_unsigned_t<std::underlying_type_t<T>>; };
+
+struct SByteView
+{
+	uint8 const* pData = nullptr;
+	size_t       size  = 0;
+};
+
+class CByteMeasure
+{
+public:
+	static constexpr bool IsReading = false;
+
+	template<typename T, std::enable_if_t<std::is_integral_v<T> || std::is_enum_v<T>, bool> = true>
+	bool Varint(T value)
+	{
+		uint64 rest = static_cast<uint64>(value);
+		do
+		{
+			++m_size;
+			rest >>= 7;
+		} while (rest != 0);
+		return true;
+	}
+
+	bool Fixed(uint32)  { m_size += sizeof(uint32); return true; }
+	bool Bool(bool)     { m_size += 1; return true; }
+
+	template<size_t TSize>
+	bool String(fstring<TSize> const& value) { return Blob(value.size()); }
+	bool Bytes(SByteView const& value, size_t = SIZE_MAX) { return Blob(value.size); }
+
+	size_t GetSize() const { return m_size; }
+
+private:
+	bool Blob(size_t size)
+	{
+		Varint(size);
+		m_size += size;
+		return true;
+	}
+
+	size_t m_size = 0;
+};
+
+class CByteWriter
+{
+public:
+	static constexpr bool IsReading = false;
+
+	CByteWriter(void* pBuffer, size_t size)
+		: m_pCursor(static_cast<uint8*>(pBuffer))
+		, m_pEnd(static_cast<uint8*>(pBuffer) + size)
+	{
+	}
+
+	template<typename T, std::enable_if_t<std::is_integral_v<T> || std::is_enum_v<T>, bool> = true>
+	bool Varint(T value)
+	{
+		uint64 rest = static_cast<uint64>(value);
+		do
+		{
+			uint8 byte = static_cast<uint8>(rest & 0x7F);
+			rest >>= 7;
+			if (rest != 0)
+			{
+				byte |= 0x80;
+			}
+			if (!Write(&byte, 1))
+			{
+				return false;
+			}
+		} while (rest != 0);
+		return true;
+	}
+
+	bool Fixed(uint32 value)
+	{
+		uint8 const bytes[] = { uint8(value), uint8(value >> 8), uint8(value >> 16), uint8(value >> 24) };
+		return Write(bytes, sizeof(bytes));
+	}
+
+	bool Bool(bool value)
+	{
+		uint8 const byte = value ? 1 : 0;
+		return Write(&byte, 1);
+	}
+
+	template<size_t TSize>
+	bool String(fstring<TSize> const& value)
+	{
+		size_t const size = value.size();
+		return Varint(size) && Write(value.data(), size);
+	}
+
+	bool Bytes(SByteView const& value, size_t maxSize = SIZE_MAX)
+	{
+		return value.size <= maxSize && Varint(value.size) && Write(value.pData, value.size);
+	}
+
+	bool   Failed() const   { return m_pCursor == nullptr; }
+	uint8* GetCursor() const { return m_pCursor; }
+
+private:
+	bool Write(void const* pData, size_t size)
+	{
+		if (!m_pCursor || static_cast<size_t>(m_pEnd - m_pCursor) < size)
+		{
+			m_pCursor = nullptr;
+			return false;
+		}
+		if (size > 0)
+		{
+			memcpy(m_pCursor, pData, size);
+			m_pCursor += size;
+		}
+		return true;
+	}
+
+	uint8*       m_pCursor;
+	uint8* const m_pEnd;
+};
+
+class CByteReader
+{
+public:
+	static constexpr bool IsReading = true;
+
+	CByteReader(void const* pBuffer, size_t size)
+		: m_pCursor(static_cast<uint8 const*>(pBuffer))
+		, m_pEnd(static_cast<uint8 const*>(pBuffer) + size)
+	{
+	}
+
+	template<typename T, std::enable_if_t<std::is_integral_v<T> || std::is_enum_v<T>, bool> = true>
+	bool Varint(T& value)
+	{
+		using TUnsigned = typename SStreamInteger<T>::Type;
+
+		uint64 result = 0;
+		for (size_t shift = 0; shift < 64; shift += 7)
+		{
+			uint8 byte;
+			if (!Read(&byte, 1))
+			{
+				return false;
+			}
+			if (shift == 63 && (byte & 0x7E))
+			{
+				return Fail(); // more than 64 bits
+			}
+
+			result |= static_cast<uint64>(byte & 0x7F) << shift;
+			if (!(byte & 0x80))
+			{
+				if (result > static_cast<uint64>((std::numeric_limits<TUnsigned>::max)()))
+				{
+					return Fail();
+				}
+				value = static_cast<T>(result);
+				return true;
+			}
+		}
+		return Fail(); // overlong encoding
+	}
+
+	template<typename T, std::enable_if_t<std::is_integral_v<T>, bool> = true>
+	bool Fixed(T& value)
+	{
+		uint8 bytes[4];
+		if (!Read(bytes, sizeof(bytes)))
+		{
+			return false;
+		}
+		value = static_cast<T>(uint32(bytes[0]) | (uint32(bytes[1]) << 8) | (uint32(bytes[2]) << 16) | (uint32(bytes[3]) << 24));
+		return true;
+	}
+
+	bool Bool(bool& value)
+	{
+		uint8 byte;
+		if (!Read(&byte, 1) || byte > 1)
+		{
+			return Fail();
+		}
+		value = byte != 0;
+		return true;
+	}
+
+	template<size_t TSize>
+	bool String(fstring<TSize>& value)
+	{
+		SByteView view;
+		if (!Bytes(view, value.max_size()))
+		{
+			return false;
+		}
+		value.assign(reinterpret_cast<char const*>(view.pData), view.size);
+		return true;
+	}
+
+	// The view points into the read buffer and is only valid as long as the buffer is.
+	bool Bytes(SByteView& value, size_t maxSize = SIZE_MAX)
+	{
+		size_t size;
+		if (!Varint(size))
+		{
+			return false;
+		}
+		if (size > maxSize || size > GetRemaining())
+		{
+			return Fail();
+		}
+		value.pData = m_pCursor;
+		value.size  = size;
+		m_pCursor += size;
+		return true;
+	}
+
+	bool         AtEnd() const        { return m_pCursor == m_pEnd; }
+	bool         Failed() const       { return m_pCursor == nullptr; }
+	size_t       GetRemaining() const { return m_pCursor ? static_cast<size_t>(m_pEnd - m_pCursor) : 0; }
+	uint8 const* GetCursor() const    { return m_pCursor; }
+
+private:
+	bool Read(void* pData, size_t size)
+	{
+		if (GetRemaining() < size)
+		{
+			return Fail();
+		}
+		memcpy(pData, m_pCursor, size);
+		m_pCursor += size;
+		return true;
+	}
+
+	bool Fail()
+	{
+		m_pCursor = nullptr;
+		return false;
+	}
+
+	uint8 const*       m_pCursor;
+	uint8 const* const m_pEnd;
+};
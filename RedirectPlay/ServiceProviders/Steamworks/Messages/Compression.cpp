@@ -0,0 +1,505 @@
+#include "Compression.h"
+#include "ByteStream.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+static constexpr uint32 s_invalidPosition = 0xFFFFFFFF;
+static constexpr size_t s_maxOffset       = 0xFFFF;
+
+static uint32 Read32(uint8 const* p)
+{
+	uint32 value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static uint32 Hash(uint8 const* p)
+{
+	return (Read32(p) * 2654435761u) >> (32 - CLZDictionary::s_hashLog);
+}
+
+static uint32 HashContent(uint8 const* pData, size_t size)
+{
+	uint32 hash = 2166136261u; // FNV-1a
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash = (hash ^ pData[i]) * 16777619u;
+	}
+	return hash != 0 ? hash : 1; // 0 means no dictionary in the handshake
+}
+
+// Lengths that do not fit into a token nibble continue as bytes, 255 meaning another byte follows.
+static bool WriteLength(uint8*& pOut, uint8 const* pEnd, size_t length)
+{
+	for (;;)
+	{
+		if (pOut == pEnd)
+		{
+			return false;
+		}
+
+		uint8 const byte = static_cast<uint8>((std::min)(length, size_t(255)));
+		*pOut++ = byte;
+		length -= byte;
+		if (byte != 255)
+		{
+			return true;
+		}
+	}
+}
+
+static bool ReadLength(uint8 const*& pIn, uint8 const* pEnd, size_t& length)
+{
+	uint8 byte;
+	do
+	{
+		if (pIn == pEnd)
+		{
+			return false;
+		}
+		byte = *pIn++;
+		length += byte;
+	} while (byte == 255);
+	return true;
+}
+
+// A match length of 0 writes the closing literals-only sequence.
+static bool WriteSequence(uint8*& pOut, uint8 const* pEnd, uint8 const* pLiterals, size_t literalLength, size_t offset, size_t matchLength)
+{
+	if (pOut == pEnd)
+	{
+		return false;
+	}
+
+	size_t const matchCode = matchLength > 0 ? matchLength - CLZCodec::s_minMatch : 0;
+	*pOut++ = static_cast<uint8>(((std::min)(literalLength, size_t(15)) << 4) | (std::min)(matchCode, size_t(15)));
+
+	if (literalLength >= 15 && !WriteLength(pOut, pEnd, literalLength - 15))
+	{
+		return false;
+	}
+	if (static_cast<size_t>(pEnd - pOut) < literalLength)
+	{
+		return false;
+	}
+	memcpy(pOut, pLiterals, literalLength);
+	pOut += literalLength;
+
+	if (matchLength == 0)
+	{
+		return true;
+	}
+
+	if (pEnd - pOut < 2)
+	{
+		return false;
+	}
+	*pOut++ = static_cast<uint8>(offset);
+	*pOut++ = static_cast<uint8>(offset >> 8);
+	return matchCode < 15 || WriteLength(pOut, pEnd, matchCode - 15);
+}
+
+CLZDictionary::CLZDictionary(void const* pData, size_t size)
+	: m_data()
+	, m_hashTable(s_hashSize, s_invalidPosition)
+	, m_id(0)
+{
+	size_t const used = (std::min)(size, s_maxSize);
+	uint8 const* pStart = static_cast<uint8 const*>(pData) + (size - used);
+	m_data.assign(pStart, pStart + used);
+	m_id = HashContent(m_data.data(), m_data.size());
+
+	for (size_t i = 0; i + CLZCodec::s_minMatch <= m_data.size(); ++i)
+	{
+		m_hashTable[Hash(m_data.data() + i)] = static_cast<uint32>(i);
+	}
+}
+
+std::vector<uint8> CLZDictionary::Train(std::vector<std::vector<uint8>> const& samples, size_t maxSize)
+{
+	static constexpr size_t s_gramSize        = 8;
+	static constexpr size_t s_segmentSize     = 32;
+	static constexpr size_t s_maxTrainingSize = 4 * 1024 * 1024; // bounds the gram table
+
+	// only the most recent samples are used
+	size_t first = samples.size();
+	size_t total = 0;
+	while (first > 0 && total + samples[first - 1].size() <= s_maxTrainingSize)
+	{
+		total += samples[--first].size();
+	}
+
+	auto readGram = [](uint8 const* p)
+	{
+		uint64 gram;
+		memcpy(&gram, p, sizeof(gram));
+		return gram;
+	};
+
+	// in how many samples each gram occurs
+	std::unordered_map<uint64, uint32> frequencies;
+	std::unordered_set<uint64>         seen;
+	for (size_t s = first; s < samples.size(); ++s)
+	{
+		std::vector<uint8> const& sample = samples[s];
+		seen.clear();
+		for (size_t i = 0; i + s_gramSize <= sample.size(); ++i)
+		{
+			uint64 const gram = readGram(sample.data() + i);
+			if (seen.insert(gram).second)
+			{
+				++frequencies[gram];
+			}
+		}
+	}
+
+	// segments score with the grams they share with other samples
+	struct SSegment
+	{
+		uint64 score;
+		size_t sample;
+		size_t offset;
+	};
+	std::vector<SSegment> segments;
+	for (size_t s = first; s < samples.size(); ++s)
+	{
+		std::vector<uint8> const& sample = samples[s];
+		for (size_t offset = 0; offset + s_segmentSize <= sample.size(); offset += s_segmentSize)
+		{
+			uint64 score = 0;
+			for (size_t i = offset; i < offset + s_segmentSize && i + s_gramSize <= sample.size(); ++i)
+			{
+				score += frequencies[readGram(sample.data() + i)] - 1;
+			}
+			if (score > 0)
+			{
+				segments.push_back({ score, s, offset });
+			}
+		}
+	}
+
+	std::sort(segments.begin(), segments.end(), [](SSegment const& a, SSegment const& b)
+	{
+		return a.score != b.score ? a.score > b.score : a.sample != b.sample ? a.sample < b.sample : a.offset < b.offset;
+	});
+
+	std::vector<SSegment const*> selected;
+	std::unordered_set<uint32>   contents;
+	for (SSegment const& segment : segments)
+	{
+		if ((selected.size() + 1) * s_segmentSize > maxSize)
+		{
+			break;
+		}
+
+		if (contents.insert(HashContent(samples[segment.sample].data() + segment.offset, s_segmentSize)).second)
+		{
+			selected.push_back(&segment);
+		}
+	}
+
+	// best segments last, they are closest to the data
+	std::vector<uint8> dictionary;
+	dictionary.reserve(selected.size() * s_segmentSize);
+	for (auto it = selected.rbegin(); it != selected.rend(); ++it)
+	{
+		uint8 const* pSegment = samples[(*it)->sample].data() + (*it)->offset;
+		dictionary.insert(dictionary.end(), pSegment, pSegment + s_segmentSize);
+	}
+	return dictionary;
+}
+
+std::shared_ptr<CLZDictionary const> CLZDictionary::Load(char const* szPath)
+{
+	std::ifstream file(szPath, std::ios::binary);
+	if (!file)
+	{
+		Log::Warn("Could not open compression dictionary '%s'.", szPath);
+		return nullptr;
+	}
+
+	std::vector<uint8> content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+	size_t const magicSize = sizeof(CLZCapture::s_magic) - 1;
+	if (content.size() >= magicSize && memcmp(content.data(), CLZCapture::s_magic, magicSize) == 0)
+	{
+		std::vector<std::vector<uint8>> samples;
+		size_t offset = magicSize;
+		while (content.size() - offset >= sizeof(uint32))
+		{
+			uint32 const size = Read32(content.data() + offset);
+			offset += sizeof(uint32);
+			if (content.size() - offset < size)
+			{
+				break;
+			}
+			samples.emplace_back(content.begin() + offset, content.begin() + offset + size);
+			offset += size;
+		}
+
+		Log::Info("Training compression dictionary from %u captured samples.", samples.size());
+		content = Train(samples);
+	}
+
+	if (content.empty())
+	{
+		Log::Warn("Compression dictionary '%s' is empty.", szPath);
+		return nullptr;
+	}
+
+	std::shared_ptr<CLZDictionary const> pDictionary = std::make_shared<CLZDictionary const>(content.data(), content.size());
+	Log::Info("Loaded compression dictionary %x with %u bytes.", pDictionary->GetId(), pDictionary->GetSize());
+	return pDictionary;
+}
+
+size_t CLZCodec::Compress(void const* pSource, size_t size, void* pDest, size_t destCapacity, CLZDictionary const* pDictionary)
+{
+	// the dictionary is copied in front of the data, so matches can cross into it like into earlier data
+	thread_local std::vector<uint8>  s_window;
+	thread_local std::vector<uint32> s_hashTable;
+
+	size_t const dictionarySize = pDictionary ? pDictionary->GetSize() : 0;
+	s_window.resize(dictionarySize + size);
+	if (dictionarySize > 0)
+	{
+		memcpy(s_window.data(), pDictionary->GetData(), dictionarySize);
+	}
+	memcpy(s_window.data() + dictionarySize, pSource, size);
+
+	if (pDictionary)
+	{
+		s_hashTable.assign(pDictionary->GetHashTable(), pDictionary->GetHashTable() + CLZDictionary::s_hashSize);
+	}
+	else
+	{
+		s_hashTable.assign(CLZDictionary::s_hashSize, s_invalidPosition);
+	}
+
+	uint8 const* const pWindow = s_window.data();
+	uint8 const* const pEnd    = pWindow + s_window.size();
+	uint8*             pOut    = static_cast<uint8*>(pDest);
+	uint8 const* const pOutEnd = pOut + destCapacity;
+
+	uint8 const* pAnchor = pWindow + dictionarySize;
+	uint8 const* pCursor = pAnchor;
+	while (pCursor + s_minMatch <= pEnd)
+	{
+		uint32&      entry     = s_hashTable[Hash(pCursor)];
+		uint32 const candidate = entry;
+		uint32 const position  = static_cast<uint32>(pCursor - pWindow);
+		entry = position;
+
+		if (candidate != s_invalidPosition && position - candidate <= s_maxOffset && Read32(pWindow + candidate) == Read32(pCursor))
+		{
+			uint8 const* const pMatch = pWindow + candidate;
+			size_t length = s_minMatch;
+			while (pCursor + length < pEnd && pMatch[length] == pCursor[length])
+			{
+				++length;
+			}
+
+			if (!WriteSequence(pOut, pOutEnd, pAnchor, pCursor - pAnchor, position - candidate, length))
+			{
+				return 0;
+			}
+			pCursor += length;
+			pAnchor = pCursor;
+		}
+		else
+		{
+			// step faster through data that does not compress
+			pCursor += 1 + ((pCursor - pAnchor) >> 6);
+		}
+	}
+
+	if (!WriteSequence(pOut, pOutEnd, pAnchor, pEnd - pAnchor, 0, 0))
+	{
+		return 0;
+	}
+	return pOut - static_cast<uint8*>(pDest);
+}
+
+bool CLZCodec::Decompress(void const* pSource, size_t size, void* pDest, size_t rawSize, CLZDictionary const* pDictionary)
+{
+	uint8 const*       pIn       = static_cast<uint8 const*>(pSource);
+	uint8 const* const pInEnd    = pIn + size;
+	uint8* const       pOutStart = static_cast<uint8*>(pDest);
+	uint8*             pOut      = pOutStart;
+	uint8 const* const pOutEnd   = pOutStart + rawSize;
+
+	uint8 const* const pDictionaryData = pDictionary ? pDictionary->GetData() : nullptr;
+	size_t const       dictionarySize  = pDictionary ? pDictionary->GetSize() : 0;
+
+	for (;;)
+	{
+		if (pIn == pInEnd)
+		{
+			return false;
+		}
+
+		uint8 const token = *pIn++;
+		size_t literalLength = token >> 4;
+		if (literalLength == 15 && !ReadLength(pIn, pInEnd, literalLength))
+		{
+			return false;
+		}
+		if (static_cast<size_t>(pInEnd - pIn) < literalLength || static_cast<size_t>(pOutEnd - pOut) < literalLength)
+		{
+			return false;
+		}
+		memcpy(pOut, pIn, literalLength);
+		pIn += literalLength;
+		pOut += literalLength;
+
+		if (pIn == pInEnd)
+		{
+			return pOut == pOutEnd;
+		}
+
+		if (pInEnd - pIn < 2)
+		{
+			return false;
+		}
+		size_t const offset = pIn[0] | (size_t(pIn[1]) << 8);
+		pIn += 2;
+
+		size_t matchLength = token & 0xF;
+		if (matchLength == 15 && !ReadLength(pIn, pInEnd, matchLength))
+		{
+			return false;
+		}
+		matchLength += s_minMatch;
+
+		size_t const produced = pOut - pOutStart;
+		if (offset == 0 || offset > produced + dictionarySize || static_cast<size_t>(pOutEnd - pOut) < matchLength)
+		{
+			return false;
+		}
+
+		if (offset > produced)
+		{
+			// the match starts in the dictionary and may continue at the start of the output
+			size_t const back           = offset - produced;
+			size_t const dictionaryPart = (std::min)(back, matchLength);
+			memcpy(pOut, pDictionaryData + dictionarySize - back, dictionaryPart);
+			pOut += dictionaryPart;
+			matchLength -= dictionaryPart;
+		}
+
+		uint8 const* pMatch = pOut - offset;
+		if (offset >= matchLength)
+		{
+			memcpy(pOut, pMatch, matchLength);
+			pOut += matchLength;
+		}
+		else
+		{
+			// overlapping matches repeat the last bytes
+			while (matchLength-- > 0)
+			{
+				*pOut++ = *pMatch++;
+			}
+		}
+	}
+}
+
+size_t CLZCodec::CompressPayload(void const* pSource, size_t size, std::vector<uint8>& dest, CLZDictionary const* pDictionary, SCompressionStats& stats)
+{
+	TClock::time_point const start = TClock::now();
+
+	CByteMeasure measure;
+	measure.Varint(size);
+	size_t const prefixSize = measure.GetSize();
+
+	// anything that does not end up smaller is not worth the receiver's time
+	dest.resize(size);
+	if (size <= prefixSize)
+	{
+		return 0;
+	}
+
+	CByteWriter writer(dest.data(), prefixSize);
+	writer.Varint(size);
+	size_t const blockSize = Compress(pSource, size, dest.data() + prefixSize, size - prefixSize, pDictionary);
+
+	stats.compressTime += TClock::now() - start;
+	if (blockSize == 0)
+	{
+		return 0;
+	}
+
+	++stats.compressed;
+	stats.rawBytes    += size;
+	stats.packedBytes += prefixSize + blockSize;
+	return prefixSize + blockSize;
+}
+
+size_t CLZCodec::ReadPayloadSize(void const* pPayload, size_t size, size_t& rawSize)
+{
+	CByteReader reader(pPayload, size);
+	if (!reader.Varint(rawSize) || rawSize > s_maxPayloadSize)
+	{
+		return 0;
+	}
+	return reader.GetCursor() - static_cast<uint8 const*>(pPayload);
+}
+
+bool CLZCodec::DecompressPayload(void const* pPayload, size_t size, void* pDest, size_t rawSize, CLZDictionary const* pDictionary, SCompressionStats& stats)
+{
+	size_t payloadRawSize;
+	size_t const offset = ReadPayloadSize(pPayload, size, payloadRawSize);
+	if (offset == 0 || payloadRawSize != rawSize)
+	{
+		return false;
+	}
+
+	TClock::time_point const start = TClock::now();
+	bool const success = Decompress(static_cast<uint8 const*>(pPayload) + offset, size - offset, pDest, rawSize, pDictionary);
+	stats.decompressTime += TClock::now() - start;
+	stats.decompressed += success ? 1 : 0;
+	return success;
+}
+
+void CLZCapture::Write(char const* szPath, void const* pData, size_t size)
+{
+	static std::mutex s_mutex;
+	std::lock_guard<std::mutex> const lock(s_mutex);
+
+	std::ofstream file(szPath, std::ios::binary | std::ios::app);
+	if (!file)
+	{
+		return;
+	}
+
+	file.seekp(0, std::ios::end);
+	if (file.tellp() == 0)
+	{
+		file.write(s_magic, sizeof(s_magic) - 1);
+	}
+
+	uint8 const sizeBytes[] = { uint8(size), uint8(size >> 8), uint8(size >> 16), uint8(size >> 24) };
+	file.write(reinterpret_cast<char const*>(sizeBytes), sizeof(sizeBytes));
+	file.write(static_cast<char const*>(pData), size);
+}
+
+void SCompressionStats::Write(Log::ESource source) const
+{
+	if (compressed == 0 && decompressed == 0)
+	{
+		return;
+	}
+
+	using std::chrono::duration_cast;
+	using std::chrono::microseconds;
+
+	double const ratio = rawBytes > 0 ? static_cast<double>(packedBytes) / static_cast<double>(rawBytes) : 1.0;
+	Log::Write(Log::ELevel::Info, source, "Compressed %llu messages from %llu to %llu bytes (ratio %.2f) in %lldus, decompressed %llu messages in %lldus.",
+		compressed, rawBytes, packedBytes, ratio, static_cast<long long>(duration_cast<microseconds>(compressTime).count()),
+		decompressed, static_cast<long long>(duration_cast<microseconds>(decompressTime).count()));
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "../SteamTypes.h"
+#include "Log.h"
+
+#include "Steam/steamtypes.h"
+
+#include <memory>
+#include <vector>
+
+// LZ77 block codec for large data payloads, in the spirit of LZ4:
+// sequences of a token byte (literal length << 4 | match length - 4), extended lengths as runs of 255,
+// the literals and a 2 byte little endian match offset. The last sequence only carries literals.
+//
+// A dictionary is logically placed in front of every block, so small messages can reference common content.
+// Both sides of a connection need the same dictionary, they compare its id during the handshake.
+
+class CLZDictionary
+{
+public:
+	static constexpr size_t s_maxSize  = 0xFFFF; // reachable by a match offset
+	static constexpr size_t s_hashLog  = 12;
+	static constexpr size_t s_hashSize = size_t(1) << s_hashLog;
+
+	// Uses the last s_maxSize bytes of the content.
+	CLZDictionary(void const* pData, size_t size);
+
+	// Builds a dictionary from sample payloads. Segments whose byte sequences occur in many samples are kept,
+	// the most common ones last so they are reached with the smallest offsets.
+	static std::vector<uint8> Train(std::vector<std::vector<uint8>> const& samples, size_t maxSize = s_maxSize);
+
+	// Loads a raw dictionary or trains one from a capture file written by CLZCapture.
+	static std::shared_ptr<CLZDictionary const> Load(char const* szPath);
+
+	uint8 const*  GetData() const      { return m_data.data(); }
+	size_t        GetSize() const      { return m_data.size(); }
+	uint32        GetId() const        { return m_id; }
+	uint32 const* GetHashTable() const { return m_hashTable.data(); }
+
+private:
+	std::vector<uint8>  m_data;
+	std::vector<uint32> m_hashTable; // last dictionary position per hash
+	uint32              m_id;
+};
+
+struct SCompressionStats;
+
+class CLZCodec
+{
+public:
+	static constexpr size_t s_minMatch       = 4;
+	static constexpr size_t s_maxPayloadSize = 512 * 1024; // largest steam message
+
+	static size_t GetMaxCompressedSize(size_t size) { return size + size / 255 + 16; }
+
+	// Returns the compressed size or 0 if the block did not fit into destCapacity.
+	static size_t Compress(void const* pSource, size_t size, void* pDest, size_t destCapacity, CLZDictionary const* pDictionary);
+
+	// Fails unless the block decodes to exactly rawSize bytes.
+	static bool   Decompress(void const* pSource, size_t size, void* pDest, size_t rawSize, CLZDictionary const* pDictionary);
+
+	// Compressed data payloads are the varint raw size followed by the block.
+	// Returns the payload size in dest or 0 if compressing did not make the payload smaller.
+	static size_t CompressPayload(void const* pSource, size_t size, std::vector<uint8>& dest, CLZDictionary const* pDictionary, SCompressionStats& stats);
+	// Returns the offset of the block or 0 if the payload is malformed.
+	static size_t ReadPayloadSize(void const* pPayload, size_t size, size_t& rawSize);
+	static bool   DecompressPayload(void const* pPayload, size_t size, void* pDest, size_t rawSize, CLZDictionary const* pDictionary, SCompressionStats& stats);
+};
+
+// Appends payloads to a capture file for CLZDictionary::Train.
+class CLZCapture
+{
+public:
+	static constexpr char s_magic[] = "RPCAPTURE1";
+
+	static void Write(char const* szPath, void const* pData, size_t size);
+};
+
+struct SCompressionStats
+{
+	uint64             compressed     = 0; // messages
+	uint64             decompressed   = 0; // messages
+	uint64             rawBytes       = 0;
+	uint64             packedBytes    = 0;
+	TClock::duration   compressTime   = TClock::duration::zero();
+	TClock::duration   decompressTime = TClock::duration::zero();
+
+	void Write(Log::ESource source) const;
+};
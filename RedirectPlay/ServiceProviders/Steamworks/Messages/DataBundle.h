@@ -0,0 +1,85 @@
+#pragma once
+
+#include "ByteStream.h"
+#include "Messages.h"
+
+#include <vector>
+
+// EMessage::ServerDataBundle packs several data messages for the same connection into one steam message.
+//
+// byte 0    EMessage::ServerDataBundle
+// entries   varint size followed by a complete SData or DataCompact message, repeated until the end
+//
+// The server fills one bundle per recipient during a tick and flushes it before the send flags change,
+// the negotiated SCapabilities::maxBatchSize is reached or the tick ends.
+
+namespace Messages
+{
+
+	namespace Server
+	{
+
+		struct SDataBundle
+		{
+			static constexpr EMessage ID        = EMessage::ServerDataBundle;
+			static constexpr size_t   s_minSize = sizeof(EMessage);
+
+			// Returns the bytes a data message of the given size takes inside a bundle.
+			static size_t GetEntrySize(size_t messageSize)
+			{
+				CByteMeasure measure;
+				measure.Varint(messageSize);
+				return measure.GetSize() + messageSize;
+			}
+
+			// Appends a data message given as header and payload, starting a new bundle if the buffer is empty.
+			static void Append(std::vector<uint8>& bundle, void const* pHeader, size_t headerSize, void const* pPayload, size_t payloadSize)
+			{
+				if (bundle.empty())
+				{
+					bundle.push_back(static_cast<uint8>(ID));
+				}
+
+				size_t const messageSize = headerSize + payloadSize;
+				size_t const start       = bundle.size();
+				bundle.resize(start + GetEntrySize(messageSize));
+
+				CByteWriter writer(bundle.data() + start, bundle.size() - start);
+				writer.Varint(messageSize);
+
+				uint8* pCursor = writer.GetCursor();
+				memcpy(pCursor, pHeader, headerSize);
+				if (payloadSize > 0)
+				{
+					memcpy(pCursor + headerSize, pPayload, payloadSize);
+				}
+			}
+
+			// Calls visit(offset, size) for every contained message, offsets are relative to pBuffer.
+			// Returns false if the bundle is malformed, messages before the error were visited already.
+			template<typename TVisit>
+			static bool ForEach(void const* pBuffer, size_t size, TVisit&& visit)
+			{
+				if (size < s_minSize || *static_cast<EMessage const*>(pBuffer) != ID)
+				{
+					return false;
+				}
+
+				uint8 const* const pStart = static_cast<uint8 const*>(pBuffer);
+				CByteReader reader(pStart + sizeof(EMessage), size - sizeof(EMessage));
+				while (!reader.AtEnd())
+				{
+					SByteView entry;
+					if (!reader.Bytes(entry) || entry.size < sizeof(EMessage))
+					{
+						return false;
+					}
+					visit(static_cast<size_t>(entry.pData - pStart), entry.size);
+				}
+				return true;
+			}
+		};
+
+	}
+
+}
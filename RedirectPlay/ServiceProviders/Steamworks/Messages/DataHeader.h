@@ -0,0 +1,214 @@
+#pragma once
+
+#include "Messages.h"
+
+#include <cstring>
+
+// Compact header of EMessage::DataCompact, replacing the fixed from/to DPIDs of SData.
+//
+// byte 0    EMessage::DataCompact
+// byte 1    addressing: bits 0-1 'to' mode, bits 2-3 'from' mode, bits 4-7 payload flags
+// [to]      nothing (broadcast), 1 byte slot or 4 byte DPID
+// [from]    nothing (implicit),  1 byte slot or 4 byte DPID
+// [seq]     2 byte sequence number with s_flagSequenced or s_flagRedundant
+// payload
+//
+// Slots are small per-session player numbers handed out by the server with the player creation messages.
+// An implicit 'from' is the sending connection's primary player, see CSteamPlayServer::SClientData.
+// Full DPIDs are used whenever one side does not know the slot of a player.
+//
+// Payload flags:
+// s_flagCompressed  payload is the varint raw size followed by a CLZCodec block
+// s_flagDelta       payload is a CDeltaCodec delta against the previous payload of the stream, never compressed
+// s_flagSequenced   unreliable data that is dropped if a newer message of its stream arrived first, see CSequenceFilter
+// s_flagRedundant   unreliable data that repeats the previous payloads of its stream, see CRedundantReceiver
+
+namespace Messages
+{
+
+	namespace Shared
+	{
+
+		struct SDataHeader
+		{
+			enum class EAddress : uint8
+			{
+				None, // 'to' is a broadcast, 'from' is implicit
+				Slot,
+				Id,
+			};
+
+			static constexpr uint8 s_flagCompressed = 1 << 0;
+			static constexpr uint8 s_flagDelta      = 1 << 1;
+			static constexpr uint8 s_flagSequenced  = 1 << 2;
+			static constexpr uint8 s_flagRedundant  = 1 << 3;
+			static constexpr uint8 s_sequenceFlags  = s_flagSequenced | s_flagRedundant;
+
+			static constexpr EMessage ID        = EMessage::DataCompact;
+			static constexpr size_t   s_minSize = sizeof(EMessage) + 1;
+			static constexpr size_t   s_maxSize = s_minSize + 2 * sizeof(uint32) + sizeof(uint16);
+
+			EAddress toMode   = EAddress::None;
+			EAddress fromMode = EAddress::None;
+			uint8    flags    = 0;
+			DPID     to       = DPID_ALLPLAYERS; // slot or DPID depending on the mode
+			DPID     from     = DPID_UNKNOWN;    // slot or DPID depending on the mode
+			uint16   sequence = 0;               // with s_sequenceFlags
+
+			void SetTo(DPID dpid, TPlayerSlot slot)
+			{
+				if (dpid == DPID_ALLPLAYERS)
+				{
+					toMode = EAddress::None;
+					to     = DPID_ALLPLAYERS;
+				}
+				else
+				{
+					SetAddress(toMode, to, dpid, slot);
+				}
+			}
+
+			void SetFrom(DPID dpid, TPlayerSlot slot, bool implicit)
+			{
+				if (implicit)
+				{
+					fromMode = EAddress::None;
+					from     = DPID_UNKNOWN;
+				}
+				else
+				{
+					SetAddress(fromMode, from, dpid, slot);
+				}
+			}
+
+			size_t GetSize() const
+			{
+				return s_minSize + GetAddressSize(toMode) + GetAddressSize(fromMode) + GetSequenceSize(flags);
+			}
+
+			// Returns the number of bytes written, the buffer needs at least GetSize() bytes.
+			size_t Write(void* pBuffer) const
+			{
+				uint8* pCursor = static_cast<uint8*>(pBuffer);
+				*pCursor++ = static_cast<uint8>(ID);
+				*pCursor++ = static_cast<uint8>(static_cast<uint8>(toMode) | (static_cast<uint8>(fromMode) << 2) | (flags << 4));
+				pCursor = WriteAddress(pCursor, toMode, to);
+				pCursor = WriteAddress(pCursor, fromMode, from);
+				if (flags & s_sequenceFlags)
+				{
+					memcpy(pCursor, &sequence, sizeof(sequence));
+					pCursor += sizeof(sequence);
+				}
+				return pCursor - static_cast<uint8*>(pBuffer);
+			}
+
+			// Returns the header size or 0 if the header is malformed.
+			size_t Read(void const* pBuffer, size_t size)
+			{
+				uint8 const* pCursor = static_cast<uint8 const*>(pBuffer);
+				uint8 const* pEnd    = pCursor + size;
+				if (size < s_minSize || static_cast<EMessage>(pCursor[0]) != ID)
+				{
+					return 0;
+				}
+
+				uint8 const addressing = pCursor[1];
+				toMode   = static_cast<EAddress>(addressing & 0x3);
+				fromMode = static_cast<EAddress>((addressing >> 2) & 0x3);
+				flags    = addressing >> 4;
+				pCursor += s_minSize;
+
+				if (!ReadAddress(pCursor, pEnd, toMode, to) || !ReadAddress(pCursor, pEnd, fromMode, from))
+				{
+					return 0;
+				}
+				if (flags & s_sequenceFlags)
+				{
+					if (pCursor + sizeof(sequence) > pEnd)
+					{
+						return 0;
+					}
+					memcpy(&sequence, pCursor, sizeof(sequence));
+					pCursor += sizeof(sequence);
+				}
+				if (toMode == EAddress::None)
+				{
+					to = DPID_ALLPLAYERS;
+				}
+				return pCursor - static_cast<uint8 const*>(pBuffer);
+			}
+
+		private:
+			static void SetAddress(EAddress& mode, DPID& address, DPID dpid, TPlayerSlot slot)
+			{
+				if (slot != s_invalidPlayerSlot)
+				{
+					mode    = EAddress::Slot;
+					address = slot;
+				}
+				else
+				{
+					mode    = EAddress::Id;
+					address = dpid;
+				}
+			}
+
+			static constexpr size_t GetAddressSize(EAddress mode)
+			{
+				return mode == EAddress::Slot ? sizeof(TPlayerSlot) : mode == EAddress::Id ? sizeof(uint32) : 0;
+			}
+
+			static constexpr size_t GetSequenceSize(uint8 flags)
+			{
+				return (flags & s_sequenceFlags) ? sizeof(uint16) : 0;
+			}
+
+			static uint8* WriteAddress(uint8* pCursor, EAddress mode, DPID address)
+			{
+				if (mode == EAddress::Slot)
+				{
+					*pCursor++ = static_cast<TPlayerSlot>(address);
+				}
+				else if (mode == EAddress::Id)
+				{
+					uint32 const id = static_cast<uint32>(address);
+					memcpy(pCursor, &id, sizeof(id));
+					pCursor += sizeof(id);
+				}
+				return pCursor;
+			}
+
+			static bool ReadAddress(uint8 const*& pCursor, uint8 const* pEnd, EAddress mode, DPID& address)
+			{
+				switch (mode)
+				{
+				case EAddress::None:
+					return true;
+				case EAddress::Slot:
+					if (pCursor + sizeof(TPlayerSlot) > pEnd || *pCursor == s_invalidPlayerSlot)
+					{
+						return false;
+					}
+					address = *pCursor++;
+					return true;
+				case EAddress::Id:
+				{
+					uint32 id;
+					if (pCursor + sizeof(id) > pEnd)
+					{
+						return false;
+					}
+					memcpy(&id, pCursor, sizeof(id));
+					address = id;
+					pCursor += sizeof(id);
+					return true;
+				}
+				default:
+					return false;
+				}
+			}
+		};
+
+	}
+
+}
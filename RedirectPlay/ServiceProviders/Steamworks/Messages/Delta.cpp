@@ -0,0 +1,244 @@
+#include "Delta.h"
+#include "ByteStream.h"
+
+#include "Steam/steamnetworkingtypes.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#define DELTA_SSE2 1
+#include <emmintrin.h>
+#else
+#define DELTA_SSE2 0
+#endif
+
+// Unchanged bytes between two changes, below this they are sent as part of the change.
+static constexpr size_t s_minUnchangedRun = 4;
+static constexpr size_t s_blockSize       = 16;
+
+// Bit i is set if a[i] == b[i], for up to s_blockSize bytes.
+static uint32 GetEqualMask(uint8 const* a, uint8 const* b, size_t count)
+{
+#if DELTA_SSE2
+	if (count == s_blockSize)
+	{
+		__m128i const va = _mm_loadu_si128(reinterpret_cast<__m128i const*>(a));
+		__m128i const vb = _mm_loadu_si128(reinterpret_cast<__m128i const*>(b));
+		return static_cast<uint32>(_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)));
+	}
+#endif
+
+	uint32 mask = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		mask |= static_cast<uint32>(a[i] == b[i]) << i;
+	}
+	return mask;
+}
+
+static void XorBytes(uint8* pDest, uint8 const* a, uint8 const* b, size_t count)
+{
+	size_t i = 0;
+#if DELTA_SSE2
+	for (; i + s_blockSize <= count; i += s_blockSize)
+	{
+		__m128i const va = _mm_loadu_si128(reinterpret_cast<__m128i const*>(a + i));
+		__m128i const vb = _mm_loadu_si128(reinterpret_cast<__m128i const*>(b + i));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(pDest + i), _mm_xor_si128(va, vb));
+	}
+#endif
+	for (; i < count; ++i)
+	{
+		pDest[i] = a[i] ^ b[i];
+	}
+}
+
+// Returns the first position from pos on where the payloads differ, or size.
+static size_t FindChange(uint8 const* pBase, uint8 const* pPayload, size_t pos, size_t size)
+{
+	while (pos < size)
+	{
+		size_t const count = (std::min)(s_blockSize, size - pos);
+		uint32 const full  = (1u << count) - 1;
+		uint32 const mask  = GetEqualMask(pBase + pos, pPayload + pos, count);
+		if (mask != full)
+		{
+			return pos + std::countr_zero(~mask);
+		}
+		pos += count;
+	}
+	return size;
+}
+
+// Returns the first position from pos on where s_minUnchangedRun unchanged bytes start, or size.
+static size_t FindUnchangedRun(uint8 const* pBase, uint8 const* pPayload, size_t pos, size_t size)
+{
+	size_t runStart  = pos;
+	size_t runLength = 0;
+	while (pos < size)
+	{
+		size_t const count = (std::min)(s_blockSize, size - pos);
+		uint32 const mask  = GetEqualMask(pBase + pos, pPayload + pos, count);
+		if (mask == 0)
+		{
+			runLength = 0;
+		}
+		else
+		{
+			for (size_t i = 0; i < count; ++i)
+			{
+				if (mask & (1u << i))
+				{
+					if (runLength++ == 0)
+					{
+						runStart = pos + i;
+					}
+					if (runLength == s_minUnchangedRun)
+					{
+						return runStart;
+					}
+				}
+				else
+				{
+					runLength = 0;
+				}
+			}
+		}
+		pos += count;
+	}
+	// unchanged bytes at the end are implicit
+	return runLength > 0 ? runStart : size;
+}
+
+size_t CDeltaCodec::Encode(void const* pBase, void const* pPayload, size_t size, uint8* pDest, size_t maxSize)
+{
+	uint8 const* const pOld = static_cast<uint8 const*>(pBase);
+	uint8 const* const pNew = static_cast<uint8 const*>(pPayload);
+	uint8* const       pEnd = pDest + maxSize;
+
+	uint8* pCursor = pDest;
+	size_t pos     = 0;
+	for (;;)
+	{
+		size_t const changeStart = FindChange(pOld, pNew, pos, size);
+		if (changeStart == size)
+		{
+			break;
+		}
+		size_t const changeEnd = FindUnchangedRun(pOld, pNew, changeStart, size);
+		size_t const count     = changeEnd - changeStart;
+
+		CByteWriter writer(pCursor, pEnd - pCursor);
+		if (!writer.Varint(changeStart - pos) || !writer.Varint(count) || static_cast<size_t>(pEnd - writer.GetCursor()) < count)
+		{
+			return SIZE_MAX;
+		}
+		pCursor = writer.GetCursor();
+		XorBytes(pCursor, pOld + changeStart, pNew + changeStart, count);
+		pCursor += count;
+		pos = changeEnd;
+	}
+	return pCursor - pDest;
+}
+
+bool CDeltaCodec::Decode(void const* pDelta, size_t deltaSize, void* pPayload, size_t size)
+{
+	uint8* const pOut = static_cast<uint8*>(pPayload);
+
+	CByteReader reader(pDelta, deltaSize);
+	size_t pos = 0;
+	while (!reader.AtEnd())
+	{
+		size_t unchanged;
+		SByteView change;
+		if (!reader.Varint(unchanged) || unchanged > size - pos || !reader.Bytes(change, size - pos - unchanged))
+		{
+			return false;
+		}
+		pos += unchanged;
+		XorBytes(pOut + pos, pOut + pos, change.pData, change.size);
+		pos += change.size;
+	}
+	return true;
+}
+
+bool CDeltaStreams::IsEligible(size_t size, int flags)
+{
+	return (flags & k_nSteamNetworkingSend_Reliable) != 0 && size >= s_minPayloadSize && size <= s_maxPayloadSize;
+}
+
+bool CDeltaStreams::Encode(DPID from, DPID to, ELane lane, void const* pPayload, size_t size, std::vector<uint8>& dest)
+{
+	SStream& stream = m_streams[SStreamKey{ from, to, lane }];
+
+	size_t deltaSize = SIZE_MAX;
+	if (stream.payload.size() == size && stream.deltasSinceKeyframe < s_keyframeInterval)
+	{
+		// a delta has to be smaller than the payload
+		dest.resize(size);
+		deltaSize = CDeltaCodec::Encode(stream.payload.data(), pPayload, size, dest.data(), size - 1);
+	}
+
+	uint8 const* const pBytes = static_cast<uint8 const*>(pPayload);
+	stream.payload.assign(pBytes, pBytes + size);
+
+	if (deltaSize == SIZE_MAX)
+	{
+		stream.deltasSinceKeyframe = 0;
+		++m_stats.keyframes;
+		return false;
+	}
+
+	dest.resize(deltaSize);
+	++stream.deltasSinceKeyframe;
+	++m_stats.deltas;
+	m_stats.rawBytes   += size;
+	m_stats.deltaBytes += deltaSize;
+	return true;
+}
+
+uint8 const* CDeltaStreams::Decode(DPID from, DPID to, ELane lane, void const* pDelta, size_t deltaSize, size_t& size)
+{
+	TStreams::iterator const it = m_streams.find(SStreamKey{ from, to, lane });
+	if (it == m_streams.end())
+	{
+		++m_stats.failed;
+		return nullptr;
+	}
+
+	if (!CDeltaCodec::Decode(pDelta, deltaSize, it->second.payload.data(), it->second.payload.size()))
+	{
+		// the previous payload may be half updated, later deltas fail until the sender's next keyframe
+		m_streams.erase(it);
+		++m_stats.failed;
+		return nullptr;
+	}
+
+	++m_stats.deltas;
+	m_stats.rawBytes   += it->second.payload.size();
+	m_stats.deltaBytes += deltaSize;
+
+	size = it->second.payload.size();
+	return it->second.payload.data();
+}
+
+void CDeltaStreams::Store(DPID from, DPID to, ELane lane, void const* pPayload, size_t size)
+{
+	uint8 const* const pBytes = static_cast<uint8 const*>(pPayload);
+	m_streams[SStreamKey{ from, to, lane }].payload.assign(pBytes, pBytes + size);
+	++m_stats.keyframes;
+}
+
+void SDeltaStats::Write(Log::ESource source) const
+{
+	if (deltas == 0 && failed == 0)
+	{
+		return;
+	}
+
+	double const ratio = rawBytes > 0 ? static_cast<double>(deltaBytes) / static_cast<double>(rawBytes) : 1.0;
+	Log::Write(Log::ELevel::Info, source, "Delta encoded %llu messages from %llu to %llu bytes (ratio %.2f), %llu keyframes, %llu failed.",
+		deltas, rawBytes, deltaBytes, ratio, keyframes, failed);
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "../SteamTypes.h"
+#include "StreamKey.h"
+#include "Log.h"
+
+#include "DirectX/dplay.h"
+#include "Steam/steamtypes.h"
+
+#include <vector>
+
+// Delta encoding of reliable data payloads against the previous payload of the same (from, to, lane) stream.
+//
+// A delta is a sequence of: varint count of unchanged bytes, varint count n, n bytes XORed with the previous payload.
+// Bytes after the last sequence are unchanged, so an empty delta repeats the previous payload.
+//
+// Resync rules, shared by both ends of a connection:
+// - only reliable payloads of an eligible size take part, reliable messages of a lane arrive in the order they were sent,
+//   so the last payload sent on a stream is the one the other end decodes the next delta against
+// - a payload is sent in full if the stream has no previous payload of the same size, after s_keyframeInterval deltas
+//   or if the delta would not be smaller, every full payload replaces the previous one
+// - streams are dropped when one of their players is destroyed, the sender drops all of them if a send failed
+// - a delta that cannot be applied drops the receiver's stream, it picks up again with the next full payload
+
+struct SDeltaStats
+{
+	uint64 deltas      = 0; // messages
+	uint64 keyframes   = 0; // messages
+	uint64 rawBytes    = 0; // of the deltas
+	uint64 deltaBytes  = 0;
+	uint64 failed      = 0; // deltas that could not be applied
+
+	void Write(Log::ESource source) const;
+};
+
+class CDeltaCodec
+{
+public:
+	// Returns the delta size or SIZE_MAX if it would not fit into maxSize.
+	static size_t Encode(void const* pBase, void const* pPayload, size_t size, uint8* pDest, size_t maxSize);
+
+	// Applies a delta to pPayload, which holds the previous payload. A failed delta may leave it partly applied.
+	static bool   Decode(void const* pDelta, size_t deltaSize, void* pPayload, size_t size);
+};
+
+class CDeltaStreams
+{
+public:
+	static constexpr size_t s_minPayloadSize   = 16;
+	static constexpr size_t s_maxPayloadSize   = 8 * 1024;
+	static constexpr uint32 s_keyframeInterval = 64;
+
+	static bool IsEligible(size_t size, int flags);
+
+	// Returns true if dest holds a delta to send instead of the payload, the payload becomes the stream's previous one.
+	bool         Encode(DPID from, DPID to, ELane lane, void const* pPayload, size_t size, std::vector<uint8>& dest);
+
+	// Reconstructs a received delta, the result stays valid until the stream changes again.
+	uint8 const* Decode(DPID from, DPID to, ELane lane, void const* pDelta, size_t deltaSize, size_t& size);
+
+	// Records a received full payload.
+	void         Store(DPID from, DPID to, ELane lane, void const* pPayload, size_t size);
+
+	void         ErasePlayer(DPID dpid) { EraseStreamsOfPlayer(m_streams, dpid); }
+	void         Clear() { m_streams.clear(); }
+
+	SDeltaStats const& GetStats() const { return m_stats; }
+
+private:
+	struct SStream
+	{
+		std::vector<uint8> payload;
+		uint32             deltasSinceKeyframe = 0;
+	};
+	using TStreams = TStreamMap<SStream>;
+
+	TStreams    m_streams;
+	SDeltaStats m_stats;
+};
@@ -0,0 +1,90 @@
+#include "Fragmentation.h"
+#include "DataHeader.h"
+
+#include "Steam/isteamnetworkingutils.h"
+
+#include <cstring>
+
+bool CFragmentAssembler::Add(SteamNetworkingMessage_t const& fragment, size_t maxMessageSize, TSteamMessageUniquePtr& pComplete)
+{
+	Messages::Shared::SDataFragment header;
+	size_t const headerSize = header.Read(fragment.GetData(), fragment.GetSize());
+	size_t const sliceSize  = fragment.GetSize() - headerSize;
+	if (fragment.m_idxLane >= m_transfers.size())
+	{
+		return false;
+	}
+
+	STransfer& transfer = m_transfers[fragment.m_idxLane];
+	if (headerSize == 0 || header.totalSize == 0 || header.totalSize > maxMessageSize || !(fragment.m_nFlags & k_nSteamNetworkingSend_Reliable))
+	{
+		transfer.Clear();
+		return false;
+	}
+
+	// a new transfer replaces one that never finished because the sender failed to hand all of its fragments to steam
+	if (header.offset == 0)
+	{
+		transfer.pMessage   = SteamNetworkingUtils()->AllocateMessage(header.totalSize);
+		transfer.transferId = header.transferId;
+		transfer.received   = 0;
+		if (!transfer.pMessage)
+		{
+			return false;
+		}
+	}
+
+	if (!transfer.pMessage || header.transferId != transfer.transferId || header.totalSize != transfer.pMessage->GetSize()
+		|| header.offset != transfer.received || sliceSize > header.totalSize - transfer.received)
+	{
+		transfer.Clear();
+		return false;
+	}
+
+	memcpy(static_cast<uint8*>(transfer.pMessage->m_pData) + transfer.received, static_cast<uint8 const*>(fragment.GetData()) + headerSize, sliceSize);
+	transfer.received += static_cast<uint32>(sliceSize);
+	if (transfer.received < header.totalSize)
+	{
+		return true;
+	}
+
+	// only data messages are transferred, bundles and fragments are never nested
+	EMessage const id = *static_cast<EMessage const*>(transfer.pMessage->GetData());
+	bool const valid = id == Messages::Shared::SDataHeader::ID || (id == Messages::Shared::SData::ID && transfer.pMessage->GetSize() >= sizeof(Messages::Shared::SData));
+	if (!valid)
+	{
+		transfer.Clear();
+		return false;
+	}
+
+	transfer.pMessage->m_conn    = fragment.m_conn;
+	transfer.pMessage->m_nFlags  = fragment.m_nFlags;
+	transfer.pMessage->m_idxLane = fragment.m_idxLane;
+	pComplete = std::move(transfer.pMessage);
+	transfer.received = 0;
+	return true;
+}
+
+void CFragmentAssembler::Clear()
+{
+	for (STransfer& transfer : m_transfers)
+	{
+		transfer.Clear();
+	}
+}
+
+size_t CFragmentAssembler::GetBufferedSize() const
+{
+	size_t size = 0;
+	for (STransfer const& transfer : m_transfers)
+	{
+		size += transfer.pMessage ? transfer.pMessage->GetSize() : 0;
+	}
+	return size;
+}
+
+void CFragmentAssembler::STransfer::Clear()
+{
+	pMessage.reset(nullptr);
+	received = 0;
+}
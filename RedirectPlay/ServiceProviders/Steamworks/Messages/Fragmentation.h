@@ -0,0 +1,95 @@
+#pragma once
+
+#include "../SteamTypes.h"
+#include "ByteStream.h"
+#include "Messages.h"
+
+// EMessage::DataFragment carries a slice of a data message that is too large for one steam message,
+// or large enough that it should not hold up the other traffic of its connection.
+//
+// byte 0    EMessage::DataFragment
+// varint    transfer id, counted per connection
+// varint    size of the complete data message
+// varint    offset of the slice
+// slice
+//
+// The transferred message is a complete SData or DataCompact message. All fragments of a transfer are handed to steam
+// at once, reliable and on the same lane, so they arrive in order and without fragments of other transfers in between.
+// Transfers on different lanes may arrive interleaved, the receiver assembles one per lane.
+// The receiver allocates the complete message with the first fragment and copies every slice into place,
+// once it is full it is handled like any other data message.
+
+namespace Messages
+{
+
+	namespace Shared
+	{
+
+		struct SDataFragment
+		{
+			static constexpr EMessage ID              = EMessage::DataFragment;
+			static constexpr size_t   s_minSize       = sizeof(EMessage) + 3;
+			static constexpr size_t   s_maxHeaderSize = sizeof(EMessage) + 3 * 5; // varint uint32
+
+			uint32 transferId = 0;
+			uint32 totalSize  = 0;
+			uint32 offset     = 0;
+
+			// Returns the number of bytes written, the buffer needs at least s_maxHeaderSize bytes.
+			size_t Write(void* pBuffer) const
+			{
+				uint8* const pStart = static_cast<uint8*>(pBuffer);
+				*pStart = static_cast<uint8>(ID);
+
+				CByteWriter writer(pStart + sizeof(EMessage), s_maxHeaderSize - sizeof(EMessage));
+				writer.Varint(transferId);
+				writer.Varint(totalSize);
+				writer.Varint(offset);
+				return writer.GetCursor() - pStart;
+			}
+
+			// Returns the header size or 0 if the header is malformed.
+			size_t Read(void const* pBuffer, size_t size)
+			{
+				if (size < s_minSize || *static_cast<EMessage const*>(pBuffer) != ID)
+				{
+					return 0;
+				}
+
+				CByteReader reader(static_cast<uint8 const*>(pBuffer) + sizeof(EMessage), size - sizeof(EMessage));
+				if (!reader.Varint(transferId) || !reader.Varint(totalSize) || !reader.Varint(offset))
+				{
+					return 0;
+				}
+				return reader.GetCursor() - static_cast<uint8 const*>(pBuffer);
+			}
+		};
+
+	}
+
+}
+
+// Reassembles the transfers arriving on one connection. Only one transfer per lane is in progress at a time,
+// so the memory held is bounded by the largest message the receiver accepts for each lane.
+class CFragmentAssembler
+{
+public:
+	// Returns false if the fragment is malformed or does not continue the current transfer of its lane, which is dropped then.
+	// pComplete receives the data message once its last fragment arrived.
+	bool   Add(SteamNetworkingMessage_t const& fragment, size_t maxMessageSize, TSteamMessageUniquePtr& pComplete);
+
+	void   Clear();
+	size_t GetBufferedSize() const;
+
+private:
+	struct STransfer
+	{
+		TSteamMessageUniquePtr pMessage;
+		uint32                 transferId = 0;
+		uint32                 received   = 0;
+
+		void Clear();
+	};
+
+	std::array<STransfer, std::tuple_size_v<TLaneCounts>> m_transfers;
+};
@@ -0,0 +1,252 @@
+#pragma once
+
+#include "../SteamTypes.h"
+#include "DataBundle.h"
+#include "DataHeader.h"
+#include "Fragmentation.h"
+#include "Messages.h"
+#include "Log.h"
+
+#include <array>
+#include <cassert>
+#include <type_traits>
+
+// Every message type is registered here once with the direction it may travel in.
+// Client and server generate their dispatch tables from this list and bind a member function per incoming message,
+// missing, duplicated or misdirected handlers fail to compile.
+
+enum class EMessageDirection : uint8
+{
+	ToServer = 1 << 0,
+	ToClient = 1 << 1,
+	Shared   = ToServer | ToClient,
+};
+
+constexpr bool HasDirection(EMessageDirection direction, EMessageDirection test)
+{
+	return (static_cast<uint8>(direction) & static_cast<uint8>(test)) != 0;
+}
+
+template<typename TMessage>
+constexpr size_t GetMinMessageSize()
+{
+	if constexpr (IsSerializedMessage<TMessage>)
+	{
+		return sizeof(SMessage);
+	}
+	else if constexpr (requires { TMessage::s_minSize; })
+	{
+		return TMessage::s_minSize;
+	}
+	else
+	{
+		return sizeof(TMessage);
+	}
+}
+
+template<typename TMessage, EMessageDirection TDirection>
+struct SMessageRegistration
+{
+	using Message = TMessage;
+
+	static constexpr EMessage          ID        = TMessage::ID;
+	static constexpr EMessageDirection Direction = TDirection;
+	static constexpr size_t            MinSize   = GetMinMessageSize<TMessage>();
+};
+
+template<typename ... TRegistrations>
+struct SMessageList
+{
+	static constexpr size_t Count = sizeof...(TRegistrations);
+
+	static constexpr std::array<EMessage, Count>          s_ids        = { TRegistrations::ID... };
+	static constexpr std::array<EMessageDirection, Count> s_directions = { TRegistrations::Direction... };
+	static constexpr std::array<size_t, Count>            s_minSizes   = { TRegistrations::MinSize... };
+
+	static constexpr size_t Find(EMessage id)
+	{
+		for (size_t i = 0; i < Count; ++i)
+		{
+			if (s_ids[i] == id)
+			{
+				return i;
+			}
+		}
+		return Count;
+	}
+
+	static constexpr size_t CountDirection(EMessageDirection direction)
+	{
+		size_t count = 0;
+		for (EMessageDirection registered : s_directions)
+		{
+			count += HasDirection(registered, direction) ? 1 : 0;
+		}
+		return count;
+	}
+
+	static constexpr bool HasUniqueIds()
+	{
+		for (size_t i = 0; i < Count; ++i)
+		{
+			if (Find(s_ids[i]) != i)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+using TMessageRegistry = SMessageList<
+	SMessageRegistration<Messages::Shared::SData,                 EMessageDirection::Shared>,
+	SMessageRegistration<Messages::Shared::SDataHeader,           EMessageDirection::Shared>,
+	SMessageRegistration<Messages::Shared::SDataFragment,         EMessageDirection::Shared>,
+	SMessageRegistration<Messages::Client::SBeginAuth,            EMessageDirection::ToServer>,
+	SMessageRegistration<Messages::Client::SCreatePlayer,         EMessageDirection::ToServer>,
+	SMessageRegistration<Messages::Client::SDestroyPlayer,        EMessageDirection::ToServer>,
+	SMessageRegistration<Messages::Client::STimeRequest,          EMessageDirection::ToServer>,
+	SMessageRegistration<Messages::Client::SResume,               EMessageDirection::ToServer>,
+	SMessageRegistration<Messages::Client::SStandbyReady,         EMessageDirection::ToServer>,
+	SMessageRegistration<Messages::Client::SEarlyAuth,            EMessageDirection::ToServer>,
+	SMessageRegistration<Messages::Server::SInfo,                 EMessageDirection::ToClient>,
+	SMessageRegistration<Messages::Server::SAuthPassed,           EMessageDirection::ToClient>,
+	SMessageRegistration<Messages::Server::SCreatePlayerResponse, EMessageDirection::ToClient>,
+	SMessageRegistration<Messages::Server::SPlayerCreated,        EMessageDirection::ToClient>,
+	SMessageRegistration<Messages::Server::SPlayerDestroyed,      EMessageDirection::ToClient>,
+	SMessageRegistration<Messages::Server::SDataBundle,           EMessageDirection::ToClient>,
+	SMessageRegistration<Messages::Server::STimeResponse,         EMessageDirection::ToClient>,
+	SMessageRegistration<Messages::Server::SResumeToken,          EMessageDirection::ToClient>,
+	SMessageRegistration<Messages::Server::SResumeResponse,       EMessageDirection::ToClient>,
+	SMessageRegistration<Messages::Server::SStandbySession,       EMessageDirection::ToClient>,
+	SMessageRegistration<Messages::Server::SStandbyPlayer,        EMessageDirection::ToClient>,
+	SMessageRegistration<Messages::Server::SStandbyHost,          EMessageDirection::ToClient>
+>;
+
+static_assert(TMessageRegistry::HasUniqueIds(), "Message ids have to be registered only once.");
+
+// Dispatches messages arriving in 'incoming' direction to members of TReceiver, which get TArgs as leading arguments.
+// A lookup is one size check against the table entry followed by an indirect call.
+// Invalid messages are reported to TReceiver::LogRejected(TArgs..., level, fmt, ...) if it has one, so it can throttle them.
+template<typename TReceiver, EMessageDirection incoming, Log::ESource logSource, typename ... TArgs>
+class CMessageDispatcher
+{
+public:
+	using THandler = void(*)(TReceiver& receiver, TArgs... args, TSteamMessageUniquePtr pSteamMessage);
+
+	struct SEntry
+	{
+		THandler pHandler = nullptr;
+		size_t   minSize  = 0;
+		bool     outgoing = false; // registered, but must not be received here
+	};
+	using TTable = std::array<SEntry, 1 << (8 * sizeof(EMessage))>;
+
+private:
+	template<typename TReceive>
+	struct SReceiveTraits;
+
+	template<typename TMessage>
+	struct SReceiveTraits<void(TReceiver::*)(TArgs..., TMessage const&)>
+	{
+		using Message = TMessage;
+	};
+
+public:
+	// Binds a serialized message, which is parsed before the member is called.
+	template<auto pReceive>
+	struct SBind
+	{
+		using Message = typename SReceiveTraits<decltype(pReceive)>::Message;
+
+		static void Invoke(TReceiver& receiver, TArgs... args, TSteamMessageUniquePtr pSteamMessage)
+		{
+			Message message;
+			if (!ReadMessage(pSteamMessage->GetData(), pSteamMessage->GetSize(), message))
+			{
+				Reject(receiver, args..., "Message %u is malformed.", Message::ID);
+				return;
+			}
+
+			(receiver.*pReceive)(args..., message);
+		}
+	};
+
+	// Binds a raw message, the member gets the steam message and does its own parsing.
+	template<typename TMessage, void(TReceiver::*pReceive)(TArgs..., TSteamMessageUniquePtr)>
+	struct SBindRaw
+	{
+		using Message = TMessage;
+
+		static void Invoke(TReceiver& receiver, TArgs... args, TSteamMessageUniquePtr pSteamMessage)
+		{
+			(receiver.*pReceive)(args..., std::move(pSteamMessage));
+		}
+	};
+
+	template<typename ... TBindings>
+	static constexpr TTable MakeTable()
+	{
+		static_assert((IsIncoming(TBindings::Message::ID) && ...), "A bound message is not registered for this direction.");
+		static_assert(SMessageList<SMessageRegistration<typename TBindings::Message, incoming>...>::HasUniqueIds(), "A message is bound more than once.");
+		static_assert(sizeof...(TBindings) == TMessageRegistry::CountDirection(incoming), "Every message registered for this direction needs a binding.");
+
+		TTable table{};
+		for (size_t i = 0; i < TMessageRegistry::Count; ++i)
+		{
+			SEntry& entry = table[static_cast<size_t>(TMessageRegistry::s_ids[i])];
+			entry.minSize  = TMessageRegistry::s_minSizes[i];
+			entry.outgoing = !HasDirection(TMessageRegistry::s_directions[i], incoming);
+		}
+		((table[static_cast<size_t>(TBindings::Message::ID)].pHandler = &TBindings::Invoke), ...);
+		return table;
+	}
+
+	static void Dispatch(TTable const& table, TReceiver& receiver, TArgs... args, TSteamMessageUniquePtr pSteamMessage)
+	{
+		assert(pSteamMessage != nullptr);
+
+		size_t const size = pSteamMessage->GetSize();
+		if (size < sizeof(SMessage))
+		{
+			Reject(receiver, args..., "Message was too short.");
+			return;
+		}
+
+		EMessage const id    = static_cast<SMessage const*>(pSteamMessage->GetData())->GetId();
+		SEntry const&  entry = table[static_cast<size_t>(id)];
+		if (!entry.pHandler)
+		{
+			Reject(receiver, args..., entry.outgoing ? "Got message %u from the wrong direction." : "Got unregistered message %u.", id);
+			return;
+		}
+
+		if (size < entry.minSize)
+		{
+			Reject(receiver, args..., "Message %u was too short. Got %u but expected at least %u.", id, size, entry.minSize);
+			return;
+		}
+
+		entry.pHandler(receiver, args..., std::move(pSteamMessage));
+	}
+
+private:
+	template<typename ... TLogArgs>
+	static void Reject(TReceiver& receiver, TArgs... args, char const* fmt, TLogArgs... logArgs)
+	{
+		if constexpr (requires { receiver.LogRejected(args..., Log::ELevel::Warning, fmt, logArgs...); })
+		{
+			receiver.LogRejected(args..., Log::ELevel::Warning, fmt, logArgs...);
+		}
+		else
+		{
+			Log::Write(Log::ELevel::Warning, logSource, fmt, logArgs...);
+		}
+	}
+
+	static constexpr bool IsIncoming(EMessage id)
+	{
+		size_t const index = TMessageRegistry::Find(id);
+		return index < TMessageRegistry::Count && HasDirection(TMessageRegistry::s_directions[index], incoming);
+	}
+};
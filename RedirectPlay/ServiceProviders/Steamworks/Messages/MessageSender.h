@@ -1,19 +1,36 @@
 #pragma once
 
 #include "../SteamTypes.h"
+#include "DataHeader.h"
+#include "Fragmentation.h"
 #include "Messages.h"
+#include "Replay.h"
 #include "Log.h"
 
 #include "Steam/isteamnetworkingutils.h"
 #include "Steam/isteamnetworkingsockets.h"
 
+#include <array>
 #include <cassert>
+#include <functional>
 
 template<ISteamNetworkingSockets*(*pGetSockets)(), Log::ESource logSource>
 class CMessageSender
 {
 public:
-	template<typename TMessage, std::enable_if_t<std::is_base_of_v<SMessage, TMessage>, bool> = true>
+	using TGetReplayBuffer = std::function<CReplayBuffer*(HSteamNetConnection connection)>;
+
+	// Reliable messages to connections with a replay buffer are recorded there before they are sent,
+	// to suspended connections they are only recorded.
+	static void SetReplayBuffers(TGetReplayBuffer getReplayBuffer)
+	{
+		s_getReplayBuffer = std::move(getReplayBuffer);
+	}
+
+	template<typename TMessage>
+	static constexpr bool IsRawMessage = std::is_base_of_v<SMessage, TMessage> && !IsSerializedMessage<TMessage>;
+
+	template<typename TMessage, std::enable_if_t<IsRawMessage<TMessage>, bool> = true>
 	static SteamNetworkingMessage_t* Allocate(size_t attachedDataSize = 0)
 	{
 		SteamNetworkingMessage_t* pSteamMessage = Allocate(sizeof(TMessage) + attachedDataSize);
@@ -55,27 +72,38 @@ public:
 		return pCopy;
 	}
 
-	template<typename TMessage, std::enable_if_t<std::is_base_of_v<SMessage, TMessage>, bool> = true>
-	static bool Send(TMessage const& message, HSteamNetConnection connection, int flags)
+	template<typename TMessage, std::enable_if_t<IsSerializedMessage<TMessage>, bool> = true>
+	static SteamNetworkingMessage_t* Serialize(TMessage const& message)
 	{
-		SteamNetworkingMessage_t* pSteamMessage = Allocate(sizeof(TMessage));
+		size_t const size = MeasureMessage(message);
+		TSteamMessageUniquePtr pSteamMessage = Allocate(size);
 		if (!pSteamMessage)
 		{
-			return false;
+			return nullptr;
 		}
 
-		memcpy(pSteamMessage->m_pData, &message, sizeof(TMessage));
-		return Send(pSteamMessage, connection, flags);
+		if (!WriteMessage(message, pSteamMessage->m_pData, size))
+		{
+			Log::Write(Log::ELevel::Error, logSource, "Failed to serialize message %u.", TMessage::ID);
+			return nullptr;
+		}
+		return pSteamMessage.release();
+	}
+
+	template<typename TMessage, std::enable_if_t<IsSerializedMessage<TMessage>, bool> = true>
+	static bool Send(TMessage const& message, HSteamNetConnection connection, int flags, ELane lane = ELane::Default)
+	{
+		SteamNetworkingMessage_t* pSteamMessage = Serialize(message);
+		return pSteamMessage && Send(pSteamMessage, connection, flags, lane);
 	}
 
-	template<typename TMessage, std::enable_if_t<std::is_base_of_v<SMessage, TMessage>, bool> = true>
+	template<typename TMessage, std::enable_if_t<IsSerializedMessage<TMessage>, bool> = true>
 	static bool Send(HSteamNetConnection connection, int flags)
 	{
-		SteamNetworkingMessage_t* pSteamMessage = Allocate<TMessage>(0);
-		return pSteamMessage && Send(pSteamMessage, connection, flags);
+		return Send(TMessage(), connection, flags);
 	}
 
-	static bool Send(TSteamMessageUniquePtr pSteamMessage, HSteamNetConnection connection, int flags)
+	static bool Send(TSteamMessageUniquePtr pSteamMessage, HSteamNetConnection connection, int flags, ELane lane = ELane::Default)
 	{
 		ISteamNetworkingSockets* pSockets = pGetSockets();
 		assert(pSockets != nullptr);
@@ -85,6 +113,13 @@ public:
 
 		pSteamMessage->m_conn = connection;
 		pSteamMessage->m_nFlags = flags;
+		pSteamMessage->m_idxLane = static_cast<uint16>(lane);
+
+		CReplayBuffer* const pReplay = s_getReplayBuffer ? s_getReplayBuffer(connection) : nullptr;
+		if (pReplay && !pReplay->Record(*pSteamMessage))
+		{
+			return true; // sent once the connection is resumed
+		}
 
 		int64 messageNumberOrResult;
 		SteamNetworkingMessage_t* ptr = pSteamMessage.release();
@@ -92,6 +127,11 @@ public:
 
 		if (messageNumberOrResult < 0)
 		{
+			if (pReplay)
+			{
+				pReplay->DiscardLast();
+			}
+
 			EResult  result = static_cast<EResult>(-messageNumberOrResult);
 			Log::Write(Log::ELevel::Info, logSource, "Failed to send message to %u with error code %u.", connection, result);
 			return false;
@@ -99,14 +139,101 @@ public:
 		return true;
 	}
 
-	template<typename TMessage, typename TWrite, std::enable_if_t<std::is_base_of_v<SMessage, TMessage>, bool> = true>
+	static bool SendData(Messages::Shared::SDataHeader const& header, void const* pPayload, size_t payloadSize, HSteamNetConnection connection, int flags, ELane lane)
+	{
+		uint8 headerBytes[Messages::Shared::SDataHeader::s_maxSize];
+		size_t const headerSize = header.Write(headerBytes);
+		return SendData(headerBytes, headerSize, pPayload, payloadSize, connection, flags, lane);
+	}
+
+	// Sends a data message that was prepared as separate header and payload.
+	static bool SendData(void const* pHeader, size_t headerSize, void const* pPayload, size_t payloadSize, HSteamNetConnection connection, int flags, ELane lane)
+	{
+		TSteamMessageUniquePtr pSteamMessage = Allocate(headerSize + payloadSize);
+		if (!pSteamMessage)
+		{
+			return false;
+		}
+
+		memcpy(pSteamMessage->m_pData, pHeader, headerSize);
+		if (payloadSize > 0)
+		{
+			memcpy(static_cast<char*>(pSteamMessage->m_pData) + headerSize, pPayload, payloadSize);
+		}
+		return Send(std::move(pSteamMessage), connection, flags, lane);
+	}
+
+	// Sends a data message as SDataFragment slices of at most fragmentSize bytes, always reliable.
+	static bool SendFragments(void const* pHeader, size_t headerSize, void const* pPayload, size_t payloadSize, HSteamNetConnection connection, ELane lane, uint32 transferId, size_t fragmentSize)
+	{
+		assert(fragmentSize > 0);
+
+		Messages::Shared::SDataFragment fragment;
+		fragment.transferId = transferId;
+		fragment.totalSize  = static_cast<uint32>(headerSize + payloadSize);
+
+		while (fragment.offset < fragment.totalSize)
+		{
+			size_t const sliceSize = (std::min)(fragmentSize, static_cast<size_t>(fragment.totalSize - fragment.offset));
+
+			uint8  fragmentHeader[Messages::Shared::SDataFragment::s_maxHeaderSize];
+			size_t const fragmentHeaderSize = fragment.Write(fragmentHeader);
+
+			TSteamMessageUniquePtr pSteamMessage = Allocate(fragmentHeaderSize + sliceSize);
+			if (!pSteamMessage)
+			{
+				return false;
+			}
+
+			// the slice may span the end of the data header and the start of the payload
+			uint8* pCursor = static_cast<uint8*>(pSteamMessage->m_pData);
+			memcpy(pCursor, fragmentHeader, fragmentHeaderSize);
+			pCursor += fragmentHeaderSize;
+
+			size_t const headerPart = fragment.offset < headerSize ? (std::min)(sliceSize, headerSize - fragment.offset) : 0;
+			if (headerPart > 0)
+			{
+				memcpy(pCursor, static_cast<uint8 const*>(pHeader) + fragment.offset, headerPart);
+			}
+			if (sliceSize > headerPart)
+			{
+				memcpy(pCursor + headerPart, static_cast<uint8 const*>(pPayload) + (fragment.offset + headerPart - headerSize), sliceSize - headerPart);
+			}
+
+			if (!Send(std::move(pSteamMessage), connection, k_nSteamNetworkingSend_Reliable, lane))
+			{
+				return false;
+			}
+			fragment.offset += static_cast<uint32>(sliceSize);
+		}
+		return true;
+	}
+
+	// Time the oldest message of each lane has been waiting in the send queue.
+	static bool GetLaneQueueTimes(HSteamNetConnection connection, std::array<TClock::duration, static_cast<size_t>(ELane::Count)>& queueTimes)
+	{
+		SteamNetConnectionRealTimeStatus_t     status;
+		SteamNetConnectionRealTimeLaneStatus_t laneStatus[static_cast<size_t>(ELane::Count)];
+		if (pGetSockets()->GetConnectionRealTimeStatus(connection, &status, static_cast<int>(ELane::Count), laneStatus) != k_EResultOK)
+		{
+			return false;
+		}
+
+		for (size_t i = 0; i < queueTimes.size(); ++i)
+		{
+			queueTimes[i] = std::chrono::microseconds(laneStatus[i].m_usecQueueTime);
+		}
+		return true;
+	}
+
+	template<typename TMessage, typename TWrite, std::enable_if_t<IsRawMessage<TMessage>, bool> = true>
 	static bool TrySend(HSteamNetConnection connection, int flags, TWrite&& write)
 	{
 		return TrySend<TMessage>(connection, flags, 0, std::forward<TWrite>(write));
 	}
 
-	template<typename TMessage, typename TWrite, std::enable_if_t<std::is_base_of_v<SMessage, TMessage>, bool> = true>
-	static bool TrySend(HSteamNetConnection connection, int flags, size_t attachedDataSize, TWrite&& write)
+	template<typename TMessage, typename TWrite, std::enable_if_t<IsRawMessage<TMessage>, bool> = true>
+	static bool TrySend(HSteamNetConnection connection, int flags, size_t attachedDataSize, TWrite&& write, ELane lane = ELane::Default)
 	{
 		TSteamMessageUniquePtr pSteamMessage = Allocate<TMessage>(attachedDataSize);
 		if (!pSteamMessage)
@@ -116,6 +243,9 @@ public:
 
 		TMessage& message = *static_cast<TMessage*>(pSteamMessage->m_pData);
 		write(message);
-		return Send(std::move(pSteamMessage), connection, flags);
+		return Send(std::move(pSteamMessage), connection, flags, lane);
 	}
+
+private:
+	static inline TGetReplayBuffer s_getReplayBuffer;
 };
@@ -1,9 +1,15 @@
 #pragma once
 
+#include "../SteamTypes.h"
+#include "ByteStream.h"
+#include "Utils/fstring.h"
+
 #include "DirectX/dplay.h"
 #include "Steam/steamtypes.h"
 
+#include <algorithm>
 #include <cstdint>
+#include <type_traits>
 
 enum class EMessage : uint8_t
 {
@@ -22,13 +28,163 @@ enum class EMessage : uint8_t
 	ServerCreatePlayerResponse, // to the sender
 	ServerPlayerCreated,        // to all clients
 	ServerPlayerDestroyed,
+
+	// Shared, appended so the ids above keep their values
+	DataCompact,                // see SDataHeader
+
+	// Appended, see SDataBundle and SDataFragment
+	ServerDataBundle,
+	DataFragment,
+
+	// Appended, see CClockSync
+	ClientTimeRequest,
+	ServerTimeResponse,
+
+	// Appended, see CReplayBuffer
+	ServerResumeToken,
+	ClientResume,
+	ServerResumeResponse,
+
+	// Appended, see SStandbyRoster
+	ServerStandbySession,
+	ServerStandbyPlayer,
+	ClientStandbyReady,
+	ServerStandbyHost,
+
+	// Appended, see EFeature::EarlyAuth
+	ClientEarlyAuth,
 };
 
-#pragma pack( push, 1 )
-#pragma warning( push )
-#pragma warning( disable : 4200 )
+// Per-session player number, used to address players in compact data headers.
+using TPlayerSlot = uint8;
+
+static constexpr TPlayerSlot s_invalidPlayerSlot = 0xFF;
+static constexpr size_t      s_maxPlayerSlots    = s_invalidPlayerSlot;
+
+// Leads SInfo. Control messages used to be packed structs, builds before the byte stream format cannot parse them
+// and servers of those builds send the auth flag in its place, so clients leave servers that send anything else.
+static constexpr uint32 s_protocolId = 0x32505352; // "RSP2"
+
+// Optional protocol features. A connection only uses the features both sides announced in the handshake,
+// so peers of different versions can still play together.
+enum class EFeature : uint32
+{
+	CompactHeader = 1 << 0, // SDataHeader instead of SData
+	Batching      = 1 << 1, // SDataBundle from the server
+	Compression   = 1 << 2, // SDataHeader::s_flagCompressed payloads, needs CompactHeader
+	Delta         = 1 << 3, // SDataHeader::s_flagDelta payloads, needs CompactHeader
+	Lanes         = 1 << 4, // data is sent on the ELane its priority maps to
+	Fragmentation = 1 << 5, // large data messages are sent as SDataFragment slices
+	Unordered     = 1 << 6, // reliable data is spread over independent lanes, for DPSESSION_NOPRESERVEORDER, needs Lanes
+	LowLatency    = 1 << 7, // data is sent without nagle delay, for DPSESSION_OPTIMIZELATENCY
+	Sequenced     = 1 << 8, // SDataHeader::s_flagSequenced unreliable data, needs CompactHeader
+	Redundancy    = 1 << 9, // SDataHeader::s_flagRedundant unreliable data, needs CompactHeader, Sequenced takes precedence
+	ClockSync     = 1 << 10, // STimeRequest and STimeResponse
+	Resume        = 1 << 11, // SResumeToken, SResume and SResumeResponse
+	HostMigration = 1 << 12, // SStandbySession, SStandbyPlayer, SStandbyReady and SStandbyHost, for DPSESSION_MIGRATEHOST
+	EarlyAuth     = 1 << 13, // SEarlyAuth, the server holds everything else the client sends until auth completed
+};
+
+struct SCapabilities
+{
+	static constexpr uint32 s_version       = 1;
+	static constexpr uint32 s_knownFeatures = static_cast<uint32>(EFeature::CompactHeader)
+		| static_cast<uint32>(EFeature::Batching)
+		| static_cast<uint32>(EFeature::Compression)
+		| static_cast<uint32>(EFeature::Delta)
+		| static_cast<uint32>(EFeature::Lanes)
+		| static_cast<uint32>(EFeature::Fragmentation)
+		| static_cast<uint32>(EFeature::Unordered)
+		| static_cast<uint32>(EFeature::LowLatency)
+		| static_cast<uint32>(EFeature::Sequenced)
+		| static_cast<uint32>(EFeature::Redundancy)
+		| static_cast<uint32>(EFeature::ClockSync)
+		| static_cast<uint32>(EFeature::Resume)
+		| static_cast<uint32>(EFeature::HostMigration)
+		| static_cast<uint32>(EFeature::EarlyAuth);
+
+	// These are signaled with SDataHeader flags.
+	static constexpr uint32 s_compactHeaderFeatures = static_cast<uint32>(EFeature::Compression)
+		| static_cast<uint32>(EFeature::Delta)
+		| static_cast<uint32>(EFeature::Sequenced)
+		| static_cast<uint32>(EFeature::Redundancy);
+
+	// These need the lanes to be configured.
+	static constexpr uint32 s_laneFeatures = static_cast<uint32>(EFeature::Lanes)
+		| static_cast<uint32>(EFeature::Unordered);
+
+	uint32 version      = 0; // 0 for peers that did not announce anything
+	uint32 features     = 0;
+	uint32 maxBatchSize = 0; // largest combined message the peer accepts in bytes
+	uint32 dictionaryId = 0; // compression dictionary, 0 for none
+
+	bool Has(EFeature feature) const { return (features & static_cast<uint32>(feature)) != 0; }
+
+	static SCapabilities Negotiate(SCapabilities const& local, SCapabilities const& remote)
+	{
+		SCapabilities result;
+		result.version      = (std::min)(local.version, remote.version);
+		result.features     = result.version > 0 ? local.features & remote.features : 0;
+		result.maxBatchSize = (std::min)(local.maxBatchSize, remote.maxBatchSize);
+		if (!result.Has(EFeature::CompactHeader))
+		{
+			result.features &= ~s_compactHeaderFeatures;
+		}
+		if (!result.Has(EFeature::Lanes))
+		{
+			result.features &= ~s_laneFeatures;
+		}
+		result.dictionaryId = local.dictionaryId == remote.dictionaryId ? local.dictionaryId : 0;
+		return result;
+	}
+
+	// Appended to handshake messages, older peers neither send nor read it.
+	template<typename TStream, typename TSelf>
+	static bool Serialize(TStream& stream, TSelf& self)
+	{
+		if constexpr (TStream::IsReading)
+		{
+			if (stream.AtEnd())
+			{
+				return true;
+			}
+		}
+
+		return stream.Varint(self.version)
+			&& stream.Varint(self.features)
+			&& stream.Varint(self.maxBatchSize)
+			&& stream.Fixed(self.dictionaryId);
+	}
+};
 
-// maybe an actual byte stream would be nicer than fixed messages?
+// Appended to a message, older peers neither send nor read it and get 0.
+template<typename TStream, typename TValue>
+bool SerializeAppended(TStream& stream, TValue& value)
+{
+	if constexpr (TStream::IsReading)
+	{
+		if (stream.AtEnd())
+		{
+			value = 0;
+			return true;
+		}
+	}
+	return stream.Varint(value);
+}
+
+// Counts are sent for every lane.
+template<typename TStream, typename TCounts>
+bool SerializeLaneCounts(TStream& stream, TCounts& counts)
+{
+	for (auto& count : counts)
+	{
+		if (!stream.Varint(count))
+		{
+			return false;
+		}
+	}
+	return true;
+}
 
 struct SMessage
 {
@@ -49,9 +205,17 @@ struct SMessageBase : public SMessage
 	constexpr SMessageBase() noexcept : SMessage(messageId) {}
 };
 
+// Control messages are serialized as their id byte followed by the fields of their Serialize function.
+// DPIDs are random 32 bit values, so they are sent fixed size, varints would only grow them.
+// Data messages carry game payload and keep a fixed header that is read in place.
+
 namespace Messages
 {
 
+#pragma pack( push, 1 )
+#pragma warning( push )
+#pragma warning( disable : 4200 )
+
 	namespace Shared
 	{
 
@@ -65,29 +229,111 @@ namespace Messages
 
 	}
 
+#pragma warning( pop )
+#pragma pack( pop )
+
 	namespace Client
 	{
 
 		struct SBeginAuth : public SMessageBase<EMessage::ClientBeginAuth>
 		{
-			char   szPassword[DPPASSWORDLEN];
-			uint32 tokenLen;
-			char   pToken[1024];
+			static constexpr size_t s_maxTokenSize = 1024;
+
+			fstring<DPPASSWORDLEN> password;
+			SByteView              token;
+			SCapabilities          capabilities;
+
+			template<typename TStream, typename TSelf>
+			static bool Serialize(TStream& stream, TSelf& self)
+			{
+				return stream.String(self.password)
+					&& stream.Bytes(self.token, s_maxTokenSize)
+					&& SCapabilities::Serialize(stream, self.capabilities);
+			}
 		};
 
-		struct SCreatePlayer : public SMessageBase<EMessage::ClientCreatePlayer>
+		// SBeginAuth sent along with the connection request, before SInfo tells the client what the server asks for.
+		// A server that needs a password ignores it without one, the client then answers SInfo with SBeginAuth as usual.
+		struct SEarlyAuth : public SMessageBase<EMessage::ClientEarlyAuth>
 		{
-			char szShortName[DPSHORTNAMELEN];
-			char szLongName[DPLONGNAMELEN];
-			bool serverPlayer;
-			bool spectator;
+			fstring<DPPASSWORDLEN> password;
+			SByteView              token;
+			SCapabilities          capabilities;
+
+			template<typename TStream, typename TSelf>
+			static bool Serialize(TStream& stream, TSelf& self)
+			{
+				return SBeginAuth::Serialize(stream, self);
+			}
+		};
 
-			char pData[0];
+		struct SCreatePlayer : public SMessageBase<EMessage::ClientCreatePlayer>
+		{
+			fstring<DPSHORTNAMELEN> shortName;
+			fstring<DPLONGNAMELEN>  longName;
+			bool                    serverPlayer = false;
+			bool                    spectator    = false;
+			uint32                  requestId    = 0; // echoed in SCreatePlayerResponse, 0 from older clients
+
+			template<typename TStream, typename TSelf>
+			static bool Serialize(TStream& stream, TSelf& self)
+			{
+				return stream.String(self.shortName)
+					&& stream.String(self.longName)
+					&& stream.Bool(self.serverPlayer)
+					&& stream.Bool(self.spectator)
+					&& SerializeAppended(stream, self.requestId);
+			}
 		};
 
 		struct SDestroyPlayer : public SMessageBase<EMessage::ClientDestroyPlayer>
 		{
-			DPID dpid;
+			DPID dpid = DPID_UNKNOWN;
+
+			template<typename TStream, typename TSelf>
+			static bool Serialize(TStream& stream, TSelf& self)
+			{
+				return stream.Fixed(self.dpid);
+			}
+		};
+
+		struct STimeRequest : public SMessageBase<EMessage::ClientTimeRequest>
+		{
+			uint64 clientTime = 0; // microseconds on the client's TClock
+
+			template<typename TStream, typename TSelf>
+			static bool Serialize(TStream& stream, TSelf& self)
+			{
+				return stream.Varint(self.clientTime);
+			}
+		};
+
+		// Sent instead of SBeginAuth on the new connection of a client that lost its old one.
+		struct SResume : public SMessageBase<EMessage::ClientResume>
+		{
+			uint64        token = 0;
+			TLaneCounts   received{}; // reliable messages the client got on the old connection
+			SCapabilities capabilities;
+
+			template<typename TStream, typename TSelf>
+			static bool Serialize(TStream& stream, TSelf& self)
+			{
+				return stream.Varint(self.token)
+					&& SerializeLaneCounts(stream, self.received)
+					&& SCapabilities::Serialize(stream, self.capabilities);
+			}
+		};
+
+		// Answers SStandbySession once the standby's own server is logged on, 0 if it could not be started.
+		struct SStandbyReady : public SMessageBase<EMessage::ClientStandbyReady>
+		{
+			uint64 serverId = 0;
+
+			template<typename TStream, typename TSelf>
+			static bool Serialize(TStream& stream, TSelf& self)
+			{
+				return stream.Varint(self.serverId);
+			}
 		};
 
 	}
@@ -97,38 +343,234 @@ namespace Messages
 
 		struct SInfo : public SMessageBase<EMessage::ServerInfo>
 		{
-			bool auth;
-			bool password;
+			uint32        protocol = s_protocolId;
+			bool          auth     = false;
+			bool          password = false;
+			SCapabilities capabilities;
+
+			template<typename TStream, typename TSelf>
+			static bool Serialize(TStream& stream, TSelf& self)
+			{
+				if constexpr (TStream::IsReading)
+				{
+					// the packed SInfo of older servers is shorter than the protocol id
+					if (stream.GetRemaining() < sizeof(self.protocol))
+					{
+						self.protocol = 0;
+						return true;
+					}
+				}
+
+				return stream.Fixed(self.protocol)
+					&& stream.Bool(self.auth)
+					&& stream.Bool(self.password)
+					&& SCapabilities::Serialize(stream, self.capabilities);
+			}
 		};
 
 		struct SAuthPassed : public SMessageBase<EMessage::ServerAuthPassed>
 		{
+			template<typename TStream, typename TSelf>
+			static bool Serialize(TStream&, TSelf&)
+			{
+				return true;
+			}
 		};
 
+		// Older servers send no request id, they answer the requests in order.
 		struct SCreatePlayerResponse : public SMessageBase<EMessage::ServerCreatePlayerResponse>
 		{
-			DPID dpid;
-
-			char szShortName[DPSHORTNAMELEN];
-			char szLongName[DPLONGNAMELEN];
+			DPID        dpid = DPID_UNKNOWN;
+			TPlayerSlot slot = s_invalidPlayerSlot;
+
+			fstring<DPSHORTNAMELEN> shortName;
+			fstring<DPLONGNAMELEN>  longName;
+
+			uint32      requestId = 0;
+
+			template<typename TStream, typename TSelf>
+			static bool Serialize(TStream& stream, TSelf& self)
+			{
+				return stream.Fixed(self.dpid)
+					&& stream.Varint(self.slot)
+					&& stream.String(self.shortName)
+					&& stream.String(self.longName)
+					&& SerializeAppended(stream, self.requestId);
+			}
 		};
 
 		struct SPlayerCreated : public SMessageBase<EMessage::ServerPlayerCreated>
 		{
-			DPID dpid;
-
-			char szShortName[DPSHORTNAMELEN];
-			char szLongName[DPLONGNAMELEN];
+			DPID        dpid = DPID_UNKNOWN;
+			TPlayerSlot slot = s_invalidPlayerSlot;
+
+			fstring<DPSHORTNAMELEN> shortName;
+			fstring<DPLONGNAMELEN>  longName;
+
+			template<typename TStream, typename TSelf>
+			static bool Serialize(TStream& stream, TSelf& self)
+			{
+				return stream.Fixed(self.dpid)
+					&& stream.Varint(self.slot)
+					&& stream.String(self.shortName)
+					&& stream.String(self.longName);
+			}
 		};
 
 		struct SPlayerDestroyed : public SMessageBase<EMessage::ServerPlayerDestroyed>
 		{
-			DPID dpid;
+			DPID dpid = DPID_UNKNOWN;
+
+			template<typename TStream, typename TSelf>
+			static bool Serialize(TStream& stream, TSelf& self)
+			{
+				return stream.Fixed(self.dpid);
+			}
+		};
+
+		// Answered right away, so the session time is taken at the middle of the client's round trip.
+		struct STimeResponse : public SMessageBase<EMessage::ServerTimeResponse>
+		{
+			uint64 clientTime  = 0; // of the request
+			uint64 sessionTime = 0; // microseconds since the server started
+
+			template<typename TStream, typename TSelf>
+			static bool Serialize(TStream& stream, TSelf& self)
+			{
+				return stream.Varint(self.clientTime)
+					&& stream.Varint(self.sessionTime);
+			}
+		};
+
+		// Lets the client resume its session on a new connection until graceTime after it lost the old one.
+		struct SResumeToken : public SMessageBase<EMessage::ServerResumeToken>
+		{
+			uint64 token     = 0;
+			uint32 graceTime = 0; // milliseconds
+
+			template<typename TStream, typename TSelf>
+			static bool Serialize(TStream& stream, TSelf& self)
+			{
+				return stream.Varint(self.token)
+					&& stream.Varint(self.graceTime);
+			}
+		};
+
+		struct SResumeResponse : public SMessageBase<EMessage::ServerResumeResponse>
+		{
+			bool        accepted = false; // the client lost its session otherwise
+			TLaneCounts received{};       // reliable messages the server got on the old connection
+
+			template<typename TStream, typename TSelf>
+			static bool Serialize(TStream& stream, TSelf& self)
+			{
+				return stream.Bool(self.accepted)
+					&& SerializeLaneCounts(stream, self.received);
+			}
+		};
+
+		// Makes the client the standby host, followed by an SStandbyPlayer for every player.
+		struct SStandbySession : public SMessageBase<EMessage::ServerStandbySession>
+		{
+			fstring<DPSESSIONNAMELEN> name;
+			fstring<DPPASSWORDLEN>    password;
+			uint32                    maxPlayers     = 0;
+			uint32                    lobbyType      = 0;
+			uint32                    sessionFlags   = 0;
+			TPlayerSlot               nextPlayerSlot = 0;
+
+			template<typename TStream, typename TSelf>
+			static bool Serialize(TStream& stream, TSelf& self)
+			{
+				return stream.String(self.name)
+					&& stream.String(self.password)
+					&& stream.Varint(self.maxPlayers)
+					&& stream.Varint(self.lobbyType)
+					&& stream.Varint(self.sessionFlags)
+					&& stream.Varint(self.nextPlayerSlot);
+			}
+		};
+
+		// A change of the roster, sent to the standby host only.
+		struct SStandbyPlayer : public SMessageBase<EMessage::ServerStandbyPlayer>
+		{
+			bool        added     = false; // removed otherwise, only dpid is set then
+			DPID        dpid      = DPID_UNKNOWN;
+			uint64      owner     = 0;     // steam id of the client the player belongs to
+			TPlayerSlot slot      = s_invalidPlayerSlot;
+			bool        spectator = false;
+			bool        primary   = false; // see SClientData::primaryPlayer
+
+			fstring<DPSHORTNAMELEN> shortName;
+			fstring<DPLONGNAMELEN>  longName;
+
+			template<typename TStream, typename TSelf>
+			static bool Serialize(TStream& stream, TSelf& self)
+			{
+				return stream.Bool(self.added)
+					&& stream.Fixed(self.dpid)
+					&& stream.Varint(self.owner)
+					&& stream.Varint(self.slot)
+					&& stream.Bool(self.spectator)
+					&& stream.Bool(self.primary)
+					&& stream.String(self.shortName)
+					&& stream.String(self.longName);
+			}
+		};
+
+		// Where clients go once the host is lost, 0 while there is no standby host.
+		struct SStandbyHost : public SMessageBase<EMessage::ServerStandbyHost>
+		{
+			uint64 serverId = 0;
+
+			template<typename TStream, typename TSelf>
+			static bool Serialize(TStream& stream, TSelf& self)
+			{
+				return stream.Varint(self.serverId);
+			}
 		};
 
 	}
 
 }
 
-#pragma warning( pop )
-#pragma pack( pop )
+template<typename TMessage>
+constexpr bool IsSerializedMessage = std::is_base_of_v<SMessage, TMessage> && requires(CByteMeasure& stream, TMessage const& message)
+{
+	TMessage::Serialize(stream, message);
+};
+
+// Returns the size of the serialized message including its id byte.
+template<typename TMessage, std::enable_if_t<IsSerializedMessage<TMessage>, bool> = true>
+size_t MeasureMessage(TMessage const& message)
+{
+	CByteMeasure measure;
+	TMessage::Serialize(measure, message);
+	return sizeof(EMessage) + measure.GetSize();
+}
+
+template<typename TMessage, std::enable_if_t<IsSerializedMessage<TMessage>, bool> = true>
+bool WriteMessage(TMessage const& message, void* pBuffer, size_t size)
+{
+	if (size < sizeof(EMessage))
+	{
+		return false;
+	}
+
+	*static_cast<EMessage*>(pBuffer) = TMessage::ID;
+	CByteWriter writer(static_cast<EMessage*>(pBuffer) + 1, size - sizeof(EMessage));
+	return TMessage::Serialize(writer, message);
+}
+
+// Views inside the message point into pBuffer.
+template<typename TMessage, std::enable_if_t<IsSerializedMessage<TMessage>, bool> = true>
+bool ReadMessage(void const* pBuffer, size_t size, TMessage& message)
+{
+	if (size < sizeof(EMessage) || *static_cast<EMessage const*>(pBuffer) != TMessage::ID)
+	{
+		return false;
+	}
+
+	CByteReader reader(static_cast<EMessage const*>(pBuffer) + 1, size - sizeof(EMessage));
+	return TMessage::Serialize(reader, message);
+}
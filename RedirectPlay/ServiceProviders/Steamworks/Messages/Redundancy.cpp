@@ -0,0 +1,107 @@
+#include "Redundancy.h"
+#include "ByteStream.h"
+
+#include <algorithm>
+#include <cstring>
+
+void SRedundancyStats::Write(Log::ESource source) const
+{
+	if (messages == 0)
+	{
+		return;
+	}
+
+	Log::Write(Log::ELevel::Info, source, "Received %llu redundant messages, recovered %llu lost payloads, %llu were lost for good, %llu duplicates.",
+		messages, recovered, lost, duplicates);
+}
+
+TSequence CRedundantSender::Encode(SStreamKey const& key, void const* pPayload, size_t size, uint8 depth, size_t maxSize, std::vector<uint8>& dest)
+{
+	SStream& stream = m_streams[key];
+	depth = (std::min)(depth, s_maxDepth);
+
+	// the newest payloads are the most likely to be missing at the other end
+	CByteMeasure measure;
+	measure.Varint(depth);
+	size_t const baseSize = measure.GetSize() + size;
+
+	size_t total    = baseSize;
+	uint8  repeated = 0;
+	for (auto it = stream.history.rbegin(); it != stream.history.rend() && repeated < depth; ++it)
+	{
+		CByteMeasure entry;
+		entry.Bytes(SByteView{ it->data(), it->size() });
+		if (total + entry.GetSize() > maxSize)
+		{
+			break;
+		}
+		total += entry.GetSize();
+		++repeated;
+	}
+
+	dest.resize(total);
+	CByteWriter writer(dest.data(), dest.size());
+	writer.Varint(repeated);
+	for (size_t i = stream.history.size() - repeated; i < stream.history.size(); ++i)
+	{
+		writer.Bytes(SByteView{ stream.history[i].data(), stream.history[i].size() });
+	}
+	memcpy(writer.GetCursor(), pPayload, size);
+
+	// payloads that can never be repeated are not worth keeping
+	if (depth > 0 && size < maxSize)
+	{
+		uint8 const* const pBytes = static_cast<uint8 const*>(pPayload);
+		stream.history.emplace_back(pBytes, pBytes + size);
+	}
+	while (stream.history.size() > depth)
+	{
+		stream.history.pop_front();
+	}
+	return stream.next++;
+}
+
+bool CRedundantReceiver::Receive(SStreamKey const& key, TSequence sequence, void const* pData, size_t size, TPayloads& payloads)
+{
+	payloads.clear();
+
+	CByteReader reader(pData, size);
+	uint8 count;
+	if (!reader.Varint(count) || count > CRedundantSender::s_maxDepth)
+	{
+		return false;
+	}
+
+	SPayload repeated[CRedundantSender::s_maxDepth];
+	for (uint8 i = 0; i < count; ++i)
+	{
+		SByteView view;
+		if (!reader.Bytes(view))
+		{
+			return false;
+		}
+		repeated[i] = SPayload{ view.pData, view.size };
+	}
+	SPayload const current{ reader.GetCursor(), reader.GetRemaining() };
+
+	++m_stats.messages;
+	auto const [it, inserted] = m_last.try_emplace(key, sequence);
+	if (!inserted)
+	{
+		if (!IsNewerSequence(sequence, it->second))
+		{
+			++m_stats.duplicates;
+			return true;
+		}
+
+		// repeated payload i has the sequence number sequence - count + i
+		TSequence const missing = static_cast<TSequence>(sequence - it->second - 1);
+		TSequence const covered = (std::min)(static_cast<TSequence>(count), missing);
+		m_stats.recovered += covered;
+		m_stats.lost      += missing - covered;
+		payloads.insert(payloads.end(), repeated + (count - covered), repeated + count);
+		it->second = sequence;
+	}
+	payloads.push_back(current);
+	return true;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "../SteamTypes.h"
+#include "Log.h"
+#include "Sequence.h"
+#include "StreamKey.h"
+
+#include "Steam/steamtypes.h"
+
+#include <deque>
+#include <vector>
+
+// Redundant delivery of unreliable data with EFeature::Redundancy.
+//
+// Every unreliable data message carries the sequence number of its (from, to, lane) stream and repeats
+// the last payloads sent on the stream, so a lost message is recovered from the next one that arrives,
+// without the round trip a reliable retransmit costs.
+//
+// varint    count n of repeated payloads, at most s_maxDepth
+// n times   varint size, payload of sequence - n + i, oldest first
+// payload   of sequence, the rest of the message
+//
+// Repeated payloads are only added as long as the message stays within the configured size.
+// The receiver delivers every payload newer than the last one it delivered of the stream, oldest first,
+// the server does so for the data it relays and repeats payloads again for each recipient.
+
+struct SRedundancyStats
+{
+	uint64 messages   = 0; // received
+	uint64 recovered  = 0; // payloads delivered from a repeated copy after their own message was lost
+	uint64 lost       = 0; // payloads that were lost together with all of their copies
+	uint64 duplicates = 0; // messages that had nothing new
+
+	void Write(Log::ESource source) const;
+};
+
+class CRedundantSender
+{
+public:
+	static constexpr uint8 s_maxDepth = 8;
+
+	// Writes the payload and up to depth previous payloads of the stream to dest while it stays within maxSize,
+	// returns the sequence number of the payload.
+	TSequence Encode(SStreamKey const& key, void const* pPayload, size_t size, uint8 depth, size_t maxSize, std::vector<uint8>& dest);
+
+	void      ErasePlayer(DPID dpid) { EraseStreamsOfPlayer(m_streams, dpid); }
+	void      Clear()                { m_streams.clear(); }
+
+private:
+	struct SStream
+	{
+		TSequence                      next = 0;
+		std::deque<std::vector<uint8>> history; // newest last
+	};
+
+	TStreamMap<SStream> m_streams;
+};
+
+class CRedundantReceiver
+{
+public:
+	struct SPayload
+	{
+		uint8 const* pData;
+		size_t       size;
+	};
+	using TPayloads = std::vector<SPayload>;
+
+	// Fills payloads with the payloads of the message that were not delivered yet, oldest first.
+	// Returns false if the message is malformed.
+	bool         Receive(SStreamKey const& key, TSequence sequence, void const* pData, size_t size, TPayloads& payloads);
+
+	void         ErasePlayer(DPID dpid) { EraseStreamsOfPlayer(m_last, dpid); }
+	void         Clear()                { m_last.clear(); }
+
+	SRedundancyStats const& GetStats() const { return m_stats; }
+
+private:
+	TStreamMap<TSequence> m_last;
+	SRedundancyStats      m_stats;
+};
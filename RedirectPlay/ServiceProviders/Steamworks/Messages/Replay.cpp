@@ -0,0 +1,135 @@
+#include "Replay.h"
+#include "Messages.h"
+
+#include "Steam/isteamnetworkingsockets.h"
+
+bool CReplayBuffer::Record(SteamNetworkingMessage_t const& message)
+{
+	m_lastRecorded = false;
+	if ((message.m_nFlags & k_nSteamNetworkingSend_Reliable) == 0)
+	{
+		// unreliable messages may get lost anyway
+		return !m_suspended;
+	}
+	if (IsHandshakeMessage(message))
+	{
+		return true;
+	}
+
+	uint16 const       lane  = GetLane(message);
+	uint8 const* const pData = static_cast<uint8 const*>(message.GetData());
+	m_entries.push_back(SEntry{ lane, m_sent[lane]++, std::vector<uint8>(pData, pData + message.GetSize()) });
+	m_size += message.GetSize();
+	m_lastRecorded = true;
+
+	// the newest message is always kept, so it can still be discarded
+	while (m_size > m_maxSize && m_entries.size() > 1)
+	{
+		SEntry const& oldest = m_entries.front();
+		m_firstKept[oldest.lane] = oldest.index + 1;
+		m_size -= oldest.data.size();
+		m_entries.pop_front();
+	}
+	return !m_suspended;
+}
+
+void CReplayBuffer::DiscardLast()
+{
+	if (!m_lastRecorded)
+	{
+		return;
+	}
+
+	SEntry const& last = m_entries.back();
+	--m_sent[last.lane];
+	m_size -= last.data.size();
+	m_entries.pop_back();
+	m_lastRecorded = false;
+}
+
+void CReplayBuffer::Receive(SteamNetworkingMessage_t const& message)
+{
+	if ((message.m_nFlags & k_nSteamNetworkingSend_Reliable) != 0 && !IsHandshakeMessage(message))
+	{
+		++m_received[GetLane(message)];
+	}
+}
+
+void CReplayBuffer::Suspend()
+{
+	if (m_suspended)
+	{
+		return;
+	}
+
+	m_suspendedReceived = m_received;
+	m_received.fill(0);
+	m_suspended = true;
+}
+
+bool CReplayBuffer::CanResume(TLaneCounts const& peerReceived) const
+{
+	for (size_t lane = 0; lane < peerReceived.size(); ++lane)
+	{
+		if (peerReceived[lane] < m_firstKept[lane] || peerReceived[lane] > m_sent[lane])
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool CReplayBuffer::Resume(TLaneCounts const& peerReceived, TEntries& messages)
+{
+	messages.clear();
+	if (!CanResume(peerReceived))
+	{
+		return false;
+	}
+
+	for (SEntry& entry : m_entries)
+	{
+		if (entry.index >= peerReceived[entry.lane])
+		{
+			messages.push_back(std::move(entry));
+		}
+	}
+
+	// the replayed messages are recorded again as they are sent on the new connection
+	m_entries.clear();
+	m_size         = 0;
+	m_lastRecorded = false;
+	m_sent.fill(0);
+	m_firstKept.fill(0);
+	m_suspended    = false;
+	return true;
+}
+
+bool CReplayBuffer::IsHandshakeMessage(SteamNetworkingMessage_t const& message)
+{
+	if (message.GetSize() < sizeof(EMessage))
+	{
+		return true;
+	}
+
+	switch (*static_cast<EMessage const*>(message.GetData()))
+	{
+	case EMessage::ClientBeginAuth:
+	case EMessage::ClientEarlyAuth:
+	case EMessage::ServerInfo:
+	case EMessage::ServerAuthPassed:
+	case EMessage::ClientTimeRequest:
+	case EMessage::ServerTimeResponse:
+	case EMessage::ServerResumeToken:
+	case EMessage::ClientResume:
+	case EMessage::ServerResumeResponse:
+		return true;
+	default:
+		return false;
+	}
+}
+
+uint16 CReplayBuffer::GetLane(SteamNetworkingMessage_t const& message)
+{
+	return message.m_idxLane < std::tuple_size_v<TLaneCounts> ? message.m_idxLane : 0;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "../SteamTypes.h"
+
+#include "Steam/steamnetworkingtypes.h"
+#include "Steam/steamtypes.h"
+
+#include <deque>
+#include <vector>
+
+// Session resumption with EFeature::Resume.
+//
+// Both sides keep copies of the last reliable messages they sent to the other and count the reliable messages
+// they received from it per lane. Steam delivers the reliable messages of a lane in order, so the counts of one side
+// tell the other exactly which of its messages arrived before the connection was lost. Once a new connection
+// resumes the session, each side sends its counts and replays what the other did not get before anything else.
+// Handshake messages belong to a single connection, they are neither recorded nor counted.
+//
+// While suspended, reliable messages are only recorded. The session can not be resumed once messages the peer
+// did not get were dropped to keep the buffer within its size.
+
+class CReplayBuffer
+{
+public:
+	struct SEntry
+	{
+		uint16             lane;
+		uint32             index; // of the reliable message on its lane
+		std::vector<uint8> data;
+	};
+	using TEntries = std::vector<SEntry>;
+
+	void               SetMaxSize(size_t maxSize) { m_maxSize = maxSize; }
+
+	// Returns false if the message must not be sent, because the connection is suspended.
+	bool               Record(SteamNetworkingMessage_t const& message);
+	// The last recorded message could not be sent after all.
+	void               DiscardLast();
+	void               Receive(SteamNetworkingMessage_t const& message);
+
+	// Stops sending and starts counting for a new connection.
+	void               Suspend();
+	bool               IsSuspended() const { return m_suspended; }
+	TLaneCounts const& GetSuspendedReceived() const { return m_suspendedReceived; }
+
+	bool               CanResume(TLaneCounts const& peerReceived) const;
+	// Moves the messages the peer did not receive on the old connection to messages, oldest first,
+	// and starts recording for the new one. Returns false if some of them were dropped already.
+	bool               Resume(TLaneCounts const& peerReceived, TEntries& messages);
+
+private:
+	static bool        IsHandshakeMessage(SteamNetworkingMessage_t const& message);
+	static uint16      GetLane(SteamNetworkingMessage_t const& message);
+
+	std::deque<SEntry> m_entries; // oldest first
+	size_t             m_size    = 0;
+	size_t             m_maxSize = 0;
+	bool               m_lastRecorded = false;
+
+	TLaneCounts        m_sent{};
+	TLaneCounts        m_firstKept{}; // index of the oldest message still recorded per lane
+	TLaneCounts        m_received{};
+	TLaneCounts        m_suspendedReceived{};
+	bool               m_suspended = false;
+};
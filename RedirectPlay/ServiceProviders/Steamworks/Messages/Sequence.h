@@ -0,0 +1,59 @@
+#pragma once
+
+#include "StreamKey.h"
+
+// Latest value delivery of unreliable data with EFeature::Sequenced.
+//
+// Every unreliable data message carries a 16 bit sequence number counted per (from, to, lane) stream and connection.
+// The receiver drops a message unless it is newer than the last one it accepted from the stream,
+// the server filters what it relays and numbers the result again for each recipient.
+// Clients additionally replace a message of the stream that still waits in the receive queue, see CSteamPlayClient::QueueData.
+
+using TSequence = uint16;
+
+// Sequence numbers wrap, anything up to half the range ahead counts as newer.
+constexpr bool IsNewerSequence(TSequence sequence, TSequence than)
+{
+	return static_cast<int16>(static_cast<TSequence>(sequence - than)) > 0;
+}
+
+class CSequenceCounters
+{
+public:
+	TSequence Next(SStreamKey const& key) { return m_next[key]++; }
+
+	void      ErasePlayer(DPID dpid) { EraseStreamsOfPlayer(m_next, dpid); }
+	void      Clear()                { m_next.clear(); }
+
+private:
+	TStreamMap<TSequence> m_next;
+};
+
+class CSequenceFilter
+{
+public:
+	// Returns false if the message is not newer than the last accepted one of its stream.
+	bool Accept(SStreamKey const& key, TSequence sequence)
+	{
+		auto const [it, inserted] = m_last.try_emplace(key, sequence);
+		if (!inserted)
+		{
+			if (!IsNewerSequence(sequence, it->second))
+			{
+				++m_dropped;
+				return false;
+			}
+			it->second = sequence;
+		}
+		return true;
+	}
+
+	void   ErasePlayer(DPID dpid) { EraseStreamsOfPlayer(m_last, dpid); }
+	void   Clear()                { m_last.clear(); }
+
+	uint64 GetDropped() const     { return m_dropped; }
+
+private:
+	TStreamMap<TSequence> m_last;
+	uint64                m_dropped = 0;
+};
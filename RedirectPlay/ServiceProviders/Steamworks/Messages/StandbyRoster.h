@@ -0,0 +1,55 @@
+#pragma once
+
+#include "Messages.h"
+
+#include "DirectX/dplay.h"
+#include "Steam/steamclientpublic.h"
+
+#include <unordered_map>
+
+// Host migration with EFeature::HostMigration for sessions with DPSESSION_MIGRATEHOST.
+//
+// The server picks one client as standby host and sends it an SStandbySession followed by an SStandbyPlayer
+// per player, then one more SStandbyPlayer for every player created or destroyed. The standby keeps a server of its own
+// logged on and hands it this roster. Once the host is lost, that server takes over the players with their DPIDs
+// and slots, the clients reconnect to it and get their players back after passing auth, see CSteamPlayServer::ClaimPlayers.
+struct SStandbyRoster
+{
+	struct SPlayer
+	{
+		CSteamID                owner;
+		TPlayerSlot             slot      = s_invalidPlayerSlot;
+		bool                    spectator = false;
+		bool                    primary   = false;
+		fstring<DPSHORTNAMELEN> shortName;
+		fstring<DPLONGNAMELEN>  longName;
+	};
+	using TPlayers = std::unordered_map<DPID, SPlayer>;
+
+	Messages::Server::SStandbySession session; // the settings the standby server starts with
+	TPlayerSlot                       nextPlayerSlot = 0;
+	TPlayers                          players;
+
+	void Apply(Messages::Server::SStandbySession const& message)
+	{
+		session        = message;
+		nextPlayerSlot = message.nextPlayerSlot;
+		players.clear();
+	}
+
+	void Apply(Messages::Server::SStandbyPlayer const& message)
+	{
+		if (!message.added)
+		{
+			players.erase(message.dpid);
+			return;
+		}
+
+		players[message.dpid] = SPlayer{ CSteamID(message.owner), message.slot, message.spectator, message.primary, message.shortName, message.longName };
+		if (message.slot != s_invalidPlayerSlot)
+		{
+			// slots are handed out round robin, see CSteamPlayServer::AllocatePlayerSlot
+			nextPlayerSlot = static_cast<TPlayerSlot>((message.slot + 1) % s_maxPlayerSlots);
+		}
+	}
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "../SteamTypes.h"
+
+#include "DirectX/dplay.h"
+#include "Steam/steamtypes.h"
+
+#include <functional>
+#include <unordered_map>
+
+// Per stream state of data between two players on one lane, used by delta encoding and sequenced data.
+
+struct SStreamKey
+{
+	DPID  from;
+	DPID  to;
+	ELane lane;
+
+	bool operator==(SStreamKey const&) const = default;
+};
+
+struct SStreamKeyHash
+{
+	size_t operator()(SStreamKey const& key) const
+	{
+		uint64 const ids = (static_cast<uint64>(static_cast<uint32>(key.from)) << 32) | static_cast<uint32>(key.to);
+		return std::hash<uint64>()(ids * 31 + static_cast<uint64>(key.lane));
+	}
+};
+
+template<typename TValue>
+using TStreamMap = std::unordered_map<SStreamKey, TValue, SStreamKeyHash>;
+
+template<typename TValue>
+void EraseStreamsOfPlayer(TStreamMap<TValue>& streams, DPID dpid)
+{
+	typename TStreamMap<TValue>::iterator it = streams.begin();
+	while (it != streams.end())
+	{
+		if (it->first.from == dpid || it->first.to == dpid)
+		{
+			it = streams.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
@@ -61,6 +61,22 @@ void CSteamLobby::Leave()
 	Log::Debug("Left lobby.");
 }
 
+bool CSteamLobby::IsOwner() const
+{
+	return m_lobbyID.IsValid() && SteamMatchmaking()->GetLobbyOwner(m_lobbyID) == SteamUser()->GetSteamID();
+}
+
+bool CSteamLobby::SetOwner(CSteamID ownerID)
+{
+	if (!IsOwner() || !SteamMatchmaking()->SetLobbyOwner(m_lobbyID, ownerID))
+	{
+		return false;
+	}
+
+	Log::Debug("Handed the lobby to %llu.", ownerID.ConvertToUint64());
+	return true;
+}
+
 void CSteamLobby::SetGameServer(CSteamID serverID)
 {
 	SteamMatchmaking()->SetLobbyGameServer(m_lobbyID, 0, 0, serverID);
@@ -34,6 +34,10 @@ public:
 
 	CSteamID GetSteamID() const     { return m_lobbyID; }
 
+	// The owner sets the game server, it is handed to the standby host when the host quits, see SStandbyRoster.
+	bool     IsOwner() const;
+	bool     SetOwner(CSteamID ownerID);
+
 	void     SetGameServer(CSteamID serverID);
 	CSteamID GetGameServer() const;
 
@@ -1,6 +1,8 @@
 #include "SteamPlayServer.h"
-#include "../Messages/Messages.h"
+#include "../Messages/DataBundle.h"
+#include "../Messages/MessageRegistry.h"
 #include "../Messages/MessageSender.h"
+#include "../SteamPlayConfig.h"
 #include "../SteamPlayUtilities.h"
 #include "DirectPlay/Utils.h"
 #include "Log.h"
@@ -8,7 +10,9 @@
 
 #include "Steam/steamclientpublic.h"
 
+#include <algorithm>
 #include <cassert>
+#include <random>
 #include <thread>
 #include <type_traits>
 
@@ -22,17 +26,53 @@ constexpr bool UseAuth() { return s_serverAuthMode >= eServerModeAuthentication;
 
 constexpr TClock::duration s_clientTimeoutDuration = std::chrono::seconds(50);
 
+// Log lines per second about invalid messages of one client.
+constexpr uint32 s_rejectLogRate  = 1;
+constexpr uint32 s_rejectLogBurst = 10;
+
 using TMessageSender = CMessageSender<SteamGameServerNetworkingSockets, Log::ESource::Server>;
 
+static uint64 CreateResumeToken()
+{
+	std::random_device random;
+	uint64 token = 0;
+	while (token == 0)
+	{
+		token = (static_cast<uint64>(random()) << 32) | random();
+	}
+	return token;
+}
+
+static uint32 GetRateLimitBurst(uint32 rate)
+{
+	return static_cast<uint32>(static_cast<uint64>(rate) * SSteamPlayConfig::Get().rateLimitBurst / 1000);
+}
+
 CSteamPlayServer::CSteamPlayServer()
 	: m_state(EState::Disconnected)
 	, m_listenSocket(k_HSteamListenSocket_Invalid)
 	, m_netPollGroup(k_HSteamNetPollGroup_Invalid)
 	, m_clients()
 	, m_players()
+	, m_playerSlots()
+	, m_nextPlayerSlot(0)
 	, m_settings()
 	, m_sendDataBuf()
+	, m_compressionStats()
+	, m_deltaBuffer()
 	, m_timeoutDuration(s_clientTimeoutDuration)
+	, m_sessionStart()
+	, m_nextLaneReport()
+	, m_standby(k_HSteamNetConnection_Invalid)
+	, m_standbyServer()
+	, m_standbyOwner(0)
+	, m_standbyMode(false)
+	, m_takeOver(false)
+	, m_standbyRoster()
+	, m_heldConnections()
+	, m_unclaimedPlayers()
+	, m_takeOverStart()
+	, m_takeOverDeadline()
 	, m_pThread(nullptr)
 	, m_quitting(false)
 {
@@ -86,6 +126,17 @@ bool CSteamPlayServer::Start(SSteamServerSettings const& settings)
 
 	m_settings = settings;
 	m_state = EState::Connecting;
+	m_sessionStart = TClock::now();
+	m_unknownSenderLog.Configure(s_rejectLogRate, s_rejectLogBurst, m_sessionStart);
+
+	TMessageSender::SetReplayBuffers([this](HSteamNetConnection connection) -> CReplayBuffer*
+	{
+		TClients::iterator const it = m_clients.find(connection);
+		return it != m_clients.end() && it->second.recordReplay ? &it->second.replay : nullptr;
+	});
+
+	m_playerSlots.fill(DPID_UNKNOWN);
+	m_nextPlayerSlot = 0;
 
 	m_quitting = false;
 	m_pThread = new std::thread([this]() { this->UpdateLoop(); });
@@ -105,9 +156,29 @@ void CSteamPlayServer::Close()
 		// tell clients we are exiting
 		for (TClient& client : m_clients)
 		{
+			client.second.deltaSendStreams.GetStats().Write(Log::ESource::Server);
+			client.second.deltaReceiveStreams.GetStats().Write(Log::ESource::Server);
+			if (client.second.sequenceFilter.GetDropped() > 0)
+			{
+				Log::InfoServer("Dropped %llu obsolete sequenced data messages from client %u.", client.second.sequenceFilter.GetDropped(), client.first);
+			}
+			if (client.second.conflationHeld > 0)
+			{
+				Log::InfoServer("Held %llu unreliable data messages for congested client %u, %llu were replaced by newer ones.",
+					client.second.conflationHeld, client.first, client.second.conflationReplaced);
+			}
+			client.second.redundantReceiver.GetStats().Write(Log::ESource::Server);
+			WriteRateLimitStats(client);
+			client.second.deferred.clear(); // steam messages have to be released before the shutdown
+			client.second.deferredBytes = 0;
+
 			SteamGameServerNetworkingSockets()->CloseConnection(client.first, (int)EDisconnectReason::ServerClosed, nullptr, false);
 			SteamGameServer()->EndAuthSession(client.second.steamId);
 		}
+		for (auto const& [connection, steamId] : m_heldConnections)
+		{
+			SteamGameServerNetworkingSockets()->CloseConnection(connection, (int)EDisconnectReason::ServerClosed, nullptr, false);
+		}
 
 		SteamGameServerNetworkingSockets()->CloseListenSocket(m_listenSocket);
 		SteamGameServerNetworkingSockets()->DestroyPollGroup(m_netPollGroup);
@@ -121,15 +192,98 @@ void CSteamPlayServer::Close()
 		m_state = EState::Disconnected;
 
 		m_settings = SSteamServerSettings();
+
+		m_compressionStats.Write(Log::ESource::Server);
+		m_compressionStats = SCompressionStats();
+		if (m_lockstep.turns > 0)
+		{
+			Log::InfoServer("Closed %llu lockstep turns with %llu commands, %llu of them complete before their deadline.",
+				m_lockstep.turns, m_lockstep.commands, m_lockstep.completeTurns);
+		}
+		m_lockstep = SLockstep();
+		if (m_spectatorFeed.updates > 0)
+		{
+			Log::InfoServer("Sent %llu spectator feed updates with %llu messages, %llu unreliable ones were replaced by newer ones.",
+				m_spectatorFeed.updates, m_spectatorFeed.held, m_spectatorFeed.replaced);
+		}
+		m_spectatorFeed = SSpectatorFeed();
+		for (auto const& [sender, stats] : m_senderStats)
+		{
+			stats.Write(sender);
+		}
+		m_senderStats.clear();
+		if (m_overrunTicks > 0)
+		{
+			Log::InfoServer("Overran %llu ticks, low priority work was shed during %llu ticks.", m_overrunTicks, m_shedTicks);
+		}
+		m_shedLevel               = EShedLevel::None;
+		m_overrunTicks            = 0;
+		m_shedTicks               = 0;
+		m_spareTicks              = 0;
+		m_unknownSenderSuppressed = 0;
+		TMessageSender::SetReplayBuffers(nullptr);
 		m_clients.clear();
 		m_players.clear();
+		m_playerSlots.fill(DPID_UNKNOWN);
+
+		m_standby       = k_HSteamNetConnection_Invalid;
+		m_standbyServer = CSteamID();
+		m_standbyOwner  = 0;
+		m_standbyMode   = false;
+		m_takeOver      = false;
+		m_standbyRoster = SStandbyRoster();
+		m_heldConnections.clear();
+		m_unclaimedPlayers.clear();
 
 		Log::InfoServer("Disconnected.");
 	}
 }
 
+bool CSteamPlayServer::StartStandby(SSteamServerSettings const& settings)
+{
+	m_standbyMode = true;
+	m_takeOver    = false;
+	if (!Start(settings))
+	{
+		m_standbyMode = false;
+		return false;
+	}
+
+	Log::InfoServer("Standing by to take over the session.");
+	return true;
+}
+
+// Called by the standby client whenever the host changed the roster, picked up by TakeOverSession.
+void CSteamPlayServer::SetStandbyRoster(SStandbyRoster const& roster)
+{
+	std::lock_guard<std::mutex> const lock(m_standbyRosterMutex);
+	m_standbyRoster = roster;
+}
+
 constexpr size_t TicksPerSecond = 60;
 
+SCapabilities CSteamPlayServer::GetCapabilities() const
+{
+	SCapabilities capabilities = SSteamPlayConfig::Get().GetCapabilities();
+	if (!(m_settings.sessionFlags & DPSESSION_NOPRESERVEORDER))
+	{
+		capabilities.features &= ~static_cast<uint32>(EFeature::Unordered);
+	}
+	if (!(m_settings.sessionFlags & DPSESSION_OPTIMIZELATENCY))
+	{
+		capabilities.features &= ~static_cast<uint32>(EFeature::LowLatency);
+	}
+	if (SSteamPlayConfig::Get().resumeGraceTime == 0)
+	{
+		capabilities.features &= ~static_cast<uint32>(EFeature::Resume);
+	}
+	if (!MigratesHost())
+	{
+		capabilities.features &= ~static_cast<uint32>(EFeature::HostMigration);
+	}
+	return capabilities;
+}
+
 void CSteamPlayServer::UpdateLoop()
 {
 	static constexpr TClock::duration s_tickDuration(TClock::duration::period::den / TicksPerSecond);
@@ -137,9 +291,28 @@ void CSteamPlayServer::UpdateLoop()
 	while (!m_quitting)
 	{
 		TClock::time_point const start = TClock::now();
+		StartSchedulerTick();
 		SteamGameServer_RunCallbacks();
 		ReceiveNetworkData();
+		UpdateSuspendedClients();
+		UpdateStandby();
+		UpdateLockstep();
+		if (!Sheds(EShedLevel::Spectators))
+		{
+			UpdateSpectatorFeed();
+		}
+		if (!Sheds(EShedLevel::Conflation))
+		{
+			UpdateConflation();
+		}
+		RunScheduler();
+		FlushBundles();
+		if (!Sheds(EShedLevel::Reports))
+		{
+			ReportLaneQueueTimes();
+		}
 		TClock::time_point const end = TClock::now();
+		UpdateShedLevel(end - start, s_tickDuration);
 
 		std::chrono::microseconds const diff = std::chrono::duration_cast<std::chrono::microseconds>(s_tickDuration - (end - start));
 		if (diff.count() > 0)
@@ -158,8 +331,10 @@ void CSteamPlayServer::ReceiveNetworkData()
 		return;
 	}
 
+	// while overloaded the rest waits in steam, where it costs the relay nothing
+	int const maxMessages = Sheds(EShedLevel::Receiving) ? s_maxMessages / 4 : s_maxMessages;
 	SteamNetworkingMessage_t* messages[s_maxMessages];
-	int const count = SteamGameServerNetworkingSockets()->ReceiveMessagesOnPollGroup(m_netPollGroup, messages, s_maxMessages);
+	int const count = SteamGameServerNetworkingSockets()->ReceiveMessagesOnPollGroup(m_netPollGroup, messages, maxMessages);
 
 	if (m_state != EState::Connected)
 	{
@@ -171,6 +346,11 @@ void CSteamPlayServer::ReceiveNetworkData()
 		return;
 	}
 
+	if (!Sheds(EShedLevel::Deferred))
+	{
+		ProcessDeferredMessages();
+	}
+
 	for (int i = 0; i < count; ++i)
 	{
 		ProcessNetworkingMessage(messages[i]);
@@ -227,13 +407,37 @@ void CSteamPlayServer::OnNetConnectionStatusChanged(SteamNetConnectionStatusChan
 	if (oldState == k_ESteamNetworkingConnectionState_None &&
 		newState == k_ESteamNetworkingConnectionState_Connecting)
 	{
-		AddClient(connection, steamID);
+		if (m_standbyMode)
+		{
+			// the host may still be there, clients only come this early if they lost it first
+			m_heldConnections.emplace_back(connection, steamID);
+			Log::InfoServer("Holding connection %u until the host is lost.", connection);
+		}
+		else
+		{
+			AddClient(connection, steamID);
+		}
 	}
 	else if ((oldState == k_ESteamNetworkingConnectionState_Connecting || oldState == k_ESteamNetworkingConnectionState_Connected) &&
-		newState == k_ESteamNetworkingConnectionState_ClosedByPeer)
+		(newState == k_ESteamNetworkingConnectionState_ClosedByPeer || newState == k_ESteamNetworkingConnectionState_ProblemDetectedLocally))
 	{
-		Log::DebugServer("Client lost %i %i", oldState, newState);
-		RemoveClient(connection, EDisconnectReason::ClientDisconnect);
+		if (std::erase_if(m_heldConnections, [connection](auto const& held) { return held.first == connection; }) > 0)
+		{
+			SteamGameServerNetworkingSockets()->CloseConnection(connection, (int)EDisconnectReason::ClientDisconnect, nullptr, false);
+			return;
+		}
+
+		// clients that can resume their session keep their players unless they left on purpose
+		TClients::iterator const it = m_clients.find(connection);
+		if (it != m_clients.end() && it->second.resumeToken != 0 && info.m_eEndReason != static_cast<int>(EDisconnectReason::ClientDisconnect))
+		{
+			SuspendClient(*it);
+		}
+		else if (newState == k_ESteamNetworkingConnectionState_ClosedByPeer)
+		{
+			Log::DebugServer("Client lost %i %i", oldState, newState);
+			RemoveClient(connection, EDisconnectReason::ClientDisconnect);
+		}
 	}
 }
 
@@ -257,7 +461,9 @@ void CSteamPlayServer::AddClient(HSteamNetConnection connection, CSteamID steamI
 		return;
 	}
 
-	if (m_players.size() >= m_settings.maxPlayers)
+	// a client resuming its session or following the host brings its players back with it
+	bool const resuming = HasSuspendedClient(steamID) || HasUnclaimedPlayers(steamID);
+	if (!resuming && m_players.size() >= m_settings.maxPlayers)
 	{
 		// No empty slots. Server full!
 		SteamGameServerNetworkingSockets()->CloseConnection(connection, (int)EDisconnectReason::ServerFull, "Server full!", false);
@@ -275,16 +481,23 @@ void CSteamPlayServer::AddClient(HSteamNetConnection connection, CSteamID steamI
 
 	SteamGameServerNetworkingSockets()->SetConnectionPollGroup(connection, m_netPollGroup);
 
-	m_clients[connection] = { steamID, false, TClock::now() };
-
-	TMessageSender::TrySend<Messages::Server::SInfo>(
-		connection,
-		k_nSteamNetworkingSend_Reliable,
-		[this](Messages::Server::SInfo& message)
-		{
-			message.auth     = UseAuth();
-			message.password = HasPassword();
-		});
+	TClock::time_point const now = TClock::now();
+	SSteamPlayConfig const&  config = SSteamPlayConfig::Get();
+	SClientData&             client = m_clients[connection];
+	client = { steamID, false, now };
+	client.messageLimit.Configure(config.rateLimitMessages, GetRateLimitBurst(config.rateLimitMessages), now);
+	client.byteLimit.Configure(config.rateLimitBytes, GetRateLimitBurst(config.rateLimitBytes), now);
+	client.rejectLog.Configure(s_rejectLogRate, s_rejectLogBurst, now);
+	client.replay.SetMaxSize(config.resumeReplaySize);
+	client.recordReplay  = config.resumeGraceTime > 0;
+	client.pendingResume = resuming;
+	client.acceptTime    = now;
+
+	Messages::Server::SInfo info;
+	info.auth         = UseAuth();
+	info.password     = HasPassword();
+	info.capabilities = GetCapabilities();
+	TMessageSender::Send(info, connection, k_nSteamNetworkingSend_Reliable);
 
 	Log::InfoServer("Accepted Client %u.", connection);
 }
@@ -310,8 +523,13 @@ CSteamPlayServer::TClients::iterator CSteamPlayServer::RemoveClient(TClients::it
 	}
 
 	HSteamNetConnection connection = entry->first;
+	WriteRateLimitStats(*entry);
 	SteamGameServerNetworkingSockets()->CloseConnection(connection, (int)reason, nullptr, false);
 	TClients::iterator const it = m_clients.erase(entry);
+	if (connection == m_standby)
+	{
+		ClearStandby();
+	}
 
 	for (auto pit = m_players.begin(); pit != m_players.end();)
 	{
@@ -339,74 +557,309 @@ void CSteamPlayServer::ProcessNetworkingMessage(TSteamMessageUniquePtr pSteamMes
 	TClients::iterator clientIt = m_clients.find(pSteamMessage->GetConnection());
 	if (clientIt == m_clients.end())
 	{
+		// the rest of what a kicked client sent ends up here as well
+		if (!m_unknownSenderLog.TryConsume(1, TClock::now()))
+		{
+			++m_unknownSenderSuppressed;
+			return;
+		}
+		if (m_unknownSenderSuppressed > 0)
+		{
+			Log::InfoServer("Suppressed %llu log lines about unknown client message senders.", m_unknownSenderSuppressed);
+			m_unknownSenderSuppressed = 0;
+		}
 		Log::InfoServer("Client message sender %u is unknown.", pSteamMessage->GetConnection());
 		return;
 	}
 
-	if (pSteamMessage->GetSize() < sizeof(SMessage))
+	// what a suspended connection still delivered is not counted, so the client replays it
+	if (clientIt->second.suspended)
 	{
-		Log::WarnServer("Client message was too short.");
 		return;
 	}
+	clientIt->second.replay.Receive(*pSteamMessage);
+
+	if (AdmitMessage(*clientIt, pSteamMessage))
+	{
+		DispatchMessage(*clientIt, std::move(pSteamMessage));
+	}
+}
 
-	size_t receiveSize;
-	void(CSteamPlayServer::*pReceive)(TClient&, TSteamMessageUniquePtr);
+// Applies the client's rate limits, returns false if the message must not be dispatched now.
+// Reliable messages are never dropped, the client is kicked if they cannot wait. The client is gone once it got kicked.
+bool CSteamPlayServer::AdmitMessage(TClient& client, TSteamMessageUniquePtr& pSteamMessage)
+{
+	SClientData&             data = client.second;
+	TClock::time_point const now  = TClock::now();
+	size_t const             size = pSteamMessage->GetSize();
 
-	SMessage const& message = *static_cast<SMessage*>(pSteamMessage->m_pData);
-	switch (message.GetId())
+	// deferred messages go first, so the client's messages keep their order
+	if (data.deferred.empty() && data.messageLimit.CanConsume(1, now) && data.byteLimit.CanConsume(size, now))
 	{
-	case Messages::Client::SBeginAuth::ID:
-		pReceive = &CSteamPlayServer::OnReceiveBeginAuth;
-		receiveSize = sizeof(Messages::Client::SBeginAuth);
-		break;
-	case Messages::Client::SCreatePlayer::ID:
-		pReceive = &CSteamPlayServer::OnReceiveCreatePlayer;
-		receiveSize = sizeof(Messages::Client::SCreatePlayer);
-		break;
-	case Messages::Client::SDestroyPlayer::ID:
-		pReceive = &CSteamPlayServer::OnReceiveDestroyPlayer;
-		receiveSize = sizeof(Messages::Client::SDestroyPlayer);
-		break;
-	case Messages::Shared::SData::ID:
-		pReceive = &CSteamPlayServer::OnReceiveData;
-		receiveSize = sizeof(Messages::Shared::SData);
-		break;
-	default:
-		Log::WarnServer("Client sent unregistered message %u.", message.GetId());
+		data.messageLimit.Consume(1);
+		data.byteLimit.Consume(size);
+		return true;
+	}
+
+	++data.rateLimited;
+	SSteamPlayConfig const& config   = SSteamPlayConfig::Get();
+	ERateLimitAction const  action   = config.rateLimitAction;
+	bool const              reliable = pSteamMessage->m_nFlags & k_nSteamNetworkingSend_Reliable;
+	if (action == ERateLimitAction::Kick)
+	{
+		Log::InfoServer("Kicking client %u, it exceeded its rate limit.", client.first);
+		RemoveClient(client.first, EDisconnectReason::ClientKicked);
+		return false;
+	}
+
+	if (reliable || action == ERateLimitAction::Delay)
+	{
+		if (data.deferredBytes + size <= config.rateLimitDeferredBytes)
+		{
+			data.deferredBytes += size;
+			data.deferred.push_back(std::move(pSteamMessage));
+			return false;
+		}
+		if (reliable)
+		{
+			Log::InfoServer("Kicking client %u, too many of its reliable messages wait for its rate limit.", client.first);
+			RemoveClient(client.first, EDisconnectReason::ClientKicked);
+			return false;
+		}
+	}
+
+	++data.dropped;
+	LogRejected(client, Log::ELevel::Info, "Dropped a message from client %u above its rate limit.", client.first);
+	return false;
+}
+
+void CSteamPlayServer::ProcessDeferredMessages()
+{
+	std::vector<HSteamNetConnection> connections;
+	for (TClient const& client : m_clients)
+	{
+		if (!client.second.deferred.empty())
+		{
+			connections.push_back(client.first);
+		}
+	}
+
+	TClock::time_point const now = TClock::now();
+	for (HSteamNetConnection const connection : connections)
+	{
+		// handlers may remove the client, it is looked up again for every message
+		for (;;)
+		{
+			TClients::iterator const clientIt = m_clients.find(connection);
+			if (clientIt == m_clients.end() || clientIt->second.deferred.empty())
+			{
+				break;
+			}
+
+			SClientData& data = clientIt->second;
+			size_t const size = data.deferred.front()->GetSize();
+			if (!data.messageLimit.CanConsume(1, now) || !data.byteLimit.CanConsume(size, now))
+			{
+				break;
+			}
+			data.messageLimit.Consume(1);
+			data.byteLimit.Consume(size);
+
+			TSteamMessageUniquePtr pSteamMessage = std::move(data.deferred.front());
+			data.deferred.pop_front();
+			data.deferredBytes -= size;
+			DispatchMessage(*clientIt, std::move(pSteamMessage));
+		}
+	}
+}
+
+template<typename ... TArgs>
+void CSteamPlayServer::LogRejected(TClient& client, Log::ELevel level, char const* fmt, TArgs... args)
+{
+	SClientData& data = client.second;
+	if (!data.rejectLog.TryConsume(1, TClock::now()))
+	{
+		++data.rejectsSuppressed;
 		return;
 	}
 
-	if (pSteamMessage->GetSize() < receiveSize)
+	if (data.rejectsSuppressed > 0)
+	{
+		Log::InfoServer("Suppressed %llu log lines about invalid messages from client %u.", data.rejectsSuppressed, client.first);
+		data.rejectsSuppressed = 0;
+	}
+	Log::Write(level, Log::ESource::Server, fmt, args...);
+}
+
+void CSteamPlayServer::WriteRateLimitStats(TClient const& client) const
+{
+	SClientData const& data = client.second;
+	if (data.rateLimited > 0)
+	{
+		Log::InfoServer("Client %u exceeded its rate limit with %llu messages, %llu of them were dropped.", client.first, data.rateLimited, data.dropped);
+	}
+	if (data.rejectsSuppressed > 0)
+	{
+		Log::InfoServer("Suppressed %llu log lines about invalid messages from client %u.", data.rejectsSuppressed, client.first);
+	}
+}
+
+void CSteamPlayServer::DispatchMessage(TClient& client, TSteamMessageUniquePtr pSteamMessage)
+{
+	if (HoldForAuth(client, pSteamMessage))
 	{
-		Log::WarnServer("Client message %u was too short. Got %u but expected at least %u.", message.GetId(), pSteamMessage->GetSize(), receiveSize);
 		return;
 	}
 
-	(this->*pReceive)(*clientIt, std::move(pSteamMessage));
+	using TDispatcher = CMessageDispatcher<CSteamPlayServer, EMessageDirection::ToServer, Log::ESource::Server, TClient&>;
+	static constexpr TDispatcher::TTable s_dispatchTable = TDispatcher::MakeTable<
+		TDispatcher::SBind<&CSteamPlayServer::OnReceiveBeginAuth>,
+		TDispatcher::SBind<&CSteamPlayServer::OnReceiveCreatePlayer>,
+		TDispatcher::SBind<&CSteamPlayServer::OnReceiveDestroyPlayer>,
+		TDispatcher::SBind<&CSteamPlayServer::OnReceiveTimeRequest>,
+		TDispatcher::SBind<&CSteamPlayServer::OnReceiveResume>,
+		TDispatcher::SBind<&CSteamPlayServer::OnReceiveStandbyReady>,
+		TDispatcher::SBind<&CSteamPlayServer::OnReceiveEarlyAuth>,
+		TDispatcher::SBindRaw<Messages::Shared::SData, &CSteamPlayServer::OnReceiveData>,
+		TDispatcher::SBindRaw<Messages::Shared::SDataHeader, &CSteamPlayServer::OnReceiveData>,
+		TDispatcher::SBindRaw<Messages::Shared::SDataFragment, &CSteamPlayServer::OnReceiveDataFragment>>();
+
+	TDispatcher::Dispatch(s_dispatchTable, *this, client, std::move(pSteamMessage));
 }
 
-void CSteamPlayServer::OnReceiveBeginAuth(TClient& client, TSteamMessageUniquePtr pSteamMessage)
+void CSteamPlayServer::OnReceiveBeginAuth(TClient& client, Messages::Client::SBeginAuth const& message)
 {
-	assert(pSteamMessage != nullptr);
-	Messages::Client::SBeginAuth const& message = *static_cast<Messages::Client::SBeginAuth*>(pSteamMessage->m_pData);
+	// the state built on the features must not change under the client, nor may it start over with auth
+	if (client.second.negotiated || client.second.authorized)
+	{
+		LogRejected(client, Log::ELevel::Warning, "Client %u sent its credentials more than once.", client.first);
+		return;
+	}
+	client.second.negotiated = true;
+
+	NegotiateCapabilities(client, message.capabilities);
+	client.second.pendingResume = false;
+	if (client.second.capabilities.Has(EFeature::Resume))
+	{
+		Messages::Server::SResumeToken token;
+		token.token     = client.second.resumeToken = CreateResumeToken();
+		token.graceTime = SSteamPlayConfig::Get().resumeGraceTime;
+		TMessageSender::Send(token, client.first, k_nSteamNetworkingSend_Reliable);
+	}
+	else
+	{
+		client.second.recordReplay = false;
+		client.second.replay       = CReplayBuffer();
+	}
 
-	if (HasPassword() && strncmp(m_settings.password, message.szPassword, ArrayCount(message.szPassword)) != 0)
+	if (HasPassword() && strncmp(m_settings.password, message.password, m_settings.password.array_size()) != 0)
 	{
 		RemoveClient(client.first, EDisconnectReason::ServerReject);
 	}
 	else if (UseAuth())
 	{
 		// authenticate the user with the Steam back-end servers
-		EBeginAuthSessionResult const result = SteamGameServer()->BeginAuthSession(message.pToken, message.tokenLen, client.second.steamId);
+		EBeginAuthSessionResult const result = SteamGameServer()->BeginAuthSession(message.token.pData, static_cast<int>(message.token.size), client.second.steamId);
 		if (result != k_EBeginAuthSessionResultOK)
 		{
 			RemoveClient(client.first, EDisconnectReason::ServerReject);
 		}
 	}
-	else
+	else if (HasPassword())
 	{
 		OnAuthCompleted(client, true);
 	}
+	// without auth and password the client is connected already and only announced its capabilities
+}
+
+// Only servers that announce EFeature::EarlyAuth take it, any other client answers SInfo with SBeginAuth later on.
+void CSteamPlayServer::OnReceiveEarlyAuth(TClient& client, Messages::Client::SEarlyAuth const& message)
+{
+	if (!SCapabilities::Negotiate(GetCapabilities(), message.capabilities).Has(EFeature::EarlyAuth))
+	{
+		return;
+	}
+	if (HasPassword() && message.password.empty())
+	{
+		// the client asks its user once it got SInfo
+		return;
+	}
+
+	Messages::Client::SBeginAuth beginAuth;
+	beginAuth.password     = message.password;
+	beginAuth.token        = message.token;
+	beginAuth.capabilities = message.capabilities;
+	OnReceiveBeginAuth(client, beginAuth);
+}
+
+// Everything but the handshake waits until the client passed auth, so it can be sent along with the credentials.
+// Clients that send more than the server holds are rejected, the client is gone then.
+bool CSteamPlayServer::HoldForAuth(TClient& client, TSteamMessageUniquePtr& pSteamMessage)
+{
+	static constexpr size_t s_maxHeldBytes = 1024 * 1024;
+
+	SClientData& data = client.second;
+	if (data.authorized || (!UseAuth() && !HasPassword()))
+	{
+		return false;
+	}
+
+	switch (*static_cast<EMessage const*>(pSteamMessage->GetData()))
+	{
+	case EMessage::ClientBeginAuth:
+	case EMessage::ClientEarlyAuth:
+	case EMessage::ClientTimeRequest:
+	case EMessage::ClientResume:
+		return false;
+	default:
+		break;
+	}
+
+	size_t const size = pSteamMessage->GetSize();
+	if (data.heldForAuthBytes + size > s_maxHeldBytes)
+	{
+		Log::InfoServer("Rejecting client %u, it sent more than %zu bytes before it passed auth.", client.first, s_maxHeldBytes);
+		RemoveClient(client.first, EDisconnectReason::ServerReject);
+		return true;
+	}
+
+	data.heldForAuthBytes += size;
+	data.heldForAuth.push_back(std::move(pSteamMessage));
+	return true;
+}
+
+void CSteamPlayServer::DispatchHeldForAuth(HSteamNetConnection connection)
+{
+	// handlers may remove the client, it is looked up again for every message
+	for (;;)
+	{
+		TClients::iterator const clientIt = m_clients.find(connection);
+		if (clientIt == m_clients.end() || clientIt->second.heldForAuth.empty())
+		{
+			break;
+		}
+
+		TSteamMessageUniquePtr pSteamMessage = std::move(clientIt->second.heldForAuth.front());
+		clientIt->second.heldForAuth.pop_front();
+		clientIt->second.heldForAuthBytes -= pSteamMessage->GetSize();
+		DispatchMessage(*clientIt, std::move(pSteamMessage));
+	}
+}
+
+void CSteamPlayServer::NegotiateCapabilities(TClient& client, SCapabilities const& remote)
+{
+	SCapabilities& capabilities = client.second.capabilities;
+	capabilities = SCapabilities::Negotiate(GetCapabilities(), remote);
+	if (capabilities.Has(EFeature::Lanes) && !SSteamPlayConfig::Get().ConfigureLanes(SteamGameServerNetworkingSockets(), client.first, capabilities))
+	{
+		// the client may still use its lanes, we just send everything on the default one
+		capabilities.features &= ~SCapabilities::s_laneFeatures;
+	}
+	if (capabilities.Has(EFeature::LowLatency))
+	{
+		SteamNetworkingUtils()->SetConnectionConfigValueInt32(client.first, k_ESteamNetworkingConfig_NagleTime, 0);
+	}
+	Log::DebugServer("Client %u uses protocol version %u with features 0x%x.", client.first, capabilities.version, capabilities.features);
 }
 
 void CSteamPlayServer::OnValidateAuthTicketResponse(ValidateAuthTicketResponse_t* pInfo)
@@ -429,8 +882,17 @@ void CSteamPlayServer::OnAuthCompleted(TClient& client, bool success)
 		return;
 	}
 	client.second.authorized = true;
+	ClaimPlayers(client);
 
 	TMessageSender::Send<Messages::Server::SAuthPassed>(client.first, k_nSteamNetworkingSend_Reliable);
+	if (m_standbyServer.IsValid())
+	{
+		SendStandbyHost(client);
+	}
+
+	long long const elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(TClock::now() - client.second.acceptTime).count();
+	Log::InfoServer("Client %u passed auth %lldms after it was accepted, %zu messages waited for it.", client.first, elapsed, client.second.heldForAuth.size());
+	DispatchHeldForAuth(client.first);
 }
 
 DPID CSteamPlayServer::FindEmptyId() const
@@ -446,54 +908,101 @@ DPID CSteamPlayServer::FindEmptyId() const
 	return DPID_UNKNOWN;
 }
 
-void CSteamPlayServer::OnReceiveCreatePlayer(TClient& client, TSteamMessageUniquePtr pSteamMessage)
+TPlayerSlot CSteamPlayServer::AllocatePlayerSlot(DPID id)
 {
-	assert(pSteamMessage != nullptr);
-	Messages::Client::SCreatePlayer& message = *static_cast<Messages::Client::SCreatePlayer*>(pSteamMessage->m_pData);
+	// hand out slots round robin, so a freed slot is not reused while messages for its old player might still be in flight
+	for (size_t i = 0; i < s_maxPlayerSlots; ++i)
+	{
+		TPlayerSlot const slot = static_cast<TPlayerSlot>((m_nextPlayerSlot + i) % s_maxPlayerSlots);
+		if (m_playerSlots[slot] == DPID_UNKNOWN)
+		{
+			m_playerSlots[slot] = id;
+			m_nextPlayerSlot = static_cast<TPlayerSlot>((slot + 1) % s_maxPlayerSlots);
+			return slot;
+		}
+	}
+	return s_invalidPlayerSlot;
+}
 
-	SPlayerData* pPlayerData = nullptr;
+TPlayerSlot CSteamPlayServer::GetKnownSlot(TClient const& client, DPID id) const
+{
+	TPlayers::const_iterator const it = m_players.find(id);
+	if (it != m_players.end() && it->second.slot != s_invalidPlayerSlot && client.second.knownSlots.test(it->second.slot))
+	{
+		return it->second.slot;
+	}
+	return s_invalidPlayerSlot;
+}
+
+DPID CSteamPlayServer::GetSlotPlayer(TPlayerSlot slot) const
+{
+	return slot < s_maxPlayerSlots ? m_playerSlots[slot] : DPID_UNKNOWN;
+}
+
+void CSteamPlayServer::OnReceiveCreatePlayer(TClient& client, Messages::Client::SCreatePlayer const& message)
+{
+	Messages::Server::SCreatePlayerResponse response;
+	response.requestId = message.requestId;
 
 	DPID const id = m_players.size() < m_settings.maxPlayers ? FindEmptyId() : DPID_UNKNOWN;
 	if (id != DPID_UNKNOWN)
 	{
-		pPlayerData = &m_players[id];
-		*pPlayerData = SPlayerData{ client.first, message.szShortName, message.szLongName };
+		SPlayerData& playerData = m_players[id];
+		// data held for a spectator connection has to reach it before it turns into a player connection
+		if (!message.spectator && IsSpectatorClient(client))
+		{
+			FlushSpectatorFeed();
+		}
+
+		playerData = SPlayerData{ client.first, message.shortName, message.longName, AllocatePlayerSlot(id), message.spectator };
+		++(message.spectator ? client.second.spectatorPlayers : client.second.gameplayPlayers);
 
-		for (TClient const& other : m_clients)
+		if (client.second.primaryPlayer == DPID_UNKNOWN && !client.second.primaryPlayerRetired)
 		{
-			if (other.first != client.first)
-			{
-				// should we also send message.pData?
+			client.second.primaryPlayer = id;
+		}
+		SendStandbyPlayer(id, playerData, true);
 
-				TMessageSender::TrySend<Messages::Server::SPlayerCreated>(
-					other.first,
-					k_nSteamNetworkingSend_Reliable,
-					[id, pPlayerData](Messages::Server::SPlayerCreated& message)
+		Messages::Server::SPlayerCreated created;
+		created.dpid      = id;
+		created.slot      = playerData.slot;
+		created.shortName = playerData.shortName;
+		created.longName  = playerData.longName;
+
+		// serialize once and copy the message for every other client
+		if (TSteamMessageUniquePtr pCreated = TMessageSender::Serialize(created))
+		{
+			for (TClient& other : m_clients)
+			{
+				if (other.first != client.first && !other.second.pendingResume)
+				{
+					if (TSteamMessageUniquePtr pCopy = TMessageSender::Copy(*pCreated))
 					{
-						message.dpid = id;
-						pPlayerData->shortName.copyTo(message.szShortName);
-						pPlayerData->longName.copyTo(message.szLongName);
-					});
+						if (TMessageSender::Send(std::move(pCopy), other.first, k_nSteamNetworkingSend_Reliable) && playerData.slot != s_invalidPlayerSlot)
+						{
+							other.second.knownSlots.set(playerData.slot);
+						}
+					}
+				}
 			}
 		}
-	}
 
-	TMessageSender::TrySend<Messages::Server::SCreatePlayerResponse>(
-		client.first,
-		k_nSteamNetworkingSend_Reliable,
-		[id, pPlayerData](Messages::Server::SCreatePlayerResponse& message)
+		response.dpid      = id;
+		response.slot      = playerData.slot;
+		response.shortName = playerData.shortName;
+		response.longName  = playerData.longName;
+
+		if (playerData.slot != s_invalidPlayerSlot)
 		{
-			message.dpid = id;
-			pPlayerData->shortName.copyTo(message.szShortName);
-			pPlayerData->longName.copyTo(message.szLongName);
-		});
+			client.second.knownSlots.set(playerData.slot);
+		}
+	}
+
+	TMessageSender::Send(response, client.first, k_nSteamNetworkingSend_Reliable);
 }
 
-void CSteamPlayServer::OnReceiveDestroyPlayer(TClient& client, TSteamMessageUniquePtr pSteamMessage)
+void CSteamPlayServer::OnReceiveDestroyPlayer(TClient& client, Messages::Client::SDestroyPlayer const& message)
 {
-	assert(pSteamMessage != nullptr);
-	Messages::Client::SDestroyPlayer& message = *static_cast<Messages::Client::SDestroyPlayer*>(pSteamMessage->m_pData);
-
 	if (message.dpid == DPID_ALLPLAYERS)
 	{
 		TPlayers::iterator it = m_players.begin();
@@ -519,67 +1028,1493 @@ void CSteamPlayServer::OnReceiveDestroyPlayer(TClient& client, TSteamMessageUniq
 	}
 }
 
-CSteamPlayServer::TPlayers::iterator CSteamPlayServer::DestroyPlayer(TPlayers::iterator validEntry)
+// Unreliable and without delay, a retransmit or nagle would only add to the round trip the client measures.
+void CSteamPlayServer::OnReceiveTimeRequest(TClient& client, Messages::Client::STimeRequest const& message)
 {
-	assert(validEntry != m_players.end());
-
-	DPID const id = validEntry->first;
-	for (TClient const& client : m_clients)
+	if (!client.second.capabilities.Has(EFeature::ClockSync))
 	{
-		if (client.first != validEntry->second.connection)
-		{
-			TMessageSender::TrySend<Messages::Server::SPlayerDestroyed>(
-				client.first,
-				k_nSteamNetworkingSend_Reliable,
-				[id](Messages::Server::SPlayerDestroyed& message)
-				{
-					message.dpid = id;
-				});
-		}
+		LogRejected(client, Log::ELevel::Warning, "Got a time request without negotiating clock sync.");
+		return;
 	}
 
-	Log::DebugServer("Destroy Player '%u'", validEntry->first);
-	return m_players.erase(validEntry);
+	Messages::Server::STimeResponse response;
+	response.clientTime  = message.clientTime;
+	response.sessionTime = static_cast<uint64>(std::chrono::duration_cast<std::chrono::microseconds>(GetSessionTime()).count());
+	ELane const lane = client.second.capabilities.Has(EFeature::Lanes) ? ELane::High : ELane::Default;
+	TMessageSender::Send(response, client.first, k_nSteamNetworkingSend_UnreliableNoNagle, lane);
 }
 
-void CSteamPlayServer::OnReceiveData(TClient& client, TSteamMessageUniquePtr pSteamMessage)
+void CSteamPlayServer::OnReceiveResume(TClient& client, Messages::Client::SResume const& message)
 {
-	assert(pSteamMessage != nullptr);
-	Messages::Shared::SData& message = *static_cast<Messages::Shared::SData*>(pSteamMessage->m_pData);
+	Messages::Server::SResumeResponse response;
+	client.second.pendingResume = false;
 
-	TPlayers::iterator fromIt = m_players.find(message.from);
-	if (fromIt == m_players.end() || fromIt->second.connection != client.first)
+	TClients::iterator resumedIt = m_clients.begin();
+	while (resumedIt != m_clients.end() && (message.token == 0 || resumedIt->second.resumeToken != message.token || resumedIt->first == client.first))
 	{
-		Log::InfoServer("Got client data with invalid sender id.");
+		++resumedIt;
+	}
+	if (resumedIt == m_clients.end() || resumedIt->second.steamId != client.second.steamId)
+	{
+		LogRejected(client, Log::ELevel::Info, "Client %u tried to resume an unknown session.", client.first);
+		TMessageSender::Send(response, client.first, k_nSteamNetworkingSend_Reliable);
 		return;
 	}
 
-	if (message.to == DPID_ALLPLAYERS)
+	// the old connection may not have noticed the loss yet
+	SuspendClient(*resumedIt);
+
+	NegotiateCapabilities(client, message.capabilities);
+	SCapabilities const& previous = resumedIt->second.capabilities;
+	bool const sameCapabilities = client.second.capabilities.features == previous.features
+		&& client.second.capabilities.maxBatchSize == previous.maxBatchSize
+		&& client.second.capabilities.dictionaryId == previous.dictionaryId;
+	if (!sameCapabilities || !resumedIt->second.replay.CanResume(message.received))
 	{
-		for (TClient& recipient : m_clients)
-		{
-			if (recipient.first != client.first)
-			{
-				if (TSteamMessageUniquePtr pSteamMessageCopy = TMessageSender::Copy(*pSteamMessage))
-				{
-					TMessageSender::Send(std::move(pSteamMessageCopy), recipient.first, pSteamMessage->m_nFlags);
-				}
+		Log::InfoServer("Client %u could not resume the session of client %u, %s.", client.first, resumedIt->first,
+			sameCapabilities ? "messages it did not get were dropped already" : "its capabilities changed");
+		RemoveClient(resumedIt, EDisconnectReason::ClientDisconnect);
+		TMessageSender::Send(response, client.first, k_nSteamNetworkingSend_Reliable);
+		return;
+	}
+
+	response.accepted = true;
+	response.received = resumedIt->second.replay.GetSuspendedReceived();
+
+	// the new connection takes over the state of the session
+	HSteamNetConnection const oldConnection = resumedIt->first;
+	client.second = std::move(resumedIt->second);
+	client.second.suspended = false;
+	m_clients.erase(resumedIt);
+	ReplaceConnection(oldConnection, client.first);
+
+	TMessageSender::Send(response, client.first, k_nSteamNetworkingSend_Reliable);
+
+	CReplayBuffer::TEntries messages;
+	client.second.replay.Resume(message.received, messages);
+	for (CReplayBuffer::SEntry const& entry : messages)
+	{
+		if (TSteamMessageUniquePtr pSteamMessage = TMessageSender::Allocate(entry.data.size()))
+		{
+			memcpy(pSteamMessage->m_pData, entry.data.data(), entry.data.size());
+			TMessageSender::Send(std::move(pSteamMessage), client.first, k_nSteamNetworkingSend_Reliable, static_cast<ELane>(entry.lane));
+		}
+	}
+
+	Log::InfoServer("Client %u resumed the session of client %u, replayed %zu messages.", client.first, oldConnection, messages.size());
+}
+
+bool CSteamPlayServer::HasSuspendedClient(CSteamID steamId) const
+{
+	if (!steamId.IsValid())
+	{
+		return false;
+	}
+
+	for (TClient const& client : m_clients)
+	{
+		if (client.second.suspended && client.second.steamId == steamId)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void CSteamPlayServer::SuspendClient(TClient& client)
+{
+	if (client.second.suspended)
+	{
+		return;
+	}
+
+	uint32 const graceTime = SSteamPlayConfig::Get().resumeGraceTime;
+	SteamGameServerNetworkingSockets()->CloseConnection(client.first, static_cast<int>(EDisconnectReason::ClientResume), nullptr, false);
+	client.second.suspended      = true;
+	client.second.resumeDeadline = TClock::now() + std::chrono::milliseconds(graceTime);
+	client.second.replay.Suspend();
+
+	Log::InfoServer("Client %u lost its connection, keeping its players for %ums.", client.first, graceTime);
+}
+
+// Everything that refers to the client by its connection moves to the new one.
+void CSteamPlayServer::ReplaceConnection(HSteamNetConnection oldConnection, HSteamNetConnection newConnection)
+{
+	for (TPlayer& player : m_players)
+	{
+		if (player.second.connection == oldConnection)
+		{
+			player.second.connection = newConnection;
+		}
+	}
+
+	if (m_standby == oldConnection)
+	{
+		m_standby = newConnection;
+	}
+
+	if (m_lockstep.contributors.erase(oldConnection) > 0)
+	{
+		m_lockstep.contributors.insert(newConnection);
+	}
+	for (SHeldMessage& message : m_lockstep.entries)
+	{
+		if (message.connection == oldConnection)
+		{
+			message.connection = newConnection;
+		}
+	}
+
+	for (SHeldMessage& message : m_spectatorFeed.reliable)
+	{
+		if (message.connection == oldConnection)
+		{
+			message.connection = newConnection;
+		}
+	}
+	for (auto& [key, message] : m_spectatorFeed.unreliable)
+	{
+		if (message.connection == oldConnection)
+		{
+			message.connection = newConnection;
+		}
+	}
+}
+
+void CSteamPlayServer::UpdateSuspendedClients()
+{
+	TClock::time_point const now = TClock::now();
+	for (TClients::iterator it = m_clients.begin(); it != m_clients.end();)
+	{
+		if (it->second.suspended && now >= it->second.resumeDeadline)
+		{
+			Log::InfoServer("Client %u did not resume its session in time.", it->first);
+			it = RemoveClient(it, EDisconnectReason::ClientDisconnect);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
+
+bool CSteamPlayServer::MigratesHost() const
+{
+	return (m_settings.sessionFlags & DPSESSION_MIGRATEHOST) != 0 && SSteamPlayConfig::Get().migrationTimeout > 0;
+}
+
+void CSteamPlayServer::UpdateStandby()
+{
+	if (m_standbyMode)
+	{
+		if (m_takeOver)
+		{
+			TakeOverSession();
+		}
+		return;
+	}
+
+	if (!m_unclaimedPlayers.empty() && TClock::now() >= m_takeOverDeadline)
+	{
+		RemoveUnclaimedPlayers();
+	}
+	if (m_standby == k_HSteamNetConnection_Invalid && MigratesHost())
+	{
+		PickStandby();
+	}
+}
+
+// The standby has to outlive the host, so it is never the client running next to this server.
+void CSteamPlayServer::PickStandby()
+{
+	CSteamID const localUser = SteamUser() ? SteamUser()->GetSteamID() : CSteamID();
+	for (TClient& client : m_clients)
+	{
+		SClientData const& data = client.second;
+		if (!data.authorized || data.suspended || data.pendingResume || data.standbyFailed
+			|| !data.capabilities.Has(EFeature::HostMigration) || data.steamId == localUser)
+		{
+			continue;
+		}
+
+		Messages::Server::SStandbySession session;
+		session.name           = m_settings.name;
+		session.password       = m_settings.password;
+		session.maxPlayers     = static_cast<uint32>(m_settings.maxPlayers);
+		session.lobbyType      = static_cast<uint32>(m_settings.lobbyType);
+		session.sessionFlags   = m_settings.sessionFlags;
+		session.nextPlayerSlot = m_nextPlayerSlot;
+		if (!TMessageSender::Send(session, client.first, k_nSteamNetworkingSend_Reliable))
+		{
+			continue;
+		}
+
+		m_standby      = client.first;
+		m_standbyOwner = data.steamId.ConvertToUint64();
+		for (TPlayer const& player : m_players)
+		{
+			SendStandbyPlayer(player.first, player.second, true);
+		}
+
+		Log::InfoServer("Client %u is the standby host.", client.first);
+		return;
+	}
+}
+
+void CSteamPlayServer::ClearStandby()
+{
+	m_standby      = k_HSteamNetConnection_Invalid;
+	m_standbyOwner = 0;
+	if (m_standbyServer.IsValid())
+	{
+		m_standbyServer = CSteamID();
+		for (TClient const& client : m_clients)
+		{
+			SendStandbyHost(client);
+		}
+	}
+}
+
+void CSteamPlayServer::SendStandbyPlayer(DPID id, SPlayerData const& player, bool added)
+{
+	if (m_standby == k_HSteamNetConnection_Invalid)
+	{
+		return;
+	}
+
+	Messages::Server::SStandbyPlayer message;
+	message.added = added;
+	message.dpid  = id;
+	if (added)
+	{
+		TClients::const_iterator const ownerIt = m_clients.find(player.connection);
+		TUnclaimedPlayers::const_iterator const unclaimedIt = m_unclaimedPlayers.find(id);
+		if (ownerIt != m_clients.end())
+		{
+			message.owner   = ownerIt->second.steamId.ConvertToUint64();
+			message.primary = ownerIt->second.primaryPlayer == id;
+		}
+		else if (unclaimedIt != m_unclaimedPlayers.end())
+		{
+			message.owner   = unclaimedIt->second.owner.ConvertToUint64();
+			message.primary = unclaimedIt->second.primary;
+		}
+		message.slot      = player.slot;
+		message.spectator = player.spectator;
+		message.shortName = player.shortName;
+		message.longName  = player.longName;
+	}
+	TMessageSender::Send(message, m_standby, k_nSteamNetworkingSend_Reliable);
+}
+
+void CSteamPlayServer::SendStandbyHost(TClient const& client)
+{
+	if (!client.second.authorized || client.second.pendingResume || !client.second.capabilities.Has(EFeature::HostMigration))
+	{
+		return;
+	}
+
+	Messages::Server::SStandbyHost message;
+	message.serverId = m_standbyServer.ConvertToUint64();
+	TMessageSender::Send(message, client.first, k_nSteamNetworkingSend_Reliable);
+}
+
+void CSteamPlayServer::OnReceiveStandbyReady(TClient& client, Messages::Client::SStandbyReady const& message)
+{
+	if (client.first != m_standby)
+	{
+		LogRejected(client, Log::ELevel::Warning, "Got a standby server from client %u, which is not the standby host.", client.first);
+		return;
+	}
+
+	if (message.serverId == 0)
+	{
+		Log::InfoServer("Client %u could not start a standby server.", client.first);
+		client.second.standbyFailed = true;
+		ClearStandby();
+		return;
+	}
+
+	m_standbyServer = CSteamID(message.serverId);
+	for (TClient const& other : m_clients)
+	{
+		SendStandbyHost(other);
+	}
+	Log::InfoServer("Client %u keeps server %llu ready to take over the session.", client.first, message.serverId);
+}
+
+// The players of the lost host come back as their owners reconnect, until the migration timeout.
+void CSteamPlayServer::TakeOverSession()
+{
+	SStandbyRoster roster;
+	{
+		std::lock_guard<std::mutex> const lock(m_standbyRosterMutex);
+		roster = m_standbyRoster;
+	}
+
+	for (auto const& [id, player] : roster.players)
+	{
+		m_players[id] = SPlayerData{ k_HSteamNetConnection_Invalid, player.shortName, player.longName, player.slot, player.spectator };
+		if (player.slot != s_invalidPlayerSlot)
+		{
+			m_playerSlots[player.slot] = id;
+		}
+		m_unclaimedPlayers[id] = SUnclaimedPlayer{ player.owner, player.primary };
+	}
+
+	TClock::time_point const now = TClock::now();
+	m_nextPlayerSlot   = roster.nextPlayerSlot;
+	m_takeOverStart    = now;
+	m_takeOverDeadline = now + std::chrono::milliseconds(SSteamPlayConfig::Get().migrationTimeout);
+	m_standbyMode      = false;
+	Log::InfoServer("Took over the session with %zu players.", m_players.size());
+
+	for (auto const& [connection, steamId] : m_heldConnections)
+	{
+		AddClient(connection, steamId);
+	}
+	m_heldConnections.clear();
+}
+
+bool CSteamPlayServer::HasUnclaimedPlayers(CSteamID steamId) const
+{
+	for (auto const& [id, player] : m_unclaimedPlayers)
+	{
+		if (player.owner == steamId)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void CSteamPlayServer::ClaimPlayers(TClient& client)
+{
+	size_t claimed = 0;
+	for (TUnclaimedPlayers::iterator it = m_unclaimedPlayers.begin(); it != m_unclaimedPlayers.end();)
+	{
+		TPlayers::iterator const playerIt = m_players.find(it->first);
+		if (it->second.owner != client.second.steamId || playerIt == m_players.end())
+		{
+			++it;
+			continue;
+		}
+
+		playerIt->second.connection = client.first;
+		++(playerIt->second.spectator ? client.second.spectatorPlayers : client.second.gameplayPlayers);
+		if (it->second.primary)
+		{
+			client.second.primaryPlayer = it->first;
+		}
+		++claimed;
+		it = m_unclaimedPlayers.erase(it);
+	}
+
+	if (claimed == 0)
+	{
+		return;
+	}
+
+	// the client kept its primary player, without one it addresses its players explicitly
+	client.second.primaryPlayerRetired = client.second.primaryPlayer == DPID_UNKNOWN;
+
+	long long const elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(TClock::now() - m_takeOverStart).count();
+	Log::InfoServer("Client %u reclaimed %zu players %lldms after the host was lost.", client.first, claimed, elapsed);
+	if (m_unclaimedPlayers.empty())
+	{
+		Log::InfoServer("All players were reclaimed %lldms after the host was lost.", elapsed);
+	}
+}
+
+void CSteamPlayServer::RemoveUnclaimedPlayers()
+{
+	Log::InfoServer("Removing %zu players whose clients did not follow the host.", m_unclaimedPlayers.size());
+	while (!m_unclaimedPlayers.empty())
+	{
+		TPlayers::iterator const it = m_players.find(m_unclaimedPlayers.begin()->first);
+		m_unclaimedPlayers.erase(m_unclaimedPlayers.begin());
+		if (it != m_players.end())
+		{
+			DestroyPlayer(it);
+		}
+	}
+}
+
+CSteamPlayServer::TPlayers::iterator CSteamPlayServer::DestroyPlayer(TPlayers::iterator validEntry)
+{
+	assert(validEntry != m_players.end());
+
+	ReleasePlayerTraffic(validEntry->first);
+
+	SendStandbyPlayer(validEntry->first, validEntry->second, false);
+	m_unclaimedPlayers.erase(validEntry->first);
+
+	Messages::Server::SPlayerDestroyed message;
+	message.dpid = validEntry->first;
+	for (TClient const& client : m_clients)
+	{
+		if (client.first != validEntry->second.connection && !client.second.pendingResume)
+		{
+			TMessageSender::Send(message, client.first, k_nSteamNetworkingSend_Reliable);
+		}
+	}
+
+	for (TClient& client : m_clients)
+	{
+		client.second.deltaSendStreams.ErasePlayer(validEntry->first);
+		client.second.deltaReceiveStreams.ErasePlayer(validEntry->first);
+		client.second.sequenceFilter.ErasePlayer(validEntry->first);
+		client.second.sequenceCounters.ErasePlayer(validEntry->first);
+		EraseStreamsOfPlayer(client.second.conflated, validEntry->first);
+		client.second.redundantSender.ErasePlayer(validEntry->first);
+		client.second.redundantReceiver.ErasePlayer(validEntry->first);
+	}
+
+	if (validEntry->second.slot != s_invalidPlayerSlot)
+	{
+		m_playerSlots[validEntry->second.slot] = DPID_UNKNOWN;
+		for (TClient& client : m_clients)
+		{
+			client.second.knownSlots.reset(validEntry->second.slot);
+		}
+	}
+
+	TClients::iterator const ownerIt = m_clients.find(validEntry->second.connection);
+	if (ownerIt != m_clients.end())
+	{
+		--(validEntry->second.spectator ? ownerIt->second.spectatorPlayers : ownerIt->second.gameplayPlayers);
+		if (ownerIt->second.primaryPlayer == validEntry->first)
+		{
+			ownerIt->second.primaryPlayer        = DPID_UNKNOWN;
+			ownerIt->second.primaryPlayerRetired = true;
+		}
+	}
+
+	TSenderStats::iterator const statsIt = m_senderStats.find(validEntry->first);
+	if (statsIt != m_senderStats.end())
+	{
+		statsIt->second.Write(validEntry->first);
+		m_senderStats.erase(statsIt);
+	}
+
+	Log::DebugServer("Destroy Player '%u'", validEntry->first);
+	return m_players.erase(validEntry);
+}
+
+void CSteamPlayServer::OnReceiveData(TClient& client, TSteamMessageUniquePtr pSteamMessage)
+{
+	assert(pSteamMessage != nullptr);
+
+	DPID   from;
+	DPID   to;
+	size_t headerSize;
+	bool   compressed = false;
+	bool   delta      = false;
+	bool   sequenced  = false;
+	bool   redundant  = false;
+	uint16 sequence   = 0;
+
+	if (static_cast<SMessage const*>(pSteamMessage->GetData())->GetId() == Messages::Shared::SData::ID)
+	{
+		// the dispatch table checked the size already
+		Messages::Shared::SData const& message = *static_cast<Messages::Shared::SData const*>(pSteamMessage->GetData());
+		from       = message.from;
+		to         = message.to;
+		headerSize = sizeof(Messages::Shared::SData);
+	}
+	else
+	{
+		using EAddress = Messages::Shared::SDataHeader::EAddress;
+
+		Messages::Shared::SDataHeader header;
+		headerSize = header.Read(pSteamMessage->GetData(), pSteamMessage->GetSize());
+		if (headerSize == 0)
+		{
+			LogRejected(client, Log::ELevel::Warning, "Client data header is malformed.");
+			return;
+		}
+
+		from = header.fromMode == EAddress::None ? client.second.primaryPlayer : header.fromMode == EAddress::Slot ? GetSlotPlayer(static_cast<TPlayerSlot>(header.from)) : header.from;
+		to   = header.toMode == EAddress::Slot ? GetSlotPlayer(static_cast<TPlayerSlot>(header.to)) : header.to;
+		compressed = (header.flags & Messages::Shared::SDataHeader::s_flagCompressed) != 0;
+		delta      = (header.flags & Messages::Shared::SDataHeader::s_flagDelta) != 0;
+		sequenced  = (header.flags & Messages::Shared::SDataHeader::s_flagSequenced) != 0;
+		redundant  = (header.flags & Messages::Shared::SDataHeader::s_flagRedundant) != 0;
+		sequence   = header.sequence;
+	}
+
+	SCapabilities const& capabilities = client.second.capabilities;
+	int const            flags        = pSteamMessage->m_nFlags;
+	ELane const          lane         = pSteamMessage->m_idxLane < static_cast<uint16>(ELane::Count) + s_unorderedLanes ? static_cast<ELane>(pSteamMessage->m_idxLane) : ELane::Default;
+	bool const           reliable     = (flags & k_nSteamNetworkingSend_Reliable) != 0;
+	if ((compressed && !capabilities.Has(EFeature::Compression)) || (delta && (compressed || !capabilities.Has(EFeature::Delta)))
+		|| (sequenced && (reliable || delta || !capabilities.Has(EFeature::Sequenced)))
+		|| (redundant && (reliable || delta || compressed || sequenced || !capabilities.Has(EFeature::Redundancy))))
+	{
+		LogRejected(client, Log::ELevel::Warning, "Got client data with payload flags that were not negotiated.");
+		return;
+	}
+
+	SRelayPayload payload;
+	payload.pData        = static_cast<char const*>(pSteamMessage->GetData()) + headerSize;
+	payload.size         = pSteamMessage->GetSize() - headerSize;
+	payload.compressed   = compressed;
+	payload.dictionaryId = capabilities.dictionaryId;
+	payload.rawSize      = payload.size;
+	payload.sequenced    = sequenced;
+	if (compressed && CLZCodec::ReadPayloadSize(payload.pData, payload.size, payload.rawSize) == 0)
+	{
+		LogRejected(client, Log::ELevel::Warning, "Client data has a malformed compressed payload.");
+		return;
+	}
+
+	// the delta state only holds streams between existing players, spoofed ids must not add to it
+	TPlayers::iterator fromIt = m_players.find(from);
+	if (fromIt == m_players.end() || fromIt->second.connection != client.first)
+	{
+		LogRejected(client, Log::ELevel::Info, "Got client data with invalid sender id.");
+		return;
+	}
+	if (to != DPID_ALLPLAYERS && !m_players.contains(to))
+	{
+		LogRejected(client, Log::ELevel::Info, "Could not find client data recipient with player id %u.", to);
+		return;
+	}
+
+	// delta streams have to follow every payload of the client, even ones that are not relayed
+	if (delta)
+	{
+		uint8 const* pDecoded = reliable ? client.second.deltaReceiveStreams.Decode(from, to, lane, payload.pData, payload.size, payload.rawSize) : nullptr;
+		if (!pDecoded)
+		{
+			LogRejected(client, Log::ELevel::Info, "Dropped client data from %u, its delta could not be applied.", from);
+			return;
+		}
+		payload.pData = pDecoded;
+		payload.size  = payload.rawSize;
+	}
+	else if (!compressed && capabilities.Has(EFeature::Delta) && CDeltaStreams::IsEligible(payload.size, flags))
+	{
+		client.second.deltaReceiveStreams.Store(from, to, lane, payload.pData, payload.size);
+	}
+
+	// obsolete values are not worth relaying
+	if (sequenced && !client.second.sequenceFilter.Accept(SStreamKey{ from, to, lane }, sequence))
+	{
+		return;
+	}
+
+	// delta streams follow the lane the data arrived on, recipients get it on a lane of their own
+	ELane const relayLane = SSteamPlayConfig::GetLogicalLane(lane);
+	if (!redundant)
+	{
+		RelayToRecipients(client, from, to, payload, flags, relayLane);
+		return;
+	}
+
+	// payloads the server missed are recovered here, recipients get repeated payloads of their own streams
+	if (!client.second.redundantReceiver.Receive(SStreamKey{ from, to, lane }, sequence, payload.pData, payload.size, m_redundantPayloads))
+	{
+		LogRejected(client, Log::ELevel::Warning, "Client data has malformed redundant payloads.");
+		return;
+	}
+	for (CRedundantReceiver::SPayload const& redundantPayload : m_redundantPayloads)
+	{
+		SRelayPayload relayPayload;
+		relayPayload.pData        = redundantPayload.pData;
+		relayPayload.size         = redundantPayload.size;
+		relayPayload.compressed   = false;
+		relayPayload.dictionaryId = capabilities.dictionaryId;
+		relayPayload.rawSize      = redundantPayload.size;
+		RelayToRecipients(client, from, to, relayPayload, flags, relayLane);
+	}
+}
+
+void CSteamPlayServer::RelayToRecipients(TClient& client, DPID from, DPID to, SRelayPayload& payload, int flags, ELane relayLane)
+{
+	// spectators only reach each other, they never add to the fan-out of the players
+	bool const fromSpectator = IsSpectator(from);
+	bool const feed          = HasSpectatorFeed();
+
+	// other reliable data of a client on the lockstep lane waits until its commands went out, so it keeps its order
+	if (!fromSpectator && IsLockstep() && (flags & k_nSteamNetworkingSend_Reliable) && relayLane == SSteamPlayConfig::Get().lockstepLane)
+	{
+		if (to == DPID_ALLPLAYERS)
+		{
+			HoldTurnData(client, from, payload, flags, relayLane);
+			return;
+		}
+		if (m_lockstep.contributors.contains(client.first))
+		{
+			CloseTurn(false);
+		}
+	}
+
+	if (to == DPID_ALLPLAYERS)
+	{
+		bool spectators = false;
+		for (TClient& recipient : m_clients)
+		{
+			bool const spectatorRecipient = IsSpectatorClient(recipient);
+			if (recipient.first == client.first || (fromSpectator && !spectatorRecipient))
+			{
+				continue;
+			}
+
+			if (feed && spectatorRecipient)
+			{
+				spectators = true;
 			}
+			else
+			{
+				RelayData(recipient, from, to, payload, flags, relayLane);
+			}
+		}
+
+		if (spectators)
+		{
+			FeedSpectators(client.first, from, to, payload, flags, relayLane);
+		}
+	}
+	else
+	{
+		TPlayers::iterator toIt = m_players.find(to);
+		TClients::iterator recipientIt = toIt != m_players.end() ? m_clients.find(toIt->second.connection) : m_clients.end();
+		if (recipientIt != m_clients.end())
+		{
+			bool const spectatorRecipient = IsSpectatorClient(*recipientIt);
+			if (fromSpectator && !spectatorRecipient)
+			{
+				LogRejected(client, Log::ELevel::Info, "Dropped data from spectator %u to player %u.", from, to);
+			}
+			else if (feed && spectatorRecipient)
+			{
+				FeedSpectators(client.first, from, to, payload, flags, relayLane);
+			}
+			else
+			{
+				RelayData(*recipientIt, from, to, payload, flags, relayLane);
+			}
+		}
+		else
+		{
+			LogRejected(client, Log::ELevel::Info, "Could not find client data recipient with player id %u.", to);
+		}
+	}
+}
+
+// Reassembled messages are relayed like any other, they are fragmented again for recipients that need it.
+void CSteamPlayServer::OnReceiveDataFragment(TClient& client, TSteamMessageUniquePtr pSteamMessage)
+{
+	assert(pSteamMessage != nullptr);
+
+	if (!client.second.capabilities.Has(EFeature::Fragmentation))
+	{
+		LogRejected(client, Log::ELevel::Warning, "Got a client data fragment without negotiating fragmentation.");
+		return;
+	}
+
+	TSteamMessageUniquePtr pComplete;
+	if (!client.second.fragments.Add(*pSteamMessage, SSteamPlayConfig::Get().maxMessageSize, pComplete))
+	{
+		LogRejected(client, Log::ELevel::Warning, "Dropped a client data transfer, a fragment was malformed or out of order.");
+		return;
+	}
+
+	if (pComplete)
+	{
+		OnReceiveData(client, std::move(pComplete));
+	}
+}
+
+// Unreliable data for a congested client only replaces what is already held for its stream,
+// more messages would just queue up behind each other or get dropped by steam at random.
+bool CSteamPlayServer::RelayData(TClient& recipient, DPID from, DPID to, SRelayPayload& payload, int flags, ELane lane)
+{
+	SClientData& client = recipient.second;
+	if ((flags & k_nSteamNetworkingSend_Reliable) || !client.congested)
+	{
+		return SendData(recipient, from, to, payload, flags, lane);
+	}
+
+	auto const [it, inserted] = client.conflated.try_emplace(SStreamKey{ from, to, lane });
+	it->second.Hold(payload, flags);
+
+	++client.conflationHeld;
+	if (!inserted)
+	{
+		++client.conflationReplaced;
+	}
+	return true;
+}
+
+// Data goes to steam right away as long as the recipient has budget left this tick and nothing queued,
+// otherwise it waits for RunScheduler, which shares the budget fairly between the senders.
+bool CSteamPlayServer::SendData(TClient& recipient, DPID from, DPID to, SRelayPayload& payload, int flags, ELane lane)
+{
+	SClientData&  client = recipient.second;
+	SSenderStats& stats  = m_senderStats[from];
+	if (client.activeSenders.empty() && client.sendBudget > 0 && HasSenderBudget(stats))
+	{
+		client.sendBudget -= static_cast<int64>(payload.size);
+		stats.tickBytes   += payload.size;
+		stats.bytes       += payload.size;
+		++stats.messages;
+		return TransmitData(recipient, from, to, payload, flags, lane);
+	}
+
+	// the payload is copied once, no matter how many recipients queue it
+	if (!payload.pHeld)
+	{
+		std::shared_ptr<SHeldPayload> pHeld = std::make_shared<SHeldPayload>();
+		pHeld->Hold(payload, flags);
+		payload.pHeld = std::move(pHeld);
+	}
+
+	SSenderQueue& queue = client.senderQueues[from];
+	if (queue.messages.empty())
+	{
+		client.activeSenders.push_back(from);
+	}
+	queue.messages.push_back(SQueuedMessage{ to, lane, flags, payload.pHeld, TClock::now() });
+	++stats.queued;
+	return true;
+}
+
+bool CSteamPlayServer::TransmitData(TClient& recipient, DPID from, DPID to, SRelayPayload& payload, int flags, ELane lane)
+{
+	SCapabilities const& capabilities = recipient.second.capabilities;
+	if (!capabilities.Has(EFeature::Lanes))
+	{
+		lane = ELane::Default;
+	}
+	lane = SSteamPlayConfig::GetStreamLane(capabilities, lane, from, to, flags);
+	if (capabilities.Has(EFeature::LowLatency))
+	{
+		flags |= k_nSteamNetworkingSend_NoNagle;
+	}
+
+	// sequenced data takes precedence over repeating unreliable payloads
+	bool const sequenced = payload.sequenced && capabilities.Has(EFeature::Sequenced);
+	bool const redundant = !sequenced && !(flags & k_nSteamNetworkingSend_Reliable) && capabilities.Has(EFeature::Redundancy);
+
+	// compressed payloads are passed on as they are if the recipient uses the same dictionary
+	bool const deltaStream       = capabilities.Has(EFeature::Delta) && CDeltaStreams::IsEligible(payload.rawSize, flags);
+	bool const forwardCompressed = !deltaStream && !redundant && payload.compressed && capabilities.Has(EFeature::Compression) && capabilities.dictionaryId == payload.dictionaryId;
+
+	void const* pPayload    = payload.pData;
+	size_t      payloadSize = payload.size;
+	if (payload.compressed && !forwardCompressed)
+	{
+		if (!DecompressRelayPayload(payload))
+		{
+			return false;
+		}
+		pPayload    = payload.pRawData;
+		payloadSize = payload.rawSize;
+	}
+
+	bool delta = false;
+	if (deltaStream)
+	{
+		delta = recipient.second.deltaSendStreams.Encode(from, to, lane, pPayload, payloadSize, m_deltaBuffer);
+		if (delta)
+		{
+			pPayload    = m_deltaBuffer.data();
+			payloadSize = m_deltaBuffer.size();
+		}
+	}
+
+	uint8  header[(std::max)(sizeof(Messages::Shared::SData), Messages::Shared::SDataHeader::s_maxSize)];
+	size_t headerSize;
+	if (capabilities.Has(EFeature::CompactHeader))
+	{
+		// other lanes may overtake the control messages that told the client about a slot
+		bool const useSlots = lane == ELane::Default;
+
+		Messages::Shared::SDataHeader compactHeader;
+		compactHeader.SetTo(to, useSlots ? GetKnownSlot(recipient, to) : s_invalidPlayerSlot);
+		compactHeader.SetFrom(from, useSlots ? GetKnownSlot(recipient, from) : s_invalidPlayerSlot, false);
+		if (forwardCompressed)
+		{
+			compactHeader.flags |= Messages::Shared::SDataHeader::s_flagCompressed;
+		}
+		if (delta)
+		{
+			compactHeader.flags |= Messages::Shared::SDataHeader::s_flagDelta;
+		}
+		if (sequenced)
+		{
+			compactHeader.flags   |= Messages::Shared::SDataHeader::s_flagSequenced;
+			compactHeader.sequence = recipient.second.sequenceCounters.Next(SStreamKey{ from, to, lane });
+		}
+		else if (redundant)
+		{
+			SSteamPlayConfig const& config = SSteamPlayConfig::Get();
+			compactHeader.flags |= Messages::Shared::SDataHeader::s_flagRedundant;
+			size_t const maxSize = config.redundancyMaxSize > compactHeader.GetSize() ? config.redundancyMaxSize - compactHeader.GetSize() : 0;
+			compactHeader.sequence = recipient.second.redundantSender.Encode(SStreamKey{ from, to, lane }, pPayload, payloadSize, config.redundancyDepth, maxSize, m_redundancyBuffer);
+			pPayload    = m_redundancyBuffer.data();
+			payloadSize = m_redundancyBuffer.size();
+		}
+		headerSize = compactHeader.Write(header);
+	}
+	else
+	{
+		Messages::Shared::SData legacyHeader;
+		legacyHeader.from = from;
+		legacyHeader.to   = to;
+		headerSize = sizeof(legacyHeader);
+		memcpy(header, &legacyHeader, headerSize);
+	}
+
+	if (BundleData(recipient, from, to, header, headerSize, pPayload, payloadSize, flags, lane))
+	{
+		return true;
+	}
+
+	SSteamPlayConfig const& config = SSteamPlayConfig::Get();
+	size_t const messageSize = headerSize + payloadSize;
+
+	bool sent;
+	if (config.ShouldFragment(capabilities, messageSize, flags))
+	{
+		ELane const fragmentLane = SSteamPlayConfig::GetFragmentLane(capabilities, lane);
+		sent = TMessageSender::SendFragments(header, headerSize, pPayload, payloadSize, recipient.first, fragmentLane, recipient.second.nextTransferId++, config.fragmentSize);
+	}
+	else
+	{
+		sent = TMessageSender::SendData(header, headerSize, pPayload, payloadSize, recipient.first, flags, lane);
+	}
+
+	if (!sent)
+	{
+		recipient.second.deltaSendStreams.Clear();
+		return false;
+	}
+	return true;
+}
+
+// Decompresses a relayed payload into m_sendDataBuf, only the first recipient that needs it pays for this.
+bool CSteamPlayServer::DecompressRelayPayload(SRelayPayload& payload)
+{
+	if (payload.pRawData)
+	{
+		return true;
+	}
+
+	// the sender only uses a dictionary if it has the same one as we do
+	CLZDictionary const* pDictionary = payload.dictionaryId != 0 ? SSteamPlayConfig::Get().pDictionary.get() : nullptr;
+
+	m_sendDataBuf.resize(payload.rawSize);
+	if (!CLZCodec::DecompressPayload(payload.pData, payload.size, m_sendDataBuf.data(), payload.rawSize, pDictionary, m_compressionStats))
+	{
+		Log::WarnServer("Failed to decompress client data.");
+		return false;
+	}
+
+	payload.pRawData = m_sendDataBuf.data();
+	return true;
+}
+
+bool CSteamPlayServer::BundleData(TClient& recipient, DPID from, DPID to, void const* pHeader, size_t headerSize, void const* pPayload, size_t payloadSize, int flags, ELane lane)
+{
+	using Messages::Server::SDataBundle;
+
+	SClientData& client = recipient.second;
+	size_t const entrySize = SDataBundle::GetEntrySize(headerSize + payloadSize);
+
+	// flush first if the message does not fit, so data keeps its order even when it bypasses the bundle
+	if (!client.bundle.empty() && (client.bundleFlags != flags || client.bundleLane != lane || client.bundle.size() + entrySize > client.capabilities.maxBatchSize))
+	{
+		FlushBundle(recipient);
+	}
+
+	if (!client.capabilities.Has(EFeature::Batching) || sizeof(EMessage) + entrySize > client.capabilities.maxBatchSize)
+	{
+		return false;
+	}
+
+	if (client.bundle.empty())
+	{
+		client.bundleFlags    = flags;
+		client.bundleLane     = lane;
+		// low latency sessions do not hold data past the end of the tick
+		uint32 const bundleDelay = client.capabilities.Has(EFeature::LowLatency) ? 0 : SSteamPlayConfig::Get().bundleDelay;
+		client.bundleDeadline = TClock::now() + std::chrono::microseconds(bundleDelay);
+	}
+
+	SDataBundle::Append(client.bundle, pHeader, headerSize, pPayload, payloadSize);
+	client.bundlePlayers.push_back(from);
+	client.bundlePlayers.push_back(to);
+	++client.bundleEntries;
+	return true;
+}
+
+void CSteamPlayServer::FlushBundle(TClient& recipient)
+{
+	SClientData& client = recipient.second;
+	if (client.bundle.empty())
+	{
+		return;
+	}
+
+	// a single message is sent as it is, without the bundle around it
+	size_t offset = 0;
+	size_t size   = client.bundle.size();
+	if (client.bundleEntries == 1)
+	{
+		Messages::Server::SDataBundle::ForEach(client.bundle.data(), client.bundle.size(), [&offset, &size](size_t entryOffset, size_t entrySize)
+		{
+			offset = entryOffset;
+			size   = entrySize;
+		});
+	}
+
+	if (!TMessageSender::SendData(client.bundle.data() + offset, size, nullptr, 0, recipient.first, client.bundleFlags, client.bundleLane))
+	{
+		// the client did not get these payloads, start over with keyframes
+		client.deltaSendStreams.Clear();
+	}
+
+	client.bundle.clear();
+	client.bundlePlayers.clear();
+	client.bundleEntries = 0;
+}
+
+void CSteamPlayServer::FlushBundles()
+{
+	TClock::time_point const now = TClock::now();
+	for (TClient& client : m_clients)
+	{
+		if (client.second.bundleDeadline <= now)
+		{
+			FlushBundle(client);
+		}
+	}
+}
+
+bool CSteamPlayServer::IsLockstep() const
+{
+	return SSteamPlayConfig::Get().lockstepMaxTurnTime > 0;
+}
+
+// Reliable broadcasts on the lockstep lane are the commands of deterministic lockstep games, instead of relaying each
+// one to every other client the server collects them per turn and sends them out together once the turn closes.
+// Only clients with EFeature::Batching get them in a single bundle, the others still get one message per command.
+void CSteamPlayServer::HoldTurnData(TClient& client, DPID from, SRelayPayload const& payload, int flags, ELane lane)
+{
+	if (m_lockstep.entries.empty())
+	{
+		m_lockstep.deadline = TClock::now() + GetTurnTime();
+	}
+
+	SHeldMessage& entry = m_lockstep.entries.emplace_back();
+	entry.connection = client.first;
+	entry.from       = from;
+	entry.to         = DPID_ALLPLAYERS;
+	entry.lane       = lane;
+	entry.payload.Hold(payload, flags);
+	m_lockstep.contributors.insert(client.first);
+	++m_lockstep.commands;
+
+	if (IsTurnComplete())
+	{
+		CloseTurn(true);
+	}
+}
+
+// Players whose client lost its connection or did not follow a new host yet cannot send commands, turns do not wait for them.
+bool CSteamPlayServer::IsTurnComplete() const
+{
+	for (TPlayer const& player : m_players)
+	{
+		if (player.second.spectator || m_lockstep.contributors.contains(player.second.connection) || m_unclaimedPlayers.contains(player.first))
+		{
+			continue;
+		}
+
+		TClients::const_iterator const clientIt = m_clients.find(player.second.connection);
+		if (clientIt != m_clients.end() && !clientIt->second.suspended && !clientIt->second.pendingResume)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// The commands of one turn arrive within about a round trip of the slowest client.
+TClock::duration CSteamPlayServer::GetTurnTime() const
+{
+	SSteamPlayConfig const& config = SSteamPlayConfig::Get();
+
+	uint32 slowestPing = 0;
+	for (TClient const& client : m_clients)
+	{
+		SteamNetConnectionRealTimeStatus_t status;
+		if (SteamGameServerNetworkingSockets()->GetConnectionRealTimeStatus(client.first, &status, 0, nullptr) == k_EResultOK && status.m_nPing > 0)
+		{
+			slowestPing = (std::max)(slowestPing, static_cast<uint32>(status.m_nPing));
+		}
+	}
+	return std::chrono::milliseconds(std::clamp(slowestPing, config.lockstepMinTurnTime, config.lockstepMaxTurnTime));
+}
+
+void CSteamPlayServer::CloseTurn(bool complete)
+{
+	if (m_lockstep.entries.empty())
+	{
+		return;
+	}
+
+	// commands go out in the order they arrived
+	for (SHeldMessage const& entry : m_lockstep.entries)
+	{
+		RelayTurnEntry(entry);
+	}
+	for (TClient& recipient : m_clients)
+	{
+		FlushBundle(recipient);
+	}
+
+	++m_lockstep.turns;
+	m_lockstep.completeTurns += complete ? 1 : 0;
+	m_lockstep.entries.clear();
+	m_lockstep.contributors.clear();
+}
+
+// Clients do not get their own commands back.
+void CSteamPlayServer::RelayTurnEntry(SHeldMessage const& entry)
+{
+	SRelayPayload payload = entry.payload.GetPayload();
+	bool const feed = HasSpectatorFeed();
+	bool spectators = false;
+	for (TClient& recipient : m_clients)
+	{
+		if (recipient.first == entry.connection)
+		{
+			continue;
+		}
+
+		if (feed && IsSpectatorClient(recipient))
+		{
+			spectators = true;
+		}
+		else
+		{
+			SendData(recipient, entry.from, entry.to, payload, entry.payload.flags, entry.lane);
 		}
 	}
+
+	if (spectators)
+	{
+		FeedSpectators(entry.connection, entry.from, entry.to, payload, entry.payload.flags, entry.lane);
+	}
+}
+
+void CSteamPlayServer::UpdateLockstep()
+{
+	if (!m_lockstep.entries.empty() && m_lockstep.deadline <= TClock::now())
+	{
+		CloseTurn(false);
+	}
+}
+
+bool CSteamPlayServer::HasSpectatorFeed() const
+{
+	return SSteamPlayConfig::Get().spectatorRate > 0;
+}
+
+bool CSteamPlayServer::IsSpectator(DPID id) const
+{
+	TPlayers::const_iterator const it = m_players.find(id);
+	return it != m_players.end() && it->second.spectator;
+}
+
+bool CSteamPlayServer::IsSpectatorClient(TClient const& client) const
+{
+	return client.second.spectatorPlayers > 0 && client.second.gameplayPlayers == 0;
+}
+
+// Spectator connections share one feed, a message is held once no matter how many of them there are.
+// Unreliable data only keeps the newest message per stream until the next update.
+void CSteamPlayServer::FeedSpectators(HSteamNetConnection sender, DPID from, DPID to, SRelayPayload const& payload, int flags, ELane lane)
+{
+	SHeldMessage* pMessage;
+	if (flags & k_nSteamNetworkingSend_Reliable)
+	{
+		pMessage = &m_spectatorFeed.reliable.emplace_back();
+	}
 	else
 	{
-		TPlayers::iterator toIt = m_players.find(message.to);
-		if (toIt != m_players.end())
+		auto const [it, inserted] = m_spectatorFeed.unreliable.try_emplace(SStreamKey{ from, to, lane });
+		m_spectatorFeed.replaced += inserted ? 0 : 1;
+		pMessage = &it->second;
+	}
+
+	pMessage->connection = sender;
+	pMessage->from       = from;
+	pMessage->to         = to;
+	pMessage->lane       = lane;
+	pMessage->payload.Hold(payload, flags);
+	++m_spectatorFeed.held;
+}
+
+void CSteamPlayServer::SendFeedMessage(TClient& recipient, SHeldMessage const& message)
+{
+	if (message.connection == recipient.first)
+	{
+		return;
+	}
+	if (message.to != DPID_ALLPLAYERS)
+	{
+		TPlayers::const_iterator const toIt = m_players.find(message.to);
+		if (toIt == m_players.end() || toIt->second.connection != recipient.first)
+		{
+			return;
+		}
+	}
+
+	SRelayPayload payload = message.payload.GetPayload();
+	RelayData(recipient, message.from, message.to, payload, message.payload.flags, message.lane);
+}
+
+void CSteamPlayServer::FlushSpectatorFeed()
+{
+	if (m_spectatorFeed.reliable.empty() && m_spectatorFeed.unreliable.empty())
+	{
+		return;
+	}
+
+	for (TClient& recipient : m_clients)
+	{
+		if (!IsSpectatorClient(recipient))
+		{
+			continue;
+		}
+
+		for (SHeldMessage const& message : m_spectatorFeed.reliable)
+		{
+			SendFeedMessage(recipient, message);
+		}
+		for (auto const& [key, message] : m_spectatorFeed.unreliable)
+		{
+			SendFeedMessage(recipient, message);
+		}
+		FlushBundle(recipient);
+	}
+
+	++m_spectatorFeed.updates;
+	m_spectatorFeed.reliable.clear();
+	m_spectatorFeed.unreliable.clear();
+}
+
+void CSteamPlayServer::UpdateSpectatorFeed()
+{
+	uint32 const rate = SSteamPlayConfig::Get().spectatorRate;
+	TClock::time_point const now = TClock::now();
+	if (rate == 0 || now < m_spectatorFeed.nextFlush)
+	{
+		return;
+	}
+
+	m_spectatorFeed.nextFlush = now + std::chrono::duration_cast<TClock::duration>(std::chrono::seconds(1)) / rate;
+	FlushSpectatorFeed();
+}
+
+// Each recipient may hand steam what it sends within the send queue time, like the client's send queue.
+void CSteamPlayServer::StartSchedulerTick()
+{
+	uint32 const queueTime = SSteamPlayConfig::Get().sendQueueTime;
+	for (TClient& client : m_clients)
+	{
+		SteamNetConnectionRealTimeStatus_t status;
+		if (SteamGameServerNetworkingSockets()->GetConnectionRealTimeStatus(client.first, &status, 0, nullptr) != k_EResultOK)
+		{
+			client.second.sendBudget = SSteamPlayConfig::s_minSendWindow;
+			continue;
+		}
+
+		int64 const budget  = static_cast<int64>(SSteamPlayConfig::GetSendWindow(status, queueTime));
+		int64 const pending = static_cast<int64>(SSteamPlayConfig::GetPendingBytes(status));
+		client.second.sendBudget = budget - pending;
+	}
+
+	for (auto& [sender, stats] : m_senderStats)
+	{
+		stats.tickBytes = 0;
+	}
+}
+
+bool CSteamPlayServer::HasSenderBudget(SSenderStats const& stats) const
+{
+	uint32 const senderRate = SSteamPlayConfig::Get().schedulerSenderRate;
+	return senderRate == 0 || stats.tickBytes < senderRate / TicksPerSecond;
+}
+
+// Deficit round robin over the senders queued for a recipient. Every round a sender may send another quantum of bytes,
+// a message larger than that waits until enough rounds added up. The recipient's budget may be overdrawn by the last
+// message, steam then reports it as pending in the next tick.
+void CSteamPlayServer::RunScheduler(TClient& recipient)
+{
+	SSteamPlayConfig const& config = SSteamPlayConfig::Get();
+	TClock::time_point const now = TClock::now();
+	TClock::duration const maxUnreliableDelay = std::chrono::milliseconds(config.sendQueueTime);
+
+	SClientData& client = recipient.second;
+	size_t blocked = 0; // senders in a row that are out of budget
+	while (!client.activeSenders.empty() && client.sendBudget > 0 && blocked < client.activeSenders.size())
+	{
+		DPID const sender = client.activeSenders.front();
+		client.activeSenders.pop_front();
+
+		SSenderQueue& queue = client.senderQueues[sender];
+		SSenderStats& stats = m_senderStats[sender];
+		if (!HasSenderBudget(stats))
+		{
+			client.activeSenders.push_back(sender);
+			++blocked;
+			continue;
+		}
+		blocked = 0;
+
+		queue.deficit += config.schedulerQuantum;
+		while (!queue.messages.empty())
+		{
+			SQueuedMessage& message = queue.messages.front();
+			TClock::duration const waited = now - message.queued;
+			if (!(message.flags & k_nSteamNetworkingSend_Reliable) && waited > maxUnreliableDelay)
+			{
+				++stats.expired;
+				queue.messages.pop_front();
+				continue;
+			}
+
+			int64 const size = static_cast<int64>(message.pPayload->data.size());
+			if (size > queue.deficit || client.sendBudget <= 0 || !HasSenderBudget(stats))
+			{
+				break;
+			}
+
+			queue.deficit      -= size;
+			client.sendBudget  -= size;
+			stats.tickBytes    += static_cast<size_t>(size);
+			stats.bytes        += static_cast<uint64>(size);
+			stats.queueTime    += waited;
+			stats.maxQueueTime  = (std::max)(stats.maxQueueTime, waited);
+			++stats.messages;
+
+			SRelayPayload payload = message.pPayload->GetPayload();
+			TransmitData(recipient, sender, message.to, payload, message.flags, message.lane);
+			queue.messages.pop_front();
+		}
+
+		if (queue.messages.empty())
 		{
-			TMessageSender::Send(std::move(pSteamMessage), toIt->second.connection, pSteamMessage->m_nFlags);
+			client.senderQueues.erase(sender);
 		}
 		else
 		{
-			Log::InfoServer("Could not find client data recipient with player id %u.", message.to);
+			client.activeSenders.push_back(sender);
+		}
+	}
+}
+
+void CSteamPlayServer::RunScheduler()
+{
+	for (TClient& client : m_clients)
+	{
+		RunScheduler(client);
+	}
+}
+
+// Everything a player sent has to reach the others before they learn it is gone and its slot is given to another one.
+// Data still queued for the player is left alone, its header is written when it is sent and then carries the full id.
+void CSteamPlayServer::ReleasePlayerTraffic(DPID player)
+{
+	// its commands go out ahead of the turn, the turn itself keeps waiting for the other players
+	std::vector<SHeldMessage>::iterator const turnEnd = std::stable_partition(m_lockstep.entries.begin(), m_lockstep.entries.end(),
+		[player](SHeldMessage const& entry) { return entry.from != player; });
+	for (std::vector<SHeldMessage>::iterator it = turnEnd; it != m_lockstep.entries.end(); ++it)
+	{
+		RelayTurnEntry(*it);
+	}
+	m_lockstep.entries.erase(turnEnd, m_lockstep.entries.end());
+	if (m_lockstep.entries.empty())
+	{
+		m_lockstep.contributors.clear();
+	}
+
+	auto const isPlayerFeed = [player](SHeldMessage const& message) { return message.from == player || message.to == player; };
+	for (TClient& recipient : m_clients)
+	{
+		if (!IsSpectatorClient(recipient))
+		{
+			continue;
+		}
+
+		for (SHeldMessage const& message : m_spectatorFeed.reliable)
+		{
+			if (isPlayerFeed(message))
+			{
+				SendFeedMessage(recipient, message);
+			}
+		}
+		for (auto const& [key, message] : m_spectatorFeed.unreliable)
+		{
+			if (isPlayerFeed(message))
+			{
+				SendFeedMessage(recipient, message);
+			}
+		}
+	}
+	std::erase_if(m_spectatorFeed.reliable, isPlayerFeed);
+	EraseStreamsOfPlayer(m_spectatorFeed.unreliable, player);
+
+	for (TClient& recipient : m_clients)
+	{
+		SClientData& client = recipient.second;
+		auto const queueIt = client.senderQueues.find(player);
+		if (queueIt != client.senderQueues.end())
+		{
+			for (SQueuedMessage const& message : queueIt->second.messages)
+			{
+				client.sendBudget -= static_cast<int64>(message.pPayload->data.size());
+				SRelayPayload payload = message.pPayload->GetPayload();
+				TransmitData(recipient, player, message.to, payload, message.flags, message.lane);
+			}
+			client.senderQueues.erase(queueIt);
+			std::erase(client.activeSenders, player);
+		}
+
+		// bundled headers may use the player's slot
+		if (std::find(client.bundlePlayers.begin(), client.bundlePlayers.end(), player) != client.bundlePlayers.end())
+		{
+			FlushBundle(recipient);
+		}
+	}
+}
+
+void CSteamPlayServer::SSenderStats::Write(DPID sender) const
+{
+	if (messages == 0)
+	{
+		return;
+	}
+
+	using std::chrono::duration_cast;
+	using std::chrono::microseconds;
+	long long const averageQueueTime = queued > 0 ? static_cast<long long>(duration_cast<microseconds>(queueTime).count() / static_cast<long long>(queued)) : 0;
+	Log::InfoServer("Relayed %llu messages with %llu bytes from %u, %llu were queued for %lldus on average and %lldus at most, %llu expired.",
+		messages, bytes, sender, queued, averageQueueTime, static_cast<long long>(duration_cast<microseconds>(maxQueueTime).count()), expired);
+}
+
+void CSteamPlayServer::UpdateConflation()
+{
+	uint32 const queueTime = SSteamPlayConfig::Get().conflationQueueTime;
+	if (queueTime == 0)
+	{
+		return;
+	}
+
+	for (TClient& client : m_clients)
+	{
+		bool const congested = IsCongested(client.first, queueTime);
+		if (congested != client.second.congested)
+		{
+			Log::DebugServer(congested ? "Client %u is congested, conflating its unreliable data." : "Client %u caught up.", client.first);
+			client.second.congested = congested;
+		}
+
+		if (!congested && !client.second.conflated.empty())
+		{
+			FlushConflated(client);
+		}
+	}
+}
+
+// Compares what steam still has to send with what it sends in the given time at the current rate.
+bool CSteamPlayServer::IsCongested(HSteamNetConnection connection, uint32 queueTime) const
+{
+	SteamNetConnectionRealTimeStatus_t status;
+	if (SteamGameServerNetworkingSockets()->GetConnectionRealTimeStatus(connection, &status, 0, nullptr) != k_EResultOK)
+	{
+		return false;
+	}
+
+	return SSteamPlayConfig::GetPendingBytes(status) > SSteamPlayConfig::GetSendWindow(status, queueTime);
+}
+
+void CSteamPlayServer::FlushConflated(TClient& recipient)
+{
+	for (auto const& [key, held] : recipient.second.conflated)
+	{
+		SRelayPayload payload = held.GetPayload();
+		SendData(recipient, key.from, key.to, payload, held.flags, key.lane);
+	}
+	recipient.second.conflated.clear();
+}
+
+void CSteamPlayServer::ReportLaneQueueTimes()
+{
+	static constexpr TClock::duration s_laneReportInterval = std::chrono::seconds(10);
+
+	TClock::time_point const now = TClock::now();
+	if (now < m_nextLaneReport)
+	{
+		return;
+	}
+	m_nextLaneReport = now + s_laneReportInterval;
+
+	using std::chrono::duration_cast;
+	using std::chrono::microseconds;
+
+	std::array<TClock::duration, static_cast<size_t>(ELane::Count)> queueTimes;
+	for (TClient const& client : m_clients)
+	{
+		if (client.second.capabilities.Has(EFeature::Lanes) && TMessageSender::GetLaneQueueTimes(client.first, queueTimes))
+		{
+			Log::DebugServer("Client %u lane queue times: default %lldus, high %lldus, bulk %lldus.", client.first,
+				static_cast<long long>(duration_cast<microseconds>(queueTimes[static_cast<size_t>(ELane::Default)]).count()),
+				static_cast<long long>(duration_cast<microseconds>(queueTimes[static_cast<size_t>(ELane::High)]).count()),
+				static_cast<long long>(duration_cast<microseconds>(queueTimes[static_cast<size_t>(ELane::Bulk)]).count()));
 		}
 	}
 }
 
+void CSteamPlayServer::UpdateShedLevel(TClock::duration tickTime, TClock::duration tickDuration)
+{
+	// ticks need to have room to spare for a while before a level is taken back, one slow tick raises it right away
+	static constexpr uint32 s_recoveryTicks = TicksPerSecond / 2;
+
+	EShedLevel const previous = m_shedLevel;
+	if (tickTime > tickDuration)
+	{
+		++m_overrunTicks;
+		m_spareTicks = 0;
+		if (m_shedLevel < EShedLevel::Receiving)
+		{
+			m_shedLevel = static_cast<EShedLevel>(static_cast<uint8>(m_shedLevel) + 1);
+		}
+	}
+	else if (tickTime < tickDuration / 2 && m_shedLevel > EShedLevel::None && ++m_spareTicks >= s_recoveryTicks)
+	{
+		m_spareTicks = 0;
+		m_shedLevel  = static_cast<EShedLevel>(static_cast<uint8>(m_shedLevel) - 1);
+	}
 
+	if (m_shedLevel > EShedLevel::None)
+	{
+		++m_shedTicks;
+	}
 
+	if (previous == EShedLevel::None && m_shedLevel != EShedLevel::None)
+	{
+		Log::InfoServer("A tick took %lldus, shedding low priority work.",
+			static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(tickTime).count()));
+	}
+	else if (previous != EShedLevel::None && m_shedLevel == EShedLevel::None)
+	{
+		Log::InfoServer("Ticks are back within their duration.");
+	}
+}
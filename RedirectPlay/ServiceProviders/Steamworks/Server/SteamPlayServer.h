@@ -1,13 +1,30 @@
 #pragma once
 
+#include "../Messages/Compression.h"
+#include "../Messages/Delta.h"
+#include "../Messages/Fragmentation.h"
+#include "../Messages/MessageRegistry.h"
+#include "../Messages/Messages.h"
+#include "../Messages/Redundancy.h"
+#include "../Messages/Replay.h"
+#include "../Messages/Sequence.h"
+#include "../Messages/StandbyRoster.h"
 #include "../SteamTypes.h"
 #include "SteamServerSettings.h"
+#include "TokenBucket.h"
 
 #include "Steam/steam_gameserver.h"
 #include "DirectX/dplay.h"
 
+#include <array>
+#include <bitset>
+#include <deque>
 #include <functional> // needed for callbacks
+#include <memory>
+#include <mutex>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 class CSteamPlayServer
 {
@@ -20,11 +37,154 @@ public:
 	};
 
 private:
+	struct SHeldPayload;
+
+	// A relayed payload, compressed ones are decompressed at most once for recipients that cannot take them as they are.
+	struct SRelayPayload
+	{
+		void const* pData;
+		size_t      size;
+		bool        compressed;
+		uint32      dictionaryId;      // negotiated with the sender
+		size_t      rawSize;
+		void const* pRawData = nullptr; // set once decompressed
+		bool        sequenced = false;
+		std::shared_ptr<SHeldPayload const> pHeld; // set once a recipient had to queue it
+	};
+
+	// A relayed payload kept past the steam message it arrived in, see RelayData and HoldTurnData.
+	struct SHeldPayload
+	{
+		std::vector<uint8> data;
+		bool               compressed;
+		uint32             dictionaryId;
+		size_t             rawSize;
+		bool               sequenced;
+		int                flags;
+
+		void Hold(SRelayPayload const& payload, int sendFlags)
+		{
+			data.assign(static_cast<uint8 const*>(payload.pData), static_cast<uint8 const*>(payload.pData) + payload.size);
+			compressed   = payload.compressed;
+			dictionaryId = payload.dictionaryId;
+			rawSize      = payload.rawSize;
+			sequenced    = payload.sequenced;
+			flags        = sendFlags;
+		}
+
+		SRelayPayload GetPayload() const
+		{
+			SRelayPayload payload;
+			payload.pData        = data.data();
+			payload.size         = data.size();
+			payload.compressed   = compressed;
+			payload.dictionaryId = dictionaryId;
+			payload.rawSize      = rawSize;
+			payload.sequenced    = sequenced;
+			return payload;
+		}
+	};
+
+	// Relayed data waiting for its turn in the recipient's deficit round robin, see RunScheduler.
+	struct SQueuedMessage
+	{
+		DPID                                to;
+		ELane                               lane;
+		int                                 flags;
+		std::shared_ptr<SHeldPayload const> pPayload;
+		TClock::time_point                  queued;
+	};
+
+	struct SSenderQueue
+	{
+		std::deque<SQueuedMessage> messages;
+		int64                      deficit = 0;
+	};
+
 	struct SClientData
 	{
 		CSteamID           steamId;
 		bool               authorized;
 		TClock::time_point lastMessage;
+		SCapabilities      capabilities; // negotiated, empty until the client announced its own
+		bool               negotiated = false; // SBeginAuth was taken, the capabilities stay for the whole session
+
+		// The first player created by a connection is the sender of data messages with an implicit 'from'.
+		// Once it is destroyed the connection has to address its players explicitly.
+		DPID                           primaryPlayer        = DPID_UNKNOWN;
+		bool                           primaryPlayerRetired = false;
+
+		// Slots this client was told about, only those can be used in compact data headers.
+		std::bitset<s_maxPlayerSlots>  knownSlots;
+
+		// Data coalesced into one SDataBundle, see FlushBundle.
+		std::vector<uint8>             bundle;
+		std::vector<DPID>              bundlePlayers; // senders and recipients of the entries
+		size_t                         bundleEntries = 0;
+		int                            bundleFlags   = 0;
+		ELane                          bundleLane    = ELane::Default;
+		TClock::time_point             bundleDeadline;
+
+		// Previous payloads for EFeature::Delta in both directions.
+		CDeltaStreams                  deltaSendStreams;
+		CDeltaStreams                  deltaReceiveStreams;
+
+		// EFeature::Fragmentation transfers in both directions.
+		CFragmentAssembler             fragments;
+		uint32                         nextTransferId = 0;
+
+		// EFeature::Sequenced streams, filtered on receive and numbered again on send.
+		CSequenceFilter                sequenceFilter;
+		CSequenceCounters              sequenceCounters;
+
+		// EFeature::Redundancy streams, payloads are delivered once on receive and repeated again on send.
+		CRedundantSender               redundantSender;
+		CRedundantReceiver             redundantReceiver;
+
+		// Players by kind, connections with only spectators are served from the spectator feed.
+		size_t                         gameplayPlayers  = 0;
+		size_t                         spectatorPlayers = 0;
+
+		// Data that did not fit into the bytes steam may take this tick, queued per sending player.
+		std::unordered_map<DPID, SSenderQueue> senderQueues;
+		std::deque<DPID>               activeSenders; // round robin order of the non-empty queues
+		int64                          sendBudget = 0;
+
+		// Unreliable data held while steam has a backlog for this client, only the newest message per stream is kept.
+		// See UpdateConflation.
+		TStreamMap<SHeldPayload>       conflated;
+		bool                           congested           = false;
+		uint64                         conflationHeld      = 0;
+		uint64                         conflationReplaced  = 0;
+
+		// What the client may send, messages above it wait in deferred, unreliable ones only with ERateLimitAction::Delay.
+		// See AdmitMessage.
+		CTokenBucket                   messageLimit;
+		CTokenBucket                   byteLimit;
+		std::deque<TSteamMessageUniquePtr> deferred;
+		size_t                         deferredBytes = 0;
+		uint64                         rateLimited = 0;
+		uint64                         dropped     = 0;
+
+		// Invalid messages are only logged at a bounded rate, see LogRejected.
+		CTokenBucket                   rejectLog;
+		uint64                         rejectsSuppressed = 0;
+
+		// EFeature::Resume, a suspended client lost its connection and keeps its players until resumeDeadline.
+		CReplayBuffer                  replay;
+		bool                           recordReplay  = true; // until negotiated without EFeature::Resume
+		uint64                         resumeToken   = 0;
+		bool                           suspended     = false;
+		bool                           pendingResume = false; // new connection of a suspended client, not told about players
+		TClock::time_point             resumeDeadline;
+
+		// EFeature::HostMigration, clients that could not start a standby server are not asked again.
+		bool                           standbyFailed = false;
+
+		// EFeature::EarlyAuth, what the client sent along with its credentials waits for auth to complete.
+		std::deque<TSteamMessageUniquePtr> heldForAuth;
+		size_t                         heldForAuthBytes = 0;
+		TClock::time_point             acceptTime;
 	};
 	using TClients = std::unordered_map<HSteamNetConnection, SClientData>;
 	using TClient  = std::pair<const HSteamNetConnection, SClientData>;
@@ -34,10 +194,78 @@ private:
 		HSteamNetConnection     connection;
 		fstring<DPSHORTNAMELEN> shortName;
 		fstring<DPLONGNAMELEN>  longName;
+		TPlayerSlot             slot = s_invalidPlayerSlot;
+		bool                    spectator = false;
 	};
 	using TPlayers = std::unordered_map<DPID, SPlayerData>;
 	using TPlayer  = std::pair<const DPID, SPlayerData>;
 
+	// A player taken over from the lost host, waiting for its owner to reconnect, see ClaimPlayers.
+	struct SUnclaimedPlayer
+	{
+		CSteamID owner;
+		bool     primary;
+	};
+	using TUnclaimedPlayers = std::unordered_map<DPID, SUnclaimedPlayer>;
+
+	// A relayed message held for later, its sender does not get it back.
+	struct SHeldMessage
+	{
+		HSteamNetConnection connection;
+		DPID                from;
+		DPID                to;
+		ELane               lane;
+		SHeldPayload        payload;
+	};
+
+	// Reliable broadcasts collected for the open lockstep turn, see HoldTurnData.
+	struct SLockstep
+	{
+		std::vector<SHeldMessage>               entries;
+		std::unordered_set<HSteamNetConnection> contributors;
+		TClock::time_point                      deadline;
+		uint64                                  turns         = 0;
+		uint64                                  completeTurns = 0; // closed once every client contributed
+		uint64                                  commands      = 0;
+	};
+
+	// Relayed traffic per sending player, see RunScheduler.
+	struct SSenderStats
+	{
+		uint64             messages = 0;
+		uint64             bytes    = 0;
+		uint64             queued   = 0; // messages that had to wait for the scheduler
+		uint64             expired  = 0; // unreliable messages that waited too long
+		TClock::duration   queueTime{};
+		TClock::duration   maxQueueTime{};
+		size_t             tickBytes = 0;
+
+		void Write(DPID sender) const;
+	};
+	using TSenderStats = std::unordered_map<DPID, SSenderStats>;
+
+	// Data for spectator connections, sent at a reduced rate, see FeedSpectators.
+	struct SSpectatorFeed
+	{
+		std::vector<SHeldMessage>  reliable;   // in order
+		TStreamMap<SHeldMessage>   unreliable; // newest per stream
+		TClock::time_point         nextFlush;
+		uint64                     held     = 0;
+		uint64                     replaced = 0;
+		uint64                     updates  = 0;
+	};
+
+	// Work skipped while ticks take longer than they may, each level sheds the work of the levels below as well.
+	enum class EShedLevel : uint8
+	{
+		None,
+		Reports,    // lane queue time reports
+		Deferred,   // messages delayed by the rate limit
+		Spectators, // spectator feed updates
+		Conflation, // unreliable data held for congested clients
+		Receiving,  // fewer messages are received per tick
+	};
+
 public:
 	CSteamPlayServer();
 	~CSteamPlayServer();
@@ -51,6 +279,17 @@ public:
 	bool             Start(SSteamServerSettings const& settings);
 	void             Close();
 
+	// A standby server logs on and holds incoming connections until TakeOver, see SStandbyRoster.
+	bool             StartStandby(SSteamServerSettings const& settings);
+	bool             IsStandby() const { return m_standbyMode; }
+	void             SetStandbyRoster(SStandbyRoster const& roster);
+	void             TakeOver()        { m_takeOver = true; }
+	// Owner of the standby host of this server, invalid if there is none.
+	CSteamID         GetStandbyOwner() const { return CSteamID(m_standbyOwner.load()); }
+
+	// Time base shared with clients of EFeature::ClockSync, see CClockSync.
+	TClock::duration GetSessionTime() const { return TClock::now() - m_sessionStart; }
+
 private:
 	STEAM_GAMESERVER_CALLBACK(CSteamPlayServer, OnSteamServersConnected,      SteamServersConnected_t);
 	STEAM_GAMESERVER_CALLBACK(CSteamPlayServer, OnSteamServersConnectFailure, SteamServerConnectFailure_t);
@@ -60,6 +299,7 @@ private:
 	STEAM_GAMESERVER_CALLBACK(CSteamPlayServer, OnNetConnectionStatusChanged, SteamNetConnectionStatusChangedCallback_t);
 
 	bool               HasPassword() const { return m_settings.HasPassword(); }
+	SCapabilities      GetCapabilities() const;
 
 	void               UpdateLoop();
 	void               ReceiveNetworkData();
@@ -70,17 +310,85 @@ private:
 	TClients::iterator RemoveClient(TClients::iterator entry, EDisconnectReason reason);
 
 	void               ProcessNetworkingMessage(TSteamMessageUniquePtr pSteamMessage);
-	void               OnReceiveBeginAuth(TClient& client, TSteamMessageUniquePtr pSteamMessage);
-	void               OnReceiveCreatePlayer(TClient& client, TSteamMessageUniquePtr pSteamMessage);
-	void               OnReceiveDestroyPlayer(TClient& client, TSteamMessageUniquePtr pSteamMessage);
+	bool               AdmitMessage(TClient& client, TSteamMessageUniquePtr& pSteamMessage);
+	void               DispatchMessage(TClient& client, TSteamMessageUniquePtr pSteamMessage);
+	void               ProcessDeferredMessages();
+	template<typename ... TArgs>
+	void               LogRejected(TClient& client, Log::ELevel level, char const* fmt, TArgs... args);
+	void               WriteRateLimitStats(TClient const& client) const;
+	void               OnReceiveBeginAuth(TClient& client, Messages::Client::SBeginAuth const& message);
+	void               OnReceiveEarlyAuth(TClient& client, Messages::Client::SEarlyAuth const& message);
+	bool               HoldForAuth(TClient& client, TSteamMessageUniquePtr& pSteamMessage);
+	void               DispatchHeldForAuth(HSteamNetConnection connection);
+	void               OnReceiveCreatePlayer(TClient& client, Messages::Client::SCreatePlayer const& message);
+	void               OnReceiveDestroyPlayer(TClient& client, Messages::Client::SDestroyPlayer const& message);
+	void               OnReceiveTimeRequest(TClient& client, Messages::Client::STimeRequest const& message);
+	void               OnReceiveResume(TClient& client, Messages::Client::SResume const& message);
+	void               OnReceiveStandbyReady(TClient& client, Messages::Client::SStandbyReady const& message);
 	void               OnReceiveData(TClient& client, TSteamMessageUniquePtr pSteamMessage);
+	void               OnReceiveDataFragment(TClient& client, TSteamMessageUniquePtr pSteamMessage);
+	void               RelayToRecipients(TClient& client, DPID from, DPID to, SRelayPayload& payload, int flags, ELane lane);
+	bool               RelayData(TClient& recipient, DPID from, DPID to, SRelayPayload& payload, int flags, ELane lane);
+	bool               SendData(TClient& recipient, DPID from, DPID to, SRelayPayload& payload, int flags, ELane lane);
+	bool               TransmitData(TClient& recipient, DPID from, DPID to, SRelayPayload& payload, int flags, ELane lane);
+	bool               DecompressRelayPayload(SRelayPayload& payload);
+	bool               BundleData(TClient& recipient, DPID from, DPID to, void const* pHeader, size_t headerSize, void const* pPayload, size_t payloadSize, int flags, ELane lane);
+	void               FlushBundle(TClient& recipient);
+	void               FlushBundles();
+	bool               IsLockstep() const;
+	void               HoldTurnData(TClient& client, DPID from, SRelayPayload const& payload, int flags, ELane lane);
+	bool               IsTurnComplete() const;
+	TClock::duration   GetTurnTime() const;
+	void               CloseTurn(bool complete);
+	void               RelayTurnEntry(SHeldMessage const& entry);
+	void               UpdateLockstep();
+	bool               HasSpectatorFeed() const;
+	bool               IsSpectator(DPID id) const;
+	bool               IsSpectatorClient(TClient const& client) const;
+	void               FeedSpectators(HSteamNetConnection sender, DPID from, DPID to, SRelayPayload const& payload, int flags, ELane lane);
+	void               SendFeedMessage(TClient& recipient, SHeldMessage const& message);
+	void               FlushSpectatorFeed();
+	void               UpdateSpectatorFeed();
+	void               StartSchedulerTick();
+	bool               HasSenderBudget(SSenderStats const& stats) const;
+	void               RunScheduler(TClient& recipient);
+	void               RunScheduler();
+	void               ReleasePlayerTraffic(DPID player);
+	void               UpdateConflation();
+	bool               IsCongested(HSteamNetConnection connection, uint32 queueTime) const;
+	void               FlushConflated(TClient& recipient);
+	void               ReportLaneQueueTimes();
+	bool               Sheds(EShedLevel level) const { return m_shedLevel >= level; }
+	void               UpdateShedLevel(TClock::duration tickTime, TClock::duration tickDuration);
 
 	void               OnAuthCompleted(TClient& client, bool success);
+	void               NegotiateCapabilities(TClient& client, SCapabilities const& remote);
+	bool               HasSuspendedClient(CSteamID steamId) const;
+	void               SuspendClient(TClient& client);
+	void               ReplaceConnection(HSteamNetConnection oldConnection, HSteamNetConnection newConnection);
+	void               UpdateSuspendedClients();
+
+	bool               MigratesHost() const;
+	void               UpdateStandby();
+	void               PickStandby();
+	void               ClearStandby();
+	void               SendStandbyPlayer(DPID id, SPlayerData const& player, bool added);
+	void               SendStandbyHost(TClient const& client);
+	void               TakeOverSession();
+	bool               HasUnclaimedPlayers(CSteamID steamId) const;
+	void               ClaimPlayers(TClient& client);
+	void               RemoveUnclaimedPlayers();
 
 	DPID               FindEmptyId() const;
+	TPlayerSlot        AllocatePlayerSlot(DPID id);
+	TPlayerSlot        GetKnownSlot(TClient const& client, DPID id) const;
+	DPID               GetSlotPlayer(TPlayerSlot slot) const;
 
 	TPlayers::iterator DestroyPlayer(TPlayers::iterator validEntry);
 
+	template<typename, EMessageDirection, Log::ESource, typename ...>
+	friend class CMessageDispatcher;
+
 private:
 	std::atomic<EState>  m_state;
 
@@ -89,12 +397,46 @@ private:
 
 	TClients             m_clients;
 	TPlayers             m_players;
+
+	std::array<DPID, s_maxPlayerSlots> m_playerSlots;
+	TPlayerSlot                        m_nextPlayerSlot;
 	 
 	SSteamServerSettings m_settings;
 
 	std::vector<char>    m_sendDataBuf;
+	SCompressionStats    m_compressionStats;
+	std::vector<uint8>   m_deltaBuffer;
+	std::vector<uint8>   m_redundancyBuffer;
+	CRedundantReceiver::TPayloads m_redundantPayloads;
+	SLockstep            m_lockstep;
+	SSpectatorFeed       m_spectatorFeed;
+	TSenderStats         m_senderStats;
 
 	TClock::duration     m_timeoutDuration;
+	TClock::time_point   m_sessionStart;
+	TClock::time_point   m_nextLaneReport;
+
+	EShedLevel           m_shedLevel = EShedLevel::None;
+	uint64               m_overrunTicks = 0;
+	uint64               m_shedTicks    = 0;
+	uint32               m_spareTicks   = 0;
+	CTokenBucket         m_unknownSenderLog;
+	uint64               m_unknownSenderSuppressed = 0;
+
+	// EFeature::HostMigration while this server is the host.
+	HSteamNetConnection  m_standby;
+	CSteamID             m_standbyServer;
+	std::atomic<uint64>  m_standbyOwner;
+
+	// EFeature::HostMigration while this server is a standby or just took over, see StartStandby.
+	std::atomic_bool     m_standbyMode;
+	std::atomic_bool     m_takeOver;
+	std::mutex           m_standbyRosterMutex;
+	SStandbyRoster       m_standbyRoster;
+	std::vector<std::pair<HSteamNetConnection, CSteamID>> m_heldConnections;
+	TUnclaimedPlayers    m_unclaimedPlayers;
+	TClock::time_point   m_takeOverStart;
+	TClock::time_point   m_takeOverDeadline;
 
 	std::thread*         m_pThread;
 	std::atomic_bool     m_quitting;
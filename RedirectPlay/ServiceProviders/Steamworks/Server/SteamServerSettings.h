@@ -13,4 +13,5 @@ struct SSteamServerSettings
 	fstring<DPPASSWORDLEN>    password;
 	ELobbyType                lobbyType = k_ELobbyTypeFriendsOnly;
 	size_t                    maxPlayers = 4;
+	DWORD                     sessionFlags = 0; // DPSESSION_NOPRESERVEORDER and DPSESSION_OPTIMIZELATENCY
 };
\ No newline at end of file
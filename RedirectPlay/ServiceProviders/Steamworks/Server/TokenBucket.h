@@ -0,0 +1,60 @@
+#pragma once
+
+#include "../SteamTypes.h"
+
+#include "Steam/steamtypes.h"
+
+#include <algorithm>
+
+// Allows rate units per second on average and up to burst units at once, a rate of 0 allows everything.
+// A single amount above the burst is allowed from a full bucket and leaves a debt, so it still costs its share of time.
+class CTokenBucket
+{
+public:
+	void Configure(uint32 rate, uint32 burst, TClock::time_point now)
+	{
+		m_rate   = rate;
+		m_burst  = (std::max)(burst, 1u);
+		m_tokens = m_burst;
+		m_last   = now;
+	}
+
+	bool IsLimited() const { return m_rate > 0; }
+
+	bool CanConsume(size_t amount, TClock::time_point now)
+	{
+		if (!IsLimited())
+		{
+			return true;
+		}
+
+		double const elapsed = std::chrono::duration<double>(now - m_last).count();
+		m_tokens = (std::min)(static_cast<double>(m_burst), m_tokens + elapsed * m_rate);
+		m_last   = now;
+		return m_tokens >= (std::min)(static_cast<double>(amount), static_cast<double>(m_burst));
+	}
+
+	void Consume(size_t amount)
+	{
+		if (IsLimited())
+		{
+			m_tokens -= static_cast<double>(amount);
+		}
+	}
+
+	bool TryConsume(size_t amount, TClock::time_point now)
+	{
+		if (!CanConsume(amount, now))
+		{
+			return false;
+		}
+		Consume(amount);
+		return true;
+	}
+
+private:
+	double             m_tokens = 0.0;
+	uint32             m_rate   = 0;
+	uint32             m_burst  = 1;
+	TClock::time_point m_last;
+};
@@ -0,0 +1,246 @@
+#include "SteamPlayConfig.h"
+#include "Globals.h"
+#include "Log.h"
+#include "Messages/DataHeader.h"
+#include "Messages/Delta.h"
+
+#include <algorithm>
+#include <iterator>
+#include <string.h>
+
+static constexpr char s_configFile[] = "RedirectPlay.ini";
+
+// Relative file names are resolved against the dll directory.
+static std::string ReadPath(char const* szSection, char const* szKey, std::string const& directory, char const* szConfigPath)
+{
+	char szValue[MAX_PATH];
+	if (GetPrivateProfileStringA(szSection, szKey, "", szValue, MAX_PATH, szConfigPath) == 0)
+	{
+		return std::string();
+	}
+
+	bool const absolute = szValue[0] == '\\' || szValue[0] == '/' || (szValue[0] != '\0' && szValue[1] == ':');
+	return absolute ? std::string(szValue) : directory + szValue;
+}
+
+static SSteamPlayConfig LoadConfig()
+{
+	SSteamPlayConfig config;
+
+	// profile functions look into the windows directory for relative paths
+	char szPath[MAX_PATH];
+	DWORD const length = GetModuleFileNameA(g_module, szPath, MAX_PATH);
+	if (length == 0 || length >= MAX_PATH)
+	{
+		return config;
+	}
+
+	char* const pFileName = strrchr(szPath, '\\');
+	size_t const directoryLength = pFileName ? pFileName + 1 - szPath : 0;
+	if (directoryLength + sizeof(s_configFile) > MAX_PATH)
+	{
+		return config;
+	}
+	memcpy(szPath + directoryLength, s_configFile, sizeof(s_configFile));
+	std::string const directory(szPath, directoryLength);
+
+	config.features     = GetPrivateProfileIntA("Protocol", "Features", config.features, szPath) & SCapabilities::s_knownFeatures;
+	config.maxBatchSize = GetPrivateProfileIntA("Protocol", "MaxBatchSize", config.maxBatchSize, szPath);
+	config.bundleDelay  = GetPrivateProfileIntA("Protocol", "BundleDelay", config.bundleDelay, szPath);
+
+	config.compressionThreshold = GetPrivateProfileIntA("Compression", "Threshold", config.compressionThreshold, szPath);
+	config.captureFile          = ReadPath("Compression", "CaptureFile", directory, szPath);
+
+	config.laneHighPriority  = GetPrivateProfileIntA("Lanes", "HighPriority", config.laneHighPriority, szPath);
+	config.laneLowPriority   = GetPrivateProfileIntA("Lanes", "LowPriority", config.laneLowPriority, szPath);
+	config.laneBulkSize      = GetPrivateProfileIntA("Lanes", "BulkSize", config.laneBulkSize, szPath);
+	config.laneDefaultWeight = static_cast<uint16>((std::max)(1u, GetPrivateProfileIntA("Lanes", "DefaultWeight", config.laneDefaultWeight, szPath)));
+	config.laneBulkWeight    = static_cast<uint16>((std::max)(1u, GetPrivateProfileIntA("Lanes", "BulkWeight", config.laneBulkWeight, szPath)));
+
+	config.sendQueueTime = GetPrivateProfileIntA("SendQueue", "QueueTime", config.sendQueueTime, szPath);
+
+	config.schedulerQuantum    = (std::max)(1u, GetPrivateProfileIntA("Scheduler", "Quantum", config.schedulerQuantum, szPath));
+	config.schedulerSenderRate = GetPrivateProfileIntA("Scheduler", "SenderRate", config.schedulerSenderRate, szPath);
+
+	// fragments have to fit into a steam message together with their header.
+	// Delta streams are keyed by their lane and fragments arrive on ELane::Bulk, so delta payloads are never fragmented.
+	static constexpr uint32 s_minFragmentSize = static_cast<uint32>(CDeltaStreams::s_maxPayloadSize + Messages::Shared::SDataHeader::s_maxSize);
+	static constexpr uint32 s_maxFragmentSize = k_cbMaxSteamNetworkingSocketsMessageSizeSend - Messages::Shared::SDataFragment::s_maxHeaderSize;
+	config.fragmentSize   = std::clamp<uint32>(GetPrivateProfileIntA("Fragmentation", "FragmentSize", config.fragmentSize, szPath), s_minFragmentSize, s_maxFragmentSize);
+	config.maxMessageSize = GetPrivateProfileIntA("Fragmentation", "MaxMessageSize", config.maxMessageSize, szPath);
+
+	config.conflationQueueTime = GetPrivateProfileIntA("Conflation", "QueueTime", config.conflationQueueTime, szPath);
+
+	config.redundancyDepth   = static_cast<uint8>(std::clamp<uint32>(GetPrivateProfileIntA("Redundancy", "Depth", config.redundancyDepth, szPath), 1, CRedundantSender::s_maxDepth));
+	config.redundancyMaxSize = GetPrivateProfileIntA("Redundancy", "MaxSize", config.redundancyMaxSize, szPath);
+
+	config.lockstepMaxTurnTime = GetPrivateProfileIntA("Lockstep", "MaxTurnTime", config.lockstepMaxTurnTime, szPath);
+	config.lockstepMinTurnTime = (std::min)(GetPrivateProfileIntA("Lockstep", "MinTurnTime", config.lockstepMinTurnTime, szPath), config.lockstepMaxTurnTime);
+
+	char szLane[16];
+	GetPrivateProfileStringA("Lockstep", "Lane", "", szLane, sizeof(szLane), szPath);
+	if (_stricmp(szLane, "default") == 0)
+	{
+		config.lockstepLane = ELane::Default;
+	}
+	else if (_stricmp(szLane, "high") == 0)
+	{
+		config.lockstepLane = ELane::High;
+	}
+	else if (_stricmp(szLane, "bulk") == 0)
+	{
+		config.lockstepLane = ELane::Bulk;
+	}
+	else if (szLane[0] != '\0')
+	{
+		Log::Warn("Unknown lockstep lane '%s'.", szLane);
+	}
+
+	config.spectatorRate = GetPrivateProfileIntA("Spectators", "Rate", config.spectatorRate, szPath);
+
+	config.rateLimitMessages      = GetPrivateProfileIntA("RateLimit", "MessageRate", config.rateLimitMessages, szPath);
+	config.rateLimitBytes         = GetPrivateProfileIntA("RateLimit", "ByteRate", config.rateLimitBytes, szPath);
+	config.rateLimitBurst         = GetPrivateProfileIntA("RateLimit", "Burst", config.rateLimitBurst, szPath);
+	config.rateLimitDeferredBytes = GetPrivateProfileIntA("RateLimit", "DeferredBytes", config.rateLimitDeferredBytes, szPath);
+
+	char szAction[16];
+	GetPrivateProfileStringA("RateLimit", "Action", "", szAction, sizeof(szAction), szPath);
+	if (_stricmp(szAction, "drop") == 0)
+	{
+		config.rateLimitAction = ERateLimitAction::Drop;
+	}
+	else if (_stricmp(szAction, "delay") == 0)
+	{
+		config.rateLimitAction = ERateLimitAction::Delay;
+	}
+	else if (_stricmp(szAction, "kick") == 0)
+	{
+		config.rateLimitAction = ERateLimitAction::Kick;
+	}
+	else if (szAction[0] != '\0')
+	{
+		Log::Warn("Unknown rate limit action '%s'.", szAction);
+	}
+
+	config.resumeGraceTime  = GetPrivateProfileIntA("Resume", "GraceTime", config.resumeGraceTime, szPath);
+	config.resumeReplaySize = GetPrivateProfileIntA("Resume", "ReplaySize", config.resumeReplaySize, szPath);
+
+	config.migrationTimeout = GetPrivateProfileIntA("Migration", "Timeout", config.migrationTimeout, szPath);
+
+	std::string const dictionaryFile = ReadPath("Compression", "Dictionary", directory, szPath);
+	if (!dictionaryFile.empty())
+	{
+		config.pDictionary = CLZDictionary::Load(dictionaryFile.c_str());
+	}
+
+	Log::Info("Protocol features 0x%x, max batch size %u, bundle delay %uus.", config.features, config.maxBatchSize, config.bundleDelay);
+	return config;
+}
+
+SCapabilities SSteamPlayConfig::GetCapabilities() const
+{
+	SCapabilities capabilities;
+	capabilities.version      = SCapabilities::s_version;
+	capabilities.features     = features;
+	capabilities.maxBatchSize = maxBatchSize;
+	capabilities.dictionaryId = pDictionary ? pDictionary->GetId() : 0;
+	return capabilities;
+}
+
+ELane SSteamPlayConfig::GetLane(DWORD priority, size_t size) const
+{
+	if (priority == 0)
+	{
+		return laneBulkSize > 0 && size >= laneBulkSize ? ELane::Bulk : ELane::Default;
+	}
+	if (priority >= laneHighPriority)
+	{
+		return ELane::High;
+	}
+	return priority <= laneLowPriority ? ELane::Bulk : ELane::Default;
+}
+
+bool SSteamPlayConfig::ConfigureLanes(ISteamNetworkingSockets* pSockets, HSteamNetConnection connection, SCapabilities const& capabilities) const
+{
+	static constexpr size_t s_maxLanes = static_cast<size_t>(ELane::Count) + s_unorderedLanes;
+
+	// high preempts, default and bulk share the rest by weight, the unordered lanes carry default data and weigh the same
+	int    priorities[s_maxLanes] = { 1, 0, 1 };
+	uint16 weights[s_maxLanes]    = { laneDefaultWeight, 1, laneBulkWeight };
+	for (size_t i = static_cast<size_t>(ELane::Count); i < s_maxLanes; ++i)
+	{
+		priorities[i] = 1;
+		weights[i]    = laneDefaultWeight;
+	}
+
+	uint16 const  laneCount = GetLaneCount(capabilities);
+	EResult const result    = pSockets->ConfigureConnectionLanes(connection, laneCount, priorities, weights);
+	if (result != k_EResultOK)
+	{
+		Log::Warn("Failed to configure lanes for connection %u with error code %u.", connection, result);
+		return false;
+	}
+	return true;
+}
+
+uint16 SSteamPlayConfig::GetLaneCount(SCapabilities const& capabilities)
+{
+	if (!capabilities.Has(EFeature::Lanes))
+	{
+		return 1;
+	}
+	return static_cast<uint16>(ELane::Count) + (capabilities.Has(EFeature::Unordered) ? s_unorderedLanes : 0);
+}
+
+// Reliable data keeps its order per sender and recipient, data of other pairs does not wait for its lost packets.
+ELane SSteamPlayConfig::GetStreamLane(SCapabilities const& capabilities, ELane lane, DPID from, DPID to, int flags)
+{
+	if (lane != ELane::Default || !capabilities.Has(EFeature::Unordered) || !(flags & k_nSteamNetworkingSend_Reliable))
+	{
+		return lane;
+	}
+
+	uint32 const pair = static_cast<uint32>(from) * 31 + static_cast<uint32>(to);
+	return static_cast<ELane>(static_cast<uint16>(ELane::Count) + (pair ^ (pair >> 16)) % s_unorderedLanes);
+}
+
+ELane SSteamPlayConfig::GetLogicalLane(ELane lane)
+{
+	return lane >= ELane::Count ? ELane::Default : lane;
+}
+
+// Fragments keep the lane of their message so it keeps its order, only sessions that do not preserve the order
+// move them out of the way of the other traffic.
+ELane SSteamPlayConfig::GetFragmentLane(SCapabilities const& capabilities, ELane lane)
+{
+	return capabilities.Has(EFeature::Unordered) ? ELane::Bulk : lane;
+}
+
+bool SSteamPlayConfig::ShouldFragment(SCapabilities const& capabilities, size_t messageSize, int flags) const
+{
+	if (!capabilities.Has(EFeature::Fragmentation))
+	{
+		return false;
+	}
+
+	// fragments are reliable, unreliable data only takes that over failing
+	size_t const limit = (flags & k_nSteamNetworkingSend_Reliable) ? fragmentSize : static_cast<size_t>(k_cbMaxSteamNetworkingSocketsMessageSizeSend);
+	return messageSize > limit;
+}
+
+// Bytes steam sends within the queue time at the current rate, a slow start still gets a few packets.
+size_t SSteamPlayConfig::GetSendWindow(SteamNetConnectionRealTimeStatus_t const& status, uint32 queueTime)
+{
+	return (std::max)(static_cast<size_t>(s_minSendWindow), static_cast<size_t>(status.m_nSendRateBytesPerSecond) * queueTime / 1000);
+}
+
+size_t SSteamPlayConfig::GetPendingBytes(SteamNetConnectionRealTimeStatus_t const& status)
+{
+	return static_cast<size_t>(status.m_cbPendingReliable) + static_cast<size_t>(status.m_cbPendingUnreliable);
+}
+
+SSteamPlayConfig const& SSteamPlayConfig::Get()
+{
+	static SSteamPlayConfig const s_config = LoadConfig();
+	return s_config;
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include "Messages/Compression.h"
+#include "Messages/Fragmentation.h"
+#include "Messages/Messages.h"
+#include "Messages/Redundancy.h"
+#include "SteamTypes.h"
+
+#include "Steam/isteamnetworkingsockets.h"
+
+#include <memory>
+#include <string>
+
+// Tuning read once from RedirectPlay.ini next to the dll, missing values keep their defaults.
+//
+// [Protocol]
+// Features=<bit mask of EFeature>  features announced to peers, 0 plays like a peer without capabilities,
+//                                  EFeature::Delta, EFeature::Sequenced and EFeature::Redundancy are only announced if they are set here
+// MaxBatchSize=<bytes>
+// BundleDelay=<microseconds>       how long the server may hold data for a bundle, 0 flushes at the end of every tick
+//
+// [Compression]
+// Threshold=<bytes>                smaller payloads are sent uncompressed
+// Dictionary=<file>                raw dictionary or capture file to train one from, all players need the same file
+// CaptureFile=<file>               appends payloads above the threshold for training a dictionary
+//
+// [Lanes]
+// HighPriority=<0-65535>           SendEx priorities from here on use ELane::High
+// LowPriority=<0-65535>            SendEx priorities from 1 to here use ELane::Bulk, 0 is the default priority of Send
+// BulkSize=<bytes>                 payloads of this size without a priority use ELane::Bulk as well, 0 to disable
+// DefaultWeight=<weight>           share of ELane::Default, ELane::High always goes first
+// BulkWeight=<weight>              share of ELane::Bulk
+//
+// [SendQueue]
+// QueueTime=<milliseconds>         data steam may hold at the current send rate, the rest waits in CSendQueue
+//                                  or the server's scheduler, unreliable data that waited longer is dropped there
+//
+// [Scheduler]
+// Quantum=<bytes>                  bytes each sender may relay to a recipient per deficit round robin round
+// SenderRate=<bytes per second>    most the server relays from one player to all recipients, 0 for no limit
+//
+// [Fragmentation]
+// FragmentSize=<bytes>             reliable data messages above this are sent in fragments on their own lane,
+//                                  on ELane::Bulk in sessions with DPSESSION_NOPRESERVEORDER,
+//                                  unreliable ones only if steam could not send them at all,
+//                                  at least the largest delta payload with its data header
+// MaxMessageSize=<bytes>           largest reassembled message accepted from a peer
+//
+// [Conflation]
+// QueueTime=<milliseconds>         the server only keeps the newest unreliable message per stream for clients
+//                                  whose steam queue holds more than this at the current send rate, 0 to disable
+//
+// [Redundancy]
+// Depth=<1-8>                      previous payloads repeated with every unreliable message of EFeature::Redundancy
+// MaxSize=<bytes>                  previous payloads are only repeated while the message stays within this
+//
+// [Lockstep]
+// MaxTurnTime=<milliseconds>       the server collects reliable broadcasts of the lockstep lane into turns, clients
+//                                  with EFeature::Batching get one bundle per turn, the others every command on its own,
+//                                  a turn closes once all players that are connected contributed or after
+//                                  the round trip time of the slowest client within these bounds, 0 to disable
+// MinTurnTime=<milliseconds>
+// Lane=<default|high|bulk>         lane of the commands, high by default so only sends with a high priority take part
+//
+// [Spectators]
+// Rate=<updates per second>        the server sends connections with only DPPLAYER_SPECTATOR players their data
+//                                  at this rate, unreliable data conflated to the newest per stream, 0 to disable
+//
+// [RateLimit]
+// MessageRate=<messages per second> most the server takes from one client, 0 for no limit (default)
+// ByteRate=<bytes per second>      most the server takes from one client, 0 for no limit (default)
+// Burst=<milliseconds>             of both rates a client may use up at once
+// Action=<drop|delay|kick>         what happens to messages above the limits, only unreliable ones are dropped,
+//                                  reliable ones are always delayed, a client is disconnected with ClientKicked
+//                                  once too many of its reliable messages wait or with kick
+// DeferredBytes=<bytes>            most the messages of one client waiting for its limits may hold
+//
+// [Resume]
+// GraceTime=<milliseconds>         the server keeps the players of a client that lost its connection this long,
+//                                  so it can resume its session on a new one with EFeature::Resume, 0 to disable
+// ReplaySize=<bytes>               reliable messages kept per connection for replaying what a peer did not get
+//
+// [Migration]
+// Timeout=<milliseconds>           clients of a DPSESSION_MIGRATEHOST session try to reach the standby host this long
+//                                  once the host is lost, the standby keeps the players of the others as long,
+//                                  0 to disable EFeature::HostMigration
+
+enum class ERateLimitAction
+{
+	Drop,
+	Delay,
+	Kick,
+};
+
+struct SSteamPlayConfig
+{
+	static constexpr uint32 s_packetSize    = 1200; // payload that fits a single unfragmented packet
+	static constexpr uint32 s_minSendWindow = 4 * s_packetSize;
+
+	uint32 features     = SCapabilities::s_knownFeatures
+		& ~(static_cast<uint32>(EFeature::Delta) | static_cast<uint32>(EFeature::Sequenced) | static_cast<uint32>(EFeature::Redundancy));
+	uint32 maxBatchSize = s_packetSize;
+	uint32 bundleDelay  = 0;
+
+	uint32                               compressionThreshold = 256;
+	std::shared_ptr<CLZDictionary const> pDictionary;
+	std::string                          captureFile;
+
+	uint32 laneHighPriority  = 0xC000;
+	uint32 laneLowPriority   = 0x3FFF;
+	uint32 laneBulkSize      = 0;
+	uint16 laneDefaultWeight = 4;
+	uint16 laneBulkWeight    = 1;
+
+	uint32 sendQueueTime = 50;
+
+	uint32 schedulerQuantum    = s_packetSize;
+	uint32 schedulerSenderRate = 0;
+
+	uint32 fragmentSize   = 64 * 1024;
+	uint32 maxMessageSize = 16 * 1024 * 1024;
+
+	uint32 conflationQueueTime = 100;
+
+	uint8  redundancyDepth   = 3;
+	uint32 redundancyMaxSize = s_packetSize;
+
+	uint32 lockstepMaxTurnTime = 0;
+	uint32 lockstepMinTurnTime = 20;
+	ELane  lockstepLane        = ELane::High;
+
+	uint32 spectatorRate = 10;
+
+	uint32           rateLimitMessages      = 0;
+	uint32           rateLimitBytes         = 0;
+	uint32           rateLimitBurst         = 500;
+	ERateLimitAction rateLimitAction        = ERateLimitAction::Delay;
+	uint32           rateLimitDeferredBytes = 1024 * 1024;
+
+	uint32 resumeGraceTime  = 15000;
+	uint32 resumeReplaySize = 1024 * 1024;
+
+	uint32 migrationTimeout = 10000;
+
+	SCapabilities GetCapabilities() const;
+
+	ELane         GetLane(DWORD priority, size_t size) const;
+	bool          ConfigureLanes(ISteamNetworkingSockets* pSockets, HSteamNetConnection connection, SCapabilities const& capabilities) const;
+
+	static uint16 GetLaneCount(SCapabilities const& capabilities);
+	static ELane  GetStreamLane(SCapabilities const& capabilities, ELane lane, DPID from, DPID to, int flags);
+	static ELane  GetLogicalLane(ELane lane);
+	static ELane  GetFragmentLane(SCapabilities const& capabilities, ELane lane);
+
+	bool          ShouldFragment(SCapabilities const& capabilities, size_t messageSize, int flags) const;
+
+	static size_t GetSendWindow(SteamNetConnectionRealTimeStatus_t const& status, uint32 queueTime);
+	static size_t GetPendingBytes(SteamNetConnectionRealTimeStatus_t const& status);
+
+	static SSteamPlayConfig const& Get();
+};
@@ -16,6 +16,7 @@
 #include "Steam/steamclientpublic.h"
 
 #include <cassert>
+#include <optional>
 
 TClock::duration s_connectionTimeout = std::chrono::seconds(10);
 
@@ -45,6 +46,69 @@ void CSteamPlayProvider::Update()
 	if (m_pClient && !m_pClient->IsDisconnected())
 	{
 		m_pClient->ReceiveNetworkData();
+		UpdateStandby();
+	}
+}
+
+void StandbyToSettings(SSteamServerSettings& settings, Messages::Server::SStandbySession const& session)
+{
+	settings.name         = session.name;
+	settings.password     = session.password;
+	settings.maxPlayers   = session.maxPlayers;
+	settings.lobbyType    = static_cast<ELobbyType>(session.lobbyType);
+	settings.sessionFlags = session.sessionFlags;
+}
+
+// EFeature::HostMigration, the standby host keeps a server of its own logged on, see SStandbyRoster.
+void CSteamPlayProvider::UpdateStandby()
+{
+	SStandbyRoster roster;
+	if (m_pClient->GetStandbyRoster(roster))
+	{
+		if (!m_pServer)
+		{
+			m_pServer = std::make_unique<CSteamPlayServer>();
+			m_standbyReported = false;
+			SSteamServerSettings settings;
+			StandbyToSettings(settings, roster.session);
+			if (!m_pServer->StartStandby(settings))
+			{
+				m_pServer.reset();
+				m_pClient->ReportStandbyServer(CSteamID());
+			}
+		}
+		if (m_pServer && m_pServer->IsStandby())
+		{
+			m_pServer->SetStandbyRoster(roster);
+		}
+	}
+
+	if (m_pServer && m_pServer->IsStandby())
+	{
+		if (!m_standbyReported && m_pServer->GetState() != CSteamPlayServer::Connecting)
+		{
+			m_standbyReported = true;
+			if (!m_pServer->IsConnected())
+			{
+				m_pServer.reset();
+				m_pClient->ReportStandbyServer(CSteamID());
+				return;
+			}
+			m_pClient->ReportStandbyServer(m_pServer->GetSteamID());
+		}
+		if (m_pClient->IsMigrating())
+		{
+			// the host is lost, the clients connect to this server now
+			m_pServer->TakeOver();
+		}
+	}
+
+	// the lobby was handed over by the old host or Steam picked this member
+	if (m_pServer && m_pServer->IsConnected() && !m_pServer->IsStandby() &&
+		m_pLobby && m_pLobby->IsInLobby() && m_pLobby->IsOwner() &&
+		m_pLobby->GetGameServer() != m_pServer->GetSteamID())
+	{
+		m_pLobby->SetGameServer(m_pServer->GetSteamID());
 	}
 }
 
@@ -121,8 +185,9 @@ HRESULT CSteamPlayProvider::JoinServer(CSteamID serverID, char const* szPassword
 		return DPERR_GENERIC;
 	}
 
+	// with EFeature::EarlyAuth the game may create its players while the server still checks the credentials
 	TClock::time_point const deadline = TClock::now() + s_connectionTimeout;
-	while (m_pClient->IsConnectingOrPending())
+	while (m_pClient->IsConnectingOrPending() && !m_pClient->IsConnected())
 	{
 		Update();
 
@@ -154,6 +219,9 @@ void DPDescToSettings(SSteamServerSettings& settings, DPSESSIONDESC2 const& desc
 	}
 	settings.lobbyType  = k_ELobbyTypeFriendsOnly;
 	settings.maxPlayers = description.dwMaxPlayers;
+
+	// these turn on EFeature::Unordered, EFeature::LowLatency and EFeature::HostMigration for clients that support them
+	settings.sessionFlags = description.dwFlags & (DPSESSION_NOPRESERVEORDER | DPSESSION_OPTIMIZELATENCY | DPSESSION_MIGRATEHOST);
 }
 
 HRESULT CSteamPlayProvider::Create(DPSESSIONDESC2& description)
@@ -263,7 +331,7 @@ HRESULT CSteamPlayProvider::InitializeConnection(void* pConnection, DWORD)
 HRESULT CSteamPlayProvider::Open(DPSESSIONDESC2* pDescription, DWORD flags)
 {
 	DPSESSION_NEWPLAYERSDISABLED;
-	DPSESSION_MIGRATEHOST;
+	DPSESSION_MIGRATEHOST;     // EFeature::HostMigration
 	DPSESSION_NOMESSAGEID;
 	DPSESSION_JOINDISABLED;
 	DPSESSION_KEEPALIVE;
@@ -273,8 +341,8 @@ HRESULT CSteamPlayProvider::Open(DPSESSIONDESC2* pDescription, DWORD flags)
 	DPSESSION_MULTICASTSERVER; // currently it is always multicast
 	DPSESSION_CLIENTSERVER;
 	DPSESSION_DIRECTPLAYPROTOCOL;
-	DPSESSION_NOPRESERVEORDER;
-	DPSESSION_OPTIMIZELATENCY;
+	DPSESSION_NOPRESERVEORDER; // EFeature::Unordered, see DPDescToSettings
+	DPSESSION_OPTIMIZELATENCY; // EFeature::LowLatency
 	DPSESSION_ALLOWVOICERETRO;
 	DPSESSION_NOSESSIONDESCMESSAGES;
 
@@ -313,43 +381,44 @@ HRESULT CSteamPlayProvider::CreatePlayer(LPDPID pPlayerId, LPDPNAME pName, HANDL
 		return DPERR_NOCONNECTION;
 	}
 
-	fstring<DPSHORTNAMELEN> shortName;
-	if (pName->lpszShortName)
-	{
-		wcstombs(shortName.data(), pName->lpszShortName, shortName.max_size());
-	}
-	fstring<DPLONGNAMELEN> longName;
-	if (pName->lpszLongName)
-	{
-		wcstombs(longName.data(), pName->lpszLongName, longName.max_size());
-	}
-
-	bool gotResponse = false;
-	m_pClient->CreatePlayer(
+	// the request stays in flight after a timeout, its answer must not end up on this stack
+	std::shared_ptr<std::optional<DPID>> const pResponse = std::make_shared<std::optional<DPID>>();
+	uint32 requestId = 0;
+	bool const sent = m_pClient->CreatePlayer(
 		{
-			shortName,
-			longName,
+			pName ? pName->lpszShortName : nullptr,
+			pName ? pName->lpszLongName : nullptr,
 			(flags & DPPLAYER_SERVERPLAYER) != 0,
 			(flags & DPPLAYER_SPECTATOR) != 0,
-			pData,
-			size,
 		},
-		[pPlayerId, &gotResponse](DPID id)	
+		[pResponse](DPID id)
 		{
-			*pPlayerId = id;
-			gotResponse = true;
-		}
+			*pResponse = id;
+		},
+		&requestId
 	);
+	if (!sent)
+	{
+		return DPERR_GENERIC;
+	}
 
 	TClock::time_point const deadline = TClock::now() + s_connectionTimeout;
-	while (!gotResponse)
+	while (!pResponse->has_value())
 	{
 		Update();
 
 		if (std::chrono::steady_clock::now() > deadline)
+		{
+			// a late answer must not add a player the game never got
+			if (m_pClient)
+			{
+				m_pClient->AbandonCreatePlayer(requestId);
+			}
 			return DPERR_TIMEOUT;
+		}
 	}
 
+	*pPlayerId = **pResponse;
 	return *pPlayerId != DPID_UNKNOWN ? DP_OK : DPERR_GENERIC;
 }
 
@@ -449,24 +518,6 @@ HRESULT CSteamPlayProvider::EnumSessions(DPSESSIONDESC2* enumDesc, DWORD timeout
 }
 
 HRESULT CSteamPlayProvider::SendEx(DPID from, DPID to, DWORD flags, LPVOID data, DWORD size, DWORD priority, DWORD timeout, LPVOID context, DWORD_PTR* msgid)
-{
-	Update();
-	return Send(from, to, flags, data, size);
-}
-
-HRESULT CSteamPlayProvider::Receive(LPDPID from, LPDPID to, DWORD flags, LPVOID data, LPDWORD size)
-{
-	Update();
-
-	if (!m_pClient || !m_pClient->IsConnected())
-	{
-		return DPERR_NOCONNECTION;
-	}
-
-	return m_pClient->ReceiveData(from, to, flags, data, size);
-}
-
-HRESULT CSteamPlayProvider::Send(DPID from, DPID to, DWORD flags, LPVOID data, DWORD size)
 {
 	Update();
 
@@ -490,12 +541,57 @@ HRESULT CSteamPlayProvider::Send(DPID from, DPID to, DWORD flags, LPVOID data, D
 		return DPERR_UNSUPPORTED;
 	}
 
-	if (!(flags & DPSEND_NOSENDCOMPLETEMSG))
+	if (priority > 0xFFFF)
 	{
-		return DPERR_UNSUPPORTED;
+		return DPERR_INVALIDPARAM;
+	}
+
+	CSteamPlayClient::SSendData input;
+	input.from     = from;
+	input.to       = to;
+	input.pData    = data;
+	input.size     = size;
+	input.flags    = flags;
+	input.priority = priority;
+	input.timeout  = timeout;
+	input.pContext = context;
+
+	// message ids are only returned for async sends, the sender receives a DPMSG_SENDCOMPLETE with it unless it opted out
+	uint32 id = 0;
+	if (!m_pClient->SendData(input, &id))
+	{
+		return DPERR_GENERIC;
+	}
+
+	if (!(flags & DPSEND_ASYNC))
+	{
+		return DP_OK;
 	}
 
-	return m_pClient->SendData(from, to, data, size, flags & DPSEND_GUARANTEED, !(flags & DPSEND_ASYNC)) ? DPERR_PENDING : DPERR_GENERIC;
+	if (msgid)
+	{
+		*msgid = id;
+	}
+	return DPERR_PENDING;
+}
+
+HRESULT CSteamPlayProvider::Receive(LPDPID from, LPDPID to, DWORD flags, LPVOID data, LPDWORD size)
+{
+	Update();
+
+	// a lost session still hands out DPSYS_SESSIONLOST and what arrived before it
+	if (!m_pClient || (!m_pClient->IsConnected() && !m_pClient->HasDataMessages()))
+	{
+		return DPERR_NOCONNECTION;
+	}
+
+	return m_pClient->ReceiveData(from, to, flags, data, size);
+}
+
+HRESULT CSteamPlayProvider::Send(DPID from, DPID to, DWORD flags, LPVOID data, DWORD size)
+{
+	// priority 0 and no timeout, just like DirectPlay does it
+	return SendEx(from, to, flags, data, size, 0, 0, nullptr, nullptr);
 }
 
 HRESULT CSteamPlayProvider::SetSessionDesc(LPDPSESSIONDESC2 description, DWORD flags)
@@ -505,6 +601,42 @@ HRESULT CSteamPlayProvider::SetSessionDesc(LPDPSESSIONDESC2 description, DWORD f
 
 HRESULT CSteamPlayProvider::CancelMessage(DWORD msgid, DWORD flags)
 {
+	Update();
+
+	if (flags != 0)
+	{
+		return DPERR_INVALIDFLAGS;
+	}
+
+	if (!m_pClient || !m_pClient->IsConnected())
+	{
+		return DPERR_NOCONNECTION;
+	}
+
+	// messages that were handed to steam already cannot be cancelled anymore
+	return m_pClient->CancelMessage(msgid) || msgid == 0 ? DP_OK : DPERR_UNKNOWNMESSAGE;
+}
+
+HRESULT CSteamPlayProvider::CancelPriority(DWORD minPriority, DWORD maxPriority, DWORD flags)
+{
+	Update();
+
+	if (flags != 0)
+	{
+		return DPERR_INVALIDFLAGS;
+	}
+
+	if (minPriority > maxPriority || maxPriority > 0xFFFF)
+	{
+		return DPERR_INVALIDPARAM;
+	}
+
+	if (!m_pClient || !m_pClient->IsConnected())
+	{
+		return DPERR_NOCONNECTION;
+	}
+
+	m_pClient->CancelPriority(static_cast<uint16>(minPriority), static_cast<uint16>(maxPriority));
 	return DP_OK;
 }
 
@@ -517,8 +649,26 @@ HRESULT CSteamPlayProvider::DestroyPlayer(DPID dpid)
 	return DPERR_NOCONNECTION;
 }
 
+HRESULT CSteamPlayProvider::GetPlayerName(DPID dpid, LPVOID data, LPDWORD size)
+{
+	if (!m_pClient || !m_pClient->IsConnected())
+	{
+		return DPERR_NOCONNECTION;
+	}
+
+	return m_pClient->GetPlayerName(dpid, data, size);
+}
+
 HRESULT CSteamPlayProvider::Close(void)
 {
+	if (m_pServer && m_pLobby)
+	{
+		// the standby host sets its server as the game server of the lobby once it took over
+		if (CSteamID const standbyOwner = m_pServer->GetStandbyOwner(); standbyOwner.IsValid())
+		{
+			m_pLobby->SetOwner(standbyOwner);
+		}
+	}
 	if (m_pClient)
 	{
 		m_pClient->Disconnect(EDisconnectReason::ClientDisconnect);
@@ -19,6 +19,7 @@ public:
 
 protected:
 	void    Update();
+	void    UpdateStandby();
 	HRESULT Join(const DPSESSIONDESC2& description);
 	HRESULT JoinLobby(CSteamID lobbyID, char const* password);
 	HRESULT JoinServer(CSteamID serverID, char const* password);
@@ -29,6 +30,8 @@ protected:
 	std::unique_ptr<CSteamPlayServer> m_pServer;
 	std::unique_ptr<CSteamLobby>      m_pLobby;
 
+	bool                              m_standbyReported = false;
+
 public:
 	// Inherited via IDirectPlay4
 	virtual HRESULT WINAPI InitializeConnection(void* connection, DWORD flags) override;
@@ -40,7 +43,9 @@ public:
 	virtual HRESULT WINAPI Send(DPID from, DPID to, DWORD flags, LPVOID data, DWORD size) override;
 	virtual HRESULT WINAPI SetSessionDesc(LPDPSESSIONDESC2 description, DWORD flags) override;
 	virtual HRESULT WINAPI CancelMessage(DWORD msgid, DWORD flags) override;
+	virtual HRESULT WINAPI CancelPriority(DWORD minPriority, DWORD maxPriority, DWORD flags) override;
 	virtual HRESULT WINAPI DestroyPlayer(DPID dpid) override;
+	virtual HRESULT WINAPI GetPlayerName(DPID dpid, LPVOID data, LPDWORD size) override;
 	virtual HRESULT WINAPI Close(void) override;
 
 	virtual HRESULT WINAPI AddPlayerToGroup(DPID, DPID) override { return E_NOTIMPL; }
@@ -57,7 +62,6 @@ public:
 	virtual HRESULT WINAPI GetPlayerAddress(DPID, LPVOID, LPDWORD) override { return E_NOTIMPL; }
 	virtual HRESULT WINAPI GetPlayerCaps(DPID, LPDPCAPS, DWORD) override { return E_NOTIMPL; }
 	virtual HRESULT WINAPI GetPlayerData(DPID, LPVOID, LPDWORD, DWORD) override { return E_NOTIMPL; }
-	virtual HRESULT WINAPI GetPlayerName(DPID, LPVOID, LPDWORD) override { return E_NOTIMPL; }
 	virtual HRESULT WINAPI GetSessionDesc(LPVOID, LPDWORD) override { return E_NOTIMPL; }
 	virtual HRESULT WINAPI Initialize(LPGUID) override { return E_NOTIMPL; }
 	virtual HRESULT WINAPI SetGroupData(DPID, LPVOID, DWORD, DWORD) override { return E_NOTIMPL; }
@@ -81,6 +85,5 @@ public:
 	virtual HRESULT WINAPI GetGroupOwner(DPID, LPDPID) override { return E_NOTIMPL; }
 	virtual HRESULT WINAPI SetGroupOwner(DPID, DPID) override { return E_NOTIMPL; }
 	virtual HRESULT WINAPI GetMessageQueue(DPID, DPID, DWORD, LPDWORD, LPDWORD) override { return E_NOTIMPL; }
-	virtual HRESULT WINAPI CancelPriority(DWORD, DWORD, DWORD) override { return E_NOTIMPL; }
 };
 
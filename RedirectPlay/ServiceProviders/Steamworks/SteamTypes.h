@@ -4,6 +4,7 @@
 
 #include "Steam/steamnetworkingtypes.h"
 
+#include <array>
 #include <chrono>
 
 using TClock = std::chrono::steady_clock;
@@ -17,10 +18,29 @@ enum class EDisconnectReason
 	ServerClosed,
 	ServerReject,
 	ServerFull,
-	ClientKicked
+	ClientKicked,
+	ClientResume, // the connection was replaced by a new one of the same session, see CReplayBuffer
 };
 
-static void ReleaseSteamMessage(SteamNetworkingMessage_t* pMessage)
+// Steam networking lanes, reliable messages keep their order only within a lane.
+// Control messages and data without a priority share ELane::Default, so their order is kept as well.
+// Without EFeature::Lanes everything is sent on ELane::Default.
+enum class ELane : uint16
+{
+	Default,
+	High,    // served before the other lanes
+	Bulk,    // large transfers that must not delay gameplay traffic
+	Count,
+};
+
+// With EFeature::Unordered reliable data of ELane::Default is spread over this many lanes following ELane::Count,
+// see SSteamPlayConfig::GetStreamLane.
+static constexpr uint16 s_unorderedLanes = 4;
+
+// Reliable messages per steam lane, see CReplayBuffer.
+using TLaneCounts = std::array<uint32, static_cast<size_t>(ELane::Count) + s_unorderedLanes>;
+
+inline void ReleaseSteamMessage(SteamNetworkingMessage_t* pMessage)
 {
 	pMessage->Release();
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string.h>
+#include <wchar.h>
 #include <utility>
 
 // A null-terminated fixed size char array. TSize is the _total_ size of the array, including the terminating null-char.
@@ -110,7 +111,7 @@ public:
 	// Returns the max size that should be read & written to (excluding the terminating null-character).
 	constexpr size_t max_size() const noexcept { return s_maxSize; }
 	// Returns the actual string length.
-	size_t size() const noexcept { return strnlen(m_data, s_maxSize); }
+	size_t size() const noexcept { return length(m_data, s_maxSize); }
 
 	// If you modify this make sure the last character stays null-terminated!
 	TChar*       data() noexcept           { return m_data; }
@@ -160,11 +161,14 @@ protected:
 
 	static void copyImpl(TChar* dest, TChar const* src, size_t lastIndex)
 	{
-		const size_t len = strnlen(src, lastIndex);
-		memcpy(dest, src, len);
+		const size_t len = length(src, lastIndex);
+		memcpy(dest, src, len * sizeof(TChar));
 		dest[len] = 0;
 	}
 
+	static size_t length(char const* src, size_t maxLen) noexcept    { return strnlen(src, maxLen); }
+	static size_t length(wchar_t const* src, size_t maxLen) noexcept { return wcsnlen(src, maxLen); }
+
 	TChar m_data[s_arraySize];
 };
 